@@ -4,119 +4,1087 @@
 #include <iomanip>
 #include <limits>
 #include <stdexcept>
+#include <variant>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <cstdio>
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <chrono>
 #include <memory>
+#include <new>
+#include <iterator>
+#include <type_traits>
+#include <algorithm>
+#include <string_view>
+#include <unordered_set>
+#include <set>
+#include <tuple>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <array>
+#include <optional>
+#include <random>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <csignal>
+#include <cerrno>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <io.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#endif
 
 using namespace std;
 
-class BillingStrategy { 
+// Optional instrumentation of the public Hotel operations, compiled in with
+// -DHOTEL_INSTRUMENTATION. Each operation opens a HOTEL_PROFILE scope that counts the call, adds
+// its latency to a power-of-two histogram and sums the elements its loops visit, as reported
+// through HOTEL_SCANNED. Counters are relaxed atomics, so recording never takes a lock.
+// Without the flag both macros expand to nothing.
+#ifdef HOTEL_INSTRUMENTATION
+enum class HotelOp : uint8_t {
+    ADD_ROOM, DELETE_ROOM, UPDATE_RATE, UPDATE_BILLING, SET_RATE_RULE, MAKE_RESERVATION, AUTO_ASSIGN, RESERVE_BLOCK,
+    CANCEL_RESERVATION, CHANGE_GUESTS, CHANGE_ROOM, CHANGE_DATES, VIEW_RESERVATION, GET_RESERVATION,
+    COMPUTE_BILLS, QUOTE_STAY, CHEAPEST_AVAILABLE, SHOW_RATES, SHOW_AVAILABLE, SEARCH_AVAILABLE, SHOW_ROOMS, SHOW_RESERVATIONS,
+    FIND_ROOMS, FIND_RESERVATIONS, FIND_GUESTS, STATS, SAVE_SNAPSHOT, CHECKPOINT, LOAD_SNAPSHOT,
+    REPLAY_JOURNAL, IMPORT_ROOMS, IMPORT_RESERVATIONS, CHANGES_SINCE, JOIN_WAITLIST, LEAVE_WAITLIST, SHOW_WAITLIST,
+    OPTIMIZE_ASSIGNMENTS, CHECK_OUT, ARCHIVE_STAYS, ARCHIVE_SUMMARY, COUNT
+};
+
+class HotelMetrics {
+public:
+    static constexpr size_t BUCKETS = 40;           // bucket b: latencies in [2^(b-1), 2^b) ns
+
+private:
+    struct Counters {
+        atomic<uint64_t> calls{0};
+        atomic<uint64_t> scanned{0};
+        atomic<uint64_t> nanoseconds{0};
+        array<atomic<uint64_t>, BUCKETS> histogram{};
+    };
+
+    array<Counters, static_cast<size_t>(HotelOp::COUNT)> counters;
+
+    static const char* name(HotelOp op) {
+        static const char* const names[] = {
+            "addRoom", "deleteRoom", "updateRoomRate", "updateRoomBilling", "setRateRule", "makeReservation", "autoAssign",
+            "reserveBlock", "cancelReservation", "changeGuests", "changeRoom", "changeDates",
+            "viewReservationDetails", "getReservation", "computeBills", "quoteStay", "cheapestAvailable",
+            "showRoomPriceRates",
+            "showAvailableRooms", "searchAvailableRooms", "showAllRooms", "showAllReservations", "findRooms",
+            "findReservations", "findGuests", "stats", "saveSnapshot", "checkpoint", "loadSnapshot",
+            "replayJournal", "importRooms", "importReservations", "changesSince", "joinWaitlist", "leaveWaitlist",
+            "showWaitlist", "optimizeAssignments", "checkOutReservation", "archiveCompletedStays", "archiveSummary"
+        };
+        return names[static_cast<size_t>(op)];
+    }
+
+    // Upper bound of the bucket holding the p-th fraction of the calls, in microseconds.
+    static double percentile(const Counters& counter, uint64_t calls, double p) {
+        uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(calls - 1)) + 1, seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += counter.histogram[b].load(memory_order_relaxed);
+            if (seen >= rank) return static_cast<double>(uint64_t(1) << b) / 1000.0;
+        }
+        return static_cast<double>(uint64_t(1) << (BUCKETS - 1)) / 1000.0;
+    }
+
+public:
+    static HotelMetrics& instance() {
+        static HotelMetrics metrics;
+        return metrics;
+    }
+
+    void record(HotelOp op, uint64_t nanoseconds, uint64_t scanned) {
+        Counters& counter = counters[static_cast<size_t>(op)];
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKETS && (nanoseconds >> bucket) != 0) ++bucket;
+        counter.calls.fetch_add(1, memory_order_relaxed);
+        counter.scanned.fetch_add(scanned, memory_order_relaxed);
+        counter.nanoseconds.fetch_add(nanoseconds, memory_order_relaxed);
+        counter.histogram[bucket].fetch_add(1, memory_order_relaxed);
+    }
+
+    // One line per operation that was called. Percentiles are bucket upper bounds, so they are
+    // within a factor of two above the true value.
+    void write(ostream& os) const {
+        os << left << setw(24) << "Operation"
+           << right << setw(10) << "Calls"
+           << right << setw(12) << "Mean (us)"
+           << right << setw(12) << "p50 (us)"
+           << right << setw(12) << "p99 (us)"
+           << right << setw(14) << "Scanned"
+           << right << setw(12) << "Per call" << "\n";
+        for (size_t i = 0; i < counters.size(); ++i) {
+            const Counters& counter = counters[i];
+            uint64_t calls = counter.calls.load(memory_order_relaxed);
+            if (calls == 0) continue;
+            uint64_t scanned = counter.scanned.load(memory_order_relaxed);
+            os << left << setw(24) << name(static_cast<HotelOp>(i))
+               << right << setw(10) << calls
+               << right << setw(12) << fixed << setprecision(2) << counter.nanoseconds.load(memory_order_relaxed) / 1000.0 / calls
+               << right << setw(12) << percentile(counter, calls, 0.50)
+               << right << setw(12) << percentile(counter, calls, 0.99)
+               << right << setw(14) << scanned
+               << right << setw(12) << setprecision(1) << static_cast<double>(scanned) / calls << "\n";
+        }
+        os << left;
+    }
+};
+
+// Times one operation and collects what HOTEL_SCANNED reports inside it; a nested operation
+// keeps its own count.
+class OperationScope {
+private:
+    static inline thread_local OperationScope* current = nullptr;
+
+    HotelOp op;
+    chrono::steady_clock::time_point start;
+    uint64_t scanned = 0;
+    OperationScope* outer;
+
 public:
-    virtual double calculateBill(double baseRate, int nights) const = 0;
-    virtual string getBillingType() const = 0;
-    virtual ~BillingStrategy() = default;
+    explicit OperationScope(HotelOp operation) : op(operation), start(chrono::steady_clock::now()), outer(current) {
+        current = this;
+    }
+
+    ~OperationScope() {
+        current = outer;
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        HotelMetrics::instance().record(op, static_cast<uint64_t>(elapsed), scanned);
+    }
+
+    OperationScope(const OperationScope&) = delete;
+    OperationScope& operator=(const OperationScope&) = delete;
+
+    static void addScanned(uint64_t count) {
+        if (current) current->scanned += count;
+    }
+};
+
+#define HOTEL_PROFILE(op) OperationScope hotelOperation(HotelOp::op)
+#define HOTEL_SCANNED(count) OperationScope::addScanned(static_cast<uint64_t>(count))
+#else
+#define HOTEL_PROFILE(op) ((void)0)
+#define HOTEL_SCANNED(count) ((void)0)
+#endif
+
+// Everything that tells the billing strategies apart, by BillingStrategy::index(). Labels,
+// batch keywords, menus and multipliers all come from here; a new strategy is one more entry
+// and one more CatalogBilling alternative in BillingStrategy.
+struct BillingKind {
+    const char* label;          // in listings
+    const char* keyword;        // in batch files and imports
+    const char* menuText;
+    double multiplier;          // of the base rate
+};
+
+inline constexpr array<BillingKind, 3> BILLING_KINDS = {{
+    { "Regular", "REGULAR", "Regular Rate", 1.0 },
+    { "Premium", "PREMIUM", "Premium Rate (10% service charge)", 1.10 },
+    { "Corporate", "CORPORATE", "Corporate Rate (15% discount)", 0.85 },
+}};
+
+// Billing strategies are stateless value types held by value in the BillingStrategy variant,
+// so a room needs no heap allocation for its strategy. nights is the stay in nights at the
+// base rate, which the rate calendar may weight.
+template <size_t Kind>
+struct CatalogBilling {
+    static constexpr size_t kind = Kind;
+    static constexpr double multiplier = BILLING_KINDS[Kind].multiplier;
+    double calculateBill(double baseRate, double nights) const {
+        return baseRate * nights * multiplier;
+    }
+    const char* getBillingType() const {
+        return BILLING_KINDS[Kind].label;
+    }
+};
+
+using RegularBilling = CatalogBilling<0>;
+using PremiumBilling = CatalogBilling<1>;
+using CorporateBilling = CatalogBilling<2>;
+
+using BillingStrategy = variant<RegularBilling, PremiumBilling, CorporateBilling>;
+
+template <size_t... Kinds>
+constexpr array<BillingStrategy, sizeof...(Kinds)> billingStrategies(index_sequence<Kinds...>) {
+    static_assert(((variant_alternative_t<Kinds, BillingStrategy>::kind == Kinds) && ...), "alternatives must follow BILLING_KINDS");
+    return {{ BillingStrategy(in_place_index<Kinds>)... }};
+}
+
+// One of each strategy, by index.
+inline constexpr auto BILLING_STRATEGIES = billingStrategies(make_index_sequence<variant_size_v<BillingStrategy>>());
+static_assert(BILLING_STRATEGIES.size() == BILLING_KINDS.size(), "every billing kind needs a BillingStrategy alternative");
+
+// Inverse of BillingStrategy::index(), used when reading persisted rooms; unknown indexes are Regular.
+BillingStrategy billingStrategyFromIndex(size_t index) {
+    return BILLING_STRATEGIES[index < BILLING_STRATEGIES.size() ? index : 0];
+}
+
+const char* billingTypeName(const BillingStrategy& strategy) {
+    return BILLING_KINDS[strategy.index()].label;
+}
+
+double billingMultiplier(const BillingStrategy& strategy) {
+    return BILLING_KINDS[strategy.index()].multiplier;
+}
+
+// Everything that tells the room types apart, by Room::RoomType.
+struct RoomTypeInfo {
+    const char* label;          // in listings and menus
+    const char* keyword;        // in batch files and imports
+    int defaultMaxGuests;       // capacity of a room added without one
 };
 
-class RegularBilling : public BillingStrategy { 
+inline constexpr array<RoomTypeInfo, 4> ROOM_TYPES = {{
+    { "Single", "SINGLE", 1 },
+    { "Double", "DOUBLE", 2 },
+    { "Deluxe", "DELUXE", 4 },
+    { "Suite", "SUITE", 6 },
+}};
+
+// Days since 01/01/1970 for a proleptic Gregorian date.
+int daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = year - era * 400;
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+bool isLeapYear(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+int daysInMonth(int year, int month) {
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+// A calendar date stored as days since 01/01/1970, so comparison and night counting are integer math.
+class Date {
+private:
+    int32_t days;
+
 public:
-    double calculateBill(double baseRate, int nights) const override {
-        return baseRate * nights;
+    Date() : days(0) {}
+    explicit Date(int32_t dayNumber) : days(dayNumber) {}
+
+    // Parses DD/MM/YYYY; throws invalid_argument for anything that is not a real calendar date.
+    static Date parse(const string& text) {
+        optional<Date> date = fromText(text);
+        if (!date) throw invalid_argument("Invalid date '" + text + "'. Please use DD/MM/YYYY.");
+        return *date;
+    }
+
+    // DD/MM/YYYY with a year from 1 to 9999 (what format writes back), or nothing if text is not
+    // a valid date. Does not allocate or throw.
+    static optional<Date> fromText(string_view text) {
+        int parts[3];
+        const char* at = text.data();
+        const char* end = text.data() + text.size();
+        for (int i = 0; i < 3; ++i) {
+            if (i > 0) {
+                if (at == end || *at != '/') return nullopt;
+                ++at;
+            }
+            if (at != end && *at == '+') return nullopt;
+            from_chars_result parsed = from_chars(at, end, parts[i]);
+            if (parsed.ec != errc() || parsed.ptr == at) return nullopt;
+            at = parsed.ptr;
+        }
+        int day = parts[0], month = parts[1], year = parts[2];
+        if (at != end || year < 1 || year > 9999 || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)) {
+            return nullopt;
+        }
+        return Date(daysFromCivil(year, month, day));
+    }
+
+    static Date today() {
+        time_t now = time(nullptr);
+        tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return Date(daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday));
+    }
+
+    int32_t dayNumber() const { return days; }
+
+    void toCivil(int& year, int& month, int& day) const {
+        const int z = days + 719468;
+        const int era = (z >= 0 ? z : z - 146096) / 146097;
+        const int dayOfEra = z - era * 146097;
+        const int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        const int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        const int monthIndex = (5 * dayOfYear + 2) / 153;
+        day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+        month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+        year = yearOfEra + era * 400 + (month <= 2);
+    }
+
+    // Writes DD/MM/YYYY plus a terminator into buffer (at least 11 bytes).
+    void format(char* buffer) const {
+        int year, month, day;
+        toCivil(year, month, day);
+        buffer[0] = static_cast<char>('0' + day / 10);
+        buffer[1] = static_cast<char>('0' + day % 10);
+        buffer[2] = '/';
+        buffer[3] = static_cast<char>('0' + month / 10);
+        buffer[4] = static_cast<char>('0' + month % 10);
+        buffer[5] = '/';
+        for (int i = 9; i >= 6; --i, year /= 10) {
+            buffer[i] = static_cast<char>('0' + year % 10);
+        }
+        buffer[10] = '\0';
     }
-    string getBillingType() const override {
-        return "Regular";
+
+    string toString() const {
+        char buffer[16];
+        format(buffer);
+        return buffer;
     }
+
+    Date operator+(int nights) const { return Date(days + nights); }
+    int operator-(Date other) const { return days - other.days; }
+    bool operator==(Date other) const { return days == other.days; }
+    bool operator!=(Date other) const { return days != other.days; }
+    bool operator<(Date other) const { return days < other.days; }
+    bool operator<=(Date other) const { return days <= other.days; }
 };
 
-class PremiumBilling : public BillingStrategy {
+ostream& operator<<(ostream& os, Date date) {
+    char buffer[16];
+    date.format(buffer);
+    return os << buffer;
+}
+
+// Booked stays of one room as half-open [checkIn, checkOut) day ranges.
+// Stays never overlap, so only the last stay starting before a range can collide with it.
+class RoomCalendar {
+private:
+    map<int, pair<int, int>> stays; // checkIn -> (checkOut, reservationID)
+    long long nights = 0;           // total over stays
+
 public:
-    double calculateBill(double baseRate, int nights) const override {
-        return baseRate * nights * 1.10; 
+    bool isFree(int checkIn, int checkOut) const {
+        auto it = stays.lower_bound(checkOut);
+        if (it == stays.begin()) return true;
+        --it;
+        return it->second.first <= checkIn;
     }
-    string getBillingType() const override {
-        return "Premium";
+
+    bool book(int checkIn, int checkOut, int reservationID) {
+        if (!isFree(checkIn, checkOut)) return false;
+        stays.emplace(checkIn, make_pair(checkOut, reservationID));
+        nights += checkOut - checkIn;
+        return true;
+    }
+
+    // Returns false if the stay starting at checkIn is not this reservation's, as happens when a
+    // reservation outlives its room and the room number is reused.
+    bool release(int checkIn, int reservationID) {
+        auto it = stays.find(checkIn);
+        if (it == stays.end() || it->second.second != reservationID) return false;
+        nights -= it->second.first - checkIn;
+        stays.erase(it);
+        return true;
+    }
+    size_t bookingCount() const { return stays.size(); }
+    long long bookedNights() const { return nights; }
+
+    // Calls visit(checkIn, checkOut, reservationID) for every stay overlapping [from, to).
+    template <typename Visit>
+    void forEachBooking(int from, int to, Visit visit) const {
+        auto it = stays.lower_bound(from);
+        if (it != stays.begin() && prev(it)->second.first > from) --it;
+        for (; it != stays.end() && it->first < to; ++it) visit(it->first, it->second.first, it->second.second);
+    }
+
+    // Calls visit(checkIn, checkOut) for every stay overlapping [from, to).
+    template <typename Visit>
+    void forEachStay(int from, int to, Visit visit) const {
+        forEachBooking(from, to, [&](int checkIn, int checkOut, int) { visit(checkIn, checkOut); });
+    }
+
+    // Calls visit(start, end) for every run of free nights overlapping [from, to). Runs are
+    // whole: they reach past from and to as far as the nights are free, with INT_MIN and INT_MAX
+    // standing for no stay before or after.
+    template <typename Visit>
+    void forEachFreeRun(int from, int to, Visit visit) const {
+        auto it = stays.lower_bound(from);
+        int start = it == stays.begin() ? numeric_limits<int>::min() : prev(it)->second.first;
+        while (start < to) {
+            int end = it == stays.end() ? numeric_limits<int>::max() : it->first;
+            if (start < end && end > from) visit(start, end);
+            if (it == stays.end()) break;
+            start = it->second.first;
+            ++it;
+        }
+    }
+};
+
+// One change to a room type's RateCalendar, in the form it is journaled and snapshotted in.
+struct RateRule {
+    enum class Kind : uint8_t { SEASON, NIGHT, WEEKDAY, STAY_DISCOUNT, RESET };
+
+    Kind kind;
+    int32_t from;   // SEASON and NIGHT: first night; WEEKDAY: 0 = Monday; STAY_DISCOUNT: minimum nights
+    int32_t to;     // SEASON and NIGHT: night after the last
+    double value;   // price factor of the base rate, or the discount percent for STAY_DISCOUNT
+
+    // Nights whose price the rule can change, as a half-open day range.
+    pair<int32_t, int32_t> affectedNights() const {
+        if (kind == Kind::SEASON || kind == Kind::NIGHT) return make_pair(from, to);
+        return make_pair(numeric_limits<int32_t>::min(), numeric_limits<int32_t>::max());
     }
 };
 
-class CorporateBilling : public BillingStrategy {
-public: 
-    double calculateBill(double baseRate, int nights) const override {
-        return baseRate * nights * 0.85; 
+// Nightly prices of one room type, as factors of each room's base rate. A night's factor is its
+// override if it has one, otherwise its season factor times its weekday factor, and the whole
+// stay is then discounted by the longest length-of-stay tier it reaches.
+// Seasons and overrides live in a window of nights whose factors are kept as prefix sums in
+// blocks of 64: the factor total of any stay is two lookups however long it is, and a change
+// rebuilds only the blocks it touches plus the running total of each later block. Nights outside
+// the window carry only their weekday factor, which sums in closed form over whole weeks.
+class RateCalendar {
+public:
+    static constexpr int32_t MAX_WINDOW = 20 * 366; // nights from the first season or override to the last
+
+private:
+    static constexpr size_t BLOCK = 64;
+
+    array<double, 7> weekday;            // Monday first
+    array<double, 8> weekPrefix;         // weekPrefix[k]: total of the first k weekday factors
+    int32_t origin = 0;                  // first night of the window
+    vector<double> season;               // by night in the window; 1 outside every season
+    vector<double> nightOverride;        // by night in the window; 0 for none
+    vector<double> withinBlock;          // by night, one past the window: total since its block began
+    vector<double> blockStart;           // total before each block
+    vector<double> blockTotal;
+    map<int32_t, double> stayDiscounts;  // minimum nights -> percent
+    vector<double> stayFactor;           // by nights, up to the longest tier
+
+    // 01/01/1970 was a Thursday; weekdays count from Monday.
+    static int weekdayOf(int64_t day) { return static_cast<int>(((day + 3) % 7 + 7) % 7); }
+
+    // Total of the weekday factors over [0, day) counted from Monday 29/12/1969, for any sign of day.
+    double weeksBefore(int64_t day) const {
+        int64_t offset = day + 3;
+        int64_t weeks = offset >= 0 ? offset / 7 : -((-offset + 6) / 7);
+        return static_cast<double>(weeks) * weekPrefix[7] + weekPrefix[static_cast<size_t>(offset - weeks * 7)];
+    }
+
+    double weekdaySum(int64_t from, int64_t to) const { return weeksBefore(to) - weeksBefore(from); }
+
+    double factorAt(size_t night) const {
+        return nightOverride[night] > 0.0 ? nightOverride[night] : season[night] * weekday[static_cast<size_t>(weekdayOf(origin + static_cast<int64_t>(night)))];
+    }
+
+    // Factor total over the first `nights` nights of the window.
+    double windowPrefix(size_t nights) const { return blockStart[nights / BLOCK] + withinBlock[nights]; }
+
+    // Rebuilds the prefix sums of the blocks holding window nights [first, end), then the
+    // running totals from there to the end of the window.
+    void rebuild(size_t first, size_t end) {
+        const size_t nights = season.size();
+        const size_t blocks = nights / BLOCK + 1;
+        withinBlock.resize(nights + 1);
+        blockStart.resize(blocks);
+        blockTotal.resize(blocks);
+        const size_t firstBlock = first / BLOCK;
+        const size_t lastBlock = min(end, nights) / BLOCK;
+        for (size_t block = firstBlock; block <= lastBlock; ++block) {
+            double sum = 0.0;
+            for (size_t night = block * BLOCK; night < min((block + 1) * BLOCK, nights + 1); ++night) {
+                withinBlock[night] = sum;
+                if (night < nights) sum += factorAt(night);
+            }
+            blockTotal[block] = sum;
+        }
+        if (firstBlock == 0) blockStart[0] = 0.0;
+        for (size_t block = max<size_t>(firstBlock, 1); block < blocks; ++block) {
+            blockStart[block] = blockStart[block - 1] + blockTotal[block - 1];
+        }
+    }
+
+    void rebuildAll() { rebuild(0, season.size()); }
+
+    // Widens the window to hold [from, to); returns true if it had to grow.
+    bool cover(int32_t from, int32_t to) {
+        if (season.empty()) {
+            origin = from;
+            season.assign(static_cast<size_t>(to - from), 1.0);
+            nightOverride.assign(season.size(), 0.0);
+            return true;
+        }
+        int32_t end = origin + static_cast<int32_t>(season.size());
+        if (from >= origin && to <= end) return false;
+        int32_t newOrigin = min(origin, from);
+        size_t before = static_cast<size_t>(origin - newOrigin);
+        size_t after = static_cast<size_t>(max(end, to) - end);
+        season.insert(season.begin(), before, 1.0);
+        season.insert(season.end(), after, 1.0);
+        nightOverride.insert(nightOverride.begin(), before, 0.0);
+        nightOverride.insert(nightOverride.end(), after, 0.0);
+        origin = newOrigin;
+        return true;
+    }
+
+    void rebuildWeek() {
+        weekPrefix[0] = 0.0;
+        for (size_t day = 0; day < 7; ++day) weekPrefix[day + 1] = weekPrefix[day] + weekday[day];
+    }
+
+    void rebuildStayFactors() {
+        stayFactor.clear();
+        if (stayDiscounts.empty()) return;
+        stayFactor.assign(static_cast<size_t>(stayDiscounts.rbegin()->first) + 1, 1.0);
+        for (const auto& [nights, percent] : stayDiscounts) {
+            fill(stayFactor.begin() + nights, stayFactor.end(), 1.0 - percent / 100.0);
+        }
+    }
+
+public:
+    RateCalendar() { reset(); }
+
+    static const char* weekdayName(int weekday) {
+        static const char* const names[] = { "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday" };
+        return weekday >= 0 && weekday < 7 ? names[weekday] : "Unknown";
+    }
+
+    void reset() {
+        weekday.fill(1.0);
+        rebuildWeek();
+        origin = 0;
+        season.clear();
+        nightOverride.clear();
+        withinBlock.assign(1, 0.0);
+        blockStart.assign(1, 0.0);
+        blockTotal.assign(1, 0.0);
+        stayDiscounts.clear();
+        stayFactor.clear();
+    }
+
+    // Why the rule cannot be applied, or null if it can.
+    const char* problem(const RateRule& rule) const {
+        switch (rule.kind) {
+            case RateRule::Kind::SEASON:
+            case RateRule::Kind::NIGHT: {
+                if (rule.to <= rule.from) return "The season must end after it starts.";
+                if (!(rule.value > 0.0)) return "The price factor must be positive.";
+                int64_t first = season.empty() ? rule.from : min<int64_t>(origin, rule.from);
+                int64_t last = season.empty() ? rule.to : max<int64_t>(origin + static_cast<int64_t>(season.size()), rule.to);
+                if (last - first > MAX_WINDOW) return "Seasons and night rates may span at most 20 years.";
+                return nullptr;
+            }
+            case RateRule::Kind::WEEKDAY:
+                if (rule.from < 0 || rule.from > 6) return "Unknown weekday.";
+                return rule.value > 0.0 ? nullptr : "The price factor must be positive.";
+            case RateRule::Kind::STAY_DISCOUNT:
+                if (rule.from < 1 || rule.from > MAX_WINDOW) return "The minimum stay must be between 1 and 7320 nights.";
+                return rule.value >= 0.0 && rule.value < 100.0 ? nullptr : "The discount must be at least 0% and below 100%.";
+            case RateRule::Kind::RESET:
+                return nullptr;
+        }
+        return "Unknown rate rule.";
+    }
+
+    // Expects a rule that problem() accepted.
+    void apply(const RateRule& rule) {
+        switch (rule.kind) {
+            case RateRule::Kind::SEASON:
+            case RateRule::Kind::NIGHT: {
+                bool grown = cover(rule.from, rule.to);
+                vector<double>& nights = rule.kind == RateRule::Kind::SEASON ? season : nightOverride;
+                size_t first = static_cast<size_t>(rule.from - origin), end = static_cast<size_t>(rule.to - origin);
+                fill(nights.begin() + static_cast<ptrdiff_t>(first), nights.begin() + static_cast<ptrdiff_t>(end), rule.value);
+                if (grown) rebuildAll();
+                else rebuild(first, end);
+                break;
+            }
+            case RateRule::Kind::WEEKDAY:
+                weekday[static_cast<size_t>(rule.from)] = rule.value;
+                rebuildWeek();
+                rebuildAll();
+                break;
+            case RateRule::Kind::STAY_DISCOUNT:
+                if (rule.value == 0.0) stayDiscounts.erase(rule.from);
+                else stayDiscounts[rule.from] = rule.value;
+                rebuildStayFactors();
+                break;
+            case RateRule::Kind::RESET:
+                reset();
+                break;
+        }
+    }
+
+    // Total of the nightly factors over [checkIn, checkOut).
+    double nightFactors(Date checkIn, Date checkOut) const {
+        int64_t from = checkIn.dayNumber(), to = checkOut.dayNumber();
+        int64_t first = origin, end = origin + static_cast<int64_t>(season.size());
+        if (season.empty() || to <= first || from >= end) return weekdaySum(from, to);
+        double total = 0.0;
+        if (from < first) total += weekdaySum(from, first);
+        total += windowPrefix(static_cast<size_t>(min(to, end) - first)) - windowPrefix(static_cast<size_t>(max(from, first) - first));
+        if (to > end) total += weekdaySum(end, to);
+        return total;
+    }
+
+    double stayDiscountFactor(int nights) const {
+        if (stayFactor.empty() || nights <= 0) return 1.0;
+        return stayFactor[min(static_cast<size_t>(nights), stayFactor.size() - 1)];
+    }
+
+    // What a stay counts as in nights at the base rate; equal to the night count when flat.
+    double ratedNights(Date checkIn, Date checkOut) const {
+        return nightFactors(checkIn, checkOut) * stayDiscountFactor(checkOut - checkIn);
     }
-    string getBillingType() const override {
-        return "Corporate";
+
+    // The rules that rebuild this calendar from a flat one.
+    vector<RateRule> rules() const {
+        vector<RateRule> found;
+        for (int32_t day = 0; day < 7; ++day) {
+            if (weekday[static_cast<size_t>(day)] != 1.0) found.push_back({ RateRule::Kind::WEEKDAY, day, day + 1, weekday[static_cast<size_t>(day)] });
+        }
+        for (size_t night = 0; night < season.size();) {
+            size_t end = night + 1;
+            while (end < season.size() && season[end] == season[night]) ++end;
+            if (season[night] != 1.0) {
+                found.push_back({ RateRule::Kind::SEASON, origin + static_cast<int32_t>(night), origin + static_cast<int32_t>(end), season[night] });
+            }
+            night = end;
+        }
+        for (size_t night = 0; night < nightOverride.size(); ++night) {
+            if (nightOverride[night] > 0.0) {
+                int32_t day = origin + static_cast<int32_t>(night);
+                found.push_back({ RateRule::Kind::NIGHT, day, day + 1, nightOverride[night] });
+            }
+        }
+        for (const auto& [nights, percent] : stayDiscounts) found.push_back({ RateRule::Kind::STAY_DISCOUNT, nights, 0, percent });
+        return found;
     }
 };
 
 class Room { 
 public:
-    enum class RoomType { SINGLE, DOUBLE, DELUXE, SUITE };
+    enum class RoomType { SINGLE, DOUBLE, DELUXE, SUITE };   // one per ROOM_TYPES entry
+    static constexpr size_t TYPE_COUNT = ROOM_TYPES.size();
+    static_assert(static_cast<size_t>(RoomType::SUITE) + 1 == TYPE_COUNT, "every room type needs a ROOM_TYPES entry");
 
 private:
     int roomNumber;
     RoomType type;
     double baseRate;
-    bool isAvailable;
-    unique_ptr<BillingStrategy> billingStrategy;
+    RoomCalendar calendar;
+    double ratedNights = 0.0;   // booked stays priced by the type's rate calendar; kept by Hotel
+    BillingStrategy billingStrategy;
     int maxGuests;
 
 public:
-    Room(int number, RoomType roomType, double rate, unique_ptr<BillingStrategy> strategy, int guests)
-        : roomNumber(number), type(roomType), baseRate(rate), isAvailable(true), billingStrategy(move(strategy)), maxGuests(guests) {}
+    Room(int number, RoomType roomType, double rate, BillingStrategy strategy, int guests)
+        : roomNumber(number), type(roomType), baseRate(rate), billingStrategy(strategy), maxGuests(guests) {}
 
     int getRoomNumber() const { return roomNumber; }
     RoomType getType() const { return type; }
     double getBaseRate() const { return baseRate; }
-    bool isRoomAvailable() const { return isAvailable; }
-    void setAvailability(bool available) { isAvailable = available; }
+    // Free tonight; use isAvailableFor for a specific stay.
+    bool isRoomAvailable() const {
+        Date today = Date::today();
+        return isAvailableFor(today, today + 1);
+    }
+    bool isAvailableFor(Date checkIn, Date checkOut) const { return calendar.isFree(checkIn.dayNumber(), checkOut.dayNumber()); }
+    bool book(Date checkIn, Date checkOut, int reservationID) { return calendar.book(checkIn.dayNumber(), checkOut.dayNumber(), reservationID); }
+    bool release(Date checkIn, int reservationID) { return calendar.release(checkIn.dayNumber(), reservationID); }
+    long long getBookedNights() const { return calendar.bookedNights(); }
+    double getRatedNights() const { return ratedNights; }
+    void addRatedNights(double nights) { ratedNights = calendar.bookedNights() == 0 ? 0.0 : ratedNights + nights; }
+    template <typename Visit>
+    void forEachStay(int from, int to, Visit visit) const { calendar.forEachStay(from, to, visit); }
+    template <typename Visit>
+    void forEachBooking(int from, int to, Visit visit) const { calendar.forEachBooking(from, to, visit); }
+    template <typename Visit>
+    void forEachFreeRun(int from, int to, Visit visit) const { calendar.forEachFreeRun(from, to, visit); }
     void setBaseRate(double newRate) { baseRate = newRate; }
-    void setBillingStrategy(unique_ptr<BillingStrategy> strategy) { billingStrategy = move(strategy); }
+    void setBillingStrategy(BillingStrategy strategy) { billingStrategy = strategy; }
+    const BillingStrategy& getBillingStrategy() const { return billingStrategy; }
     int getMaxGuests() const { return maxGuests; }
 
-    double calculateBill(int nights) const {
+    static double billFor(const BillingStrategy& strategy, double rate, double nights) {
         if (nights <= 0) throw invalid_argument("Number of nights must be positive.");
-        return billingStrategy->calculateBill(baseRate, nights);
+        return rate * nights * billingMultiplier(strategy);
+    }
+
+    // At the base rate on every night.
+    double calculateBill(int nights) const {
+        return billFor(billingStrategy, baseRate, nights);
+    }
+
+    // At the calendar's prices for the stay; O(1) for any length of stay.
+    double calculateBill(const RateCalendar& rates, Date checkIn, Date checkOut) const {
+        return billFor(billingStrategy, baseRate, rates.ratedNights(checkIn, checkOut));
+    }
+
+    static const char* typeLabel(RoomType roomType) {
+        size_t index = static_cast<size_t>(roomType);
+        return index < TYPE_COUNT ? ROOM_TYPES[index].label : "Unknown";
+    }
+
+    // Capacity that goes with each room type when none is given.
+    static int defaultMaxGuests(RoomType roomType) {
+        size_t index = static_cast<size_t>(roomType);
+        return index < TYPE_COUNT ? ROOM_TYPES[index].defaultMaxGuests : 1;
+    }
+
+    // The type numbered choice (from 1) in the menus, if there is one.
+    static optional<RoomType> typeFromMenu(int choice) {
+        if (choice < 1 || static_cast<size_t>(choice) > TYPE_COUNT) return nullopt;
+        return static_cast<RoomType>(choice - 1);
+    }
+
+    // "1 Single, 2 Double, ..." for one-line menu prompts.
+    static string typeChoices() {
+        string text;
+        for (size_t i = 0; i < TYPE_COUNT; ++i) text += (i ? ", " : "") + to_string(i + 1) + " " + ROOM_TYPES[i].label;
+        return text;
+    }
+
+    const char* getRoomTypeString() const {
+        return typeLabel(type);
+    }
+
+    const char* getBillingStrategyString() const {
+        return billingTypeName(billingStrategy);
+    }
+};
+
+// Key of the guest-name index: names compare case-insensitively.
+string guestKey(string_view name) {
+    string key(name);
+    for (char& c : key) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return key;
+}
+
+// Append-only storage for strings that live as long as the arena. Each string is copied into
+// a large block and handed out as a view, so storing one is a copy instead of a heap
+// allocation; strings larger than a quarter block get a block of their own.
+class StringArena {
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> blocks;
+    char* next = nullptr;
+    size_t left = 0;                      // free bytes at next
+
+public:
+    string_view store(string_view text) {
+        if (text.empty()) return {};
+        if (text.size() > BLOCK_SIZE / 4) {
+            blocks.push_back(make_unique<char[]>(text.size()));
+            memcpy(blocks.back().get(), text.data(), text.size());
+            return string_view(blocks.back().get(), text.size());
+        }
+        if (text.size() > left) {
+            blocks.push_back(make_unique<char[]>(BLOCK_SIZE));
+            next = blocks.back().get();
+            left = BLOCK_SIZE;
+        }
+        char* stored = next;
+        memcpy(stored, text.data(), text.size());
+        next += text.size();
+        left -= text.size();
+        return string_view(stored, text.size());
+    }
+
+    void clear() {
+        blocks.clear();
+        next = nullptr;
+        left = 0;
+    }
+};
+
+// One record per guest, shared by all of that guest's reservations. The text lives in the
+// directory's arena and the record stays put until the directory is cleared, so a
+// Reservation points at its guest instead of owning any strings.
+struct Guest {
+    uint32_t guestID;
+    string_view name;
+    string_view contact;
+    string_view key;                      // guestKey(name)
+};
+
+struct GuestMatch {
+    const Guest* guest;
+    double score;                         // 1 for a prefix match, else the share of query trigrams found
+    vector<int> reservationIDs;           // live reservations, ascending
+};
+
+// Sorts on up to threads threads: equal slices are sorted at the same time, then merged pairwise.
+template <typename T>
+void parallelSort(vector<T>& items, size_t threads) {
+    size_t slices = min(threads, items.size() / 65536);
+    if (slices <= 1) {
+        sort(items.begin(), items.end());
+        return;
+    }
+    vector<size_t> bounds(slices + 1);
+    for (size_t i = 0; i <= slices; ++i) bounds[i] = i * items.size() / slices;
+    auto at = [&](size_t slice) { return items.begin() + static_cast<ptrdiff_t>(bounds[slice]); };
+    vector<thread> workers;
+    for (size_t i = 0; i < slices; ++i) workers.emplace_back([&, i] { sort(at(i), at(i + 1)); });
+    for (thread& worker : workers) worker.join();
+    for (size_t width = 1; width < slices; width *= 2) {
+        workers.clear();
+        for (size_t i = 0; i + width < slices; i += 2 * width) {
+            workers.emplace_back([&, i, width] { inplace_merge(at(i), at(i + width), at(min(i + 2 * width, slices))); });
+        }
+        for (thread& worker : workers) worker.join();
+    }
+}
+
+// Adds a batch of entries to a sorted set. A batch that is large next to the set is sorted,
+// merged with the set's contents and the set rebuilt from the merged run, which is linear
+// because every element of a sorted run lands at the end; a small batch is inserted one by one.
+template <typename T>
+void insertSorted(set<T>& target, vector<T>& entries, size_t threads = 1) {
+    if (entries.size() * 8 < target.size()) {
+        for (T& entry : entries) target.insert(move(entry));
+        return;
+    }
+    parallelSort(entries, threads);
+    vector<T> merged;
+    merged.reserve(target.size() + entries.size());
+    merge(target.begin(), target.end(), entries.begin(), entries.end(), back_inserter(merged));
+    target = set<T>(merged.begin(), merged.end());
+}
+
+// Interns guests by name (ignoring case) and contact, and indexes them for front-desk lookups.
+// Prefix search walks a sorted set of the lowercased name, contact and each of their words;
+// fuzzy search counts the query's trigrams in an inverted index, so a misspelt name or a
+// partly remembered phone number still finds the guest. Both indexes are extended as guests
+// are interned. The directory has its own mutex and may be called with reservationMutex held.
+class GuestDirectory {
+private:
+    static constexpr double MIN_SIMILARITY = 0.5;
+
+    StringArena text;
+    deque<Guest> guests;                                  // by guestID; deque keeps addresses stable
+    vector<set<int>> reservationsOf;                      // live reservation IDs, by guestID
+    unordered_map<string_view, uint32_t> byIdentity;      // guestKey(name) + '\n' + contact, in text
+    set<pair<string_view, uint32_t>> byPrefix;            // (lowercased name, contact or word, guestID)
+    unordered_map<uint32_t, vector<uint32_t>> byTrigram;  // packed trigram -> guestIDs, ascending
+    string probe;                                         // reused identity key for lookups
+    vector<uint32_t> scratchTrigrams;                     // reused by index
+
+    mutable mutex directoryMutex;
+
+    static vector<string_view> words(string_view lowered) {
+        vector<string_view> found;
+        size_t start = 0;
+        for (size_t i = 0; i <= lowered.size(); ++i) {
+            if (i < lowered.size() && isalnum(static_cast<unsigned char>(lowered[i]))) continue;
+            if (i > start) found.push_back(lowered.substr(start, i - start));
+            start = i + 1;
+        }
+        return found;
+    }
+
+    // Trigrams of each word padded as "  word ", so short words and word starts count too.
+    // Appended to trigrams; call distinct() once everything is added.
+    static void addTrigrams(string_view lowered, vector<uint32_t>& trigrams) {
+        for (string_view word : words(lowered)) {
+            auto at = [&](size_t i) -> uint32_t {
+                return i < 2 || i - 2 >= word.size() ? ' ' : static_cast<unsigned char>(word[i - 2]);
+            };
+            for (size_t i = 0; i < word.size() + 1; ++i) trigrams.push_back(at(i) << 16 | at(i + 1) << 8 | at(i + 2));
+        }
+    }
+
+    static void distinct(vector<uint32_t>& trigrams) {
+        sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    }
+
+    // With pending set, the prefix entries are collected there for one insertSorted later.
+    void index(const Guest& guest, string_view loweredContact, vector<pair<string_view, uint32_t>>* pending) {
+        for (string_view lowered : { guest.key, loweredContact }) {
+            if (lowered.empty()) continue;
+            if (pending) pending->emplace_back(lowered, guest.guestID);
+            else byPrefix.emplace(lowered, guest.guestID);
+            for (string_view word : words(lowered)) {
+                if (pending) pending->emplace_back(word, guest.guestID);
+                else byPrefix.emplace(word, guest.guestID);
+            }
+        }
+        scratchTrigrams.clear();
+        addTrigrams(guest.key, scratchTrigrams);
+        addTrigrams(loweredContact, scratchTrigrams);
+        distinct(scratchTrigrams);
+        for (uint32_t trigram : scratchTrigrams) byTrigram[trigram].push_back(guest.guestID);
+    }
+
+    const Guest& internLocked(string_view name, string_view contact, vector<pair<string_view, uint32_t>>* pending) {
+        probe.assign(name);
+        for (char& c : probe) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        probe += '\n';
+        probe.append(contact);
+        auto known = byIdentity.find(probe);
+        if (known != byIdentity.end()) return guests[known->second];
+
+        string_view identity = text.store(probe);
+        uint32_t guestID = static_cast<uint32_t>(guests.size());
+        byIdentity.emplace(identity, guestID);
+        guests.push_back(Guest{ guestID, text.store(name), text.store(contact), identity.substr(0, name.size()) });
+        reservationsOf.emplace_back();
+        index(guests.back(), text.store(guestKey(contact)), pending);
+        return guests.back();
+    }
+
+public:
+    // Returns the existing record for this guest, or a new one.
+    const Guest& intern(string_view name, string_view contact) {
+        lock_guard<mutex> lock(directoryMutex);
+        return internLocked(name, contact, nullptr);
     }
 
-    string getRoomTypeString() const {
-        switch (type) {
-            case RoomType::SINGLE: return "Single";
-            case RoomType::DOUBLE: return "Double";
-            case RoomType::DELUXE: return "Deluxe";
-            case RoomType::SUITE: return "Suite";
-            default: return "Unknown";
+    // intern for each (name, contact) under one lock, for bulk imports; the prefix entries of
+    // the new guests go into the sorted set in one merge.
+    vector<const Guest*> internAll(const vector<pair<string_view, string_view>>& identities, size_t threads = 1) {
+        lock_guard<mutex> lock(directoryMutex);
+        vector<const Guest*> found;
+        vector<pair<string_view, uint32_t>> pending;
+        found.reserve(identities.size());
+        for (const auto& [name, contact] : identities) found.push_back(&internLocked(name, contact, &pending));
+        insertSorted(byPrefix, pending, threads);
+        return found;
+    }
+
+    void attach(const Guest& guest, int reservationID) {
+        lock_guard<mutex> lock(directoryMutex);
+        reservationsOf[guest.guestID].insert(reservationID);
+    }
+
+    void detach(const Guest& guest, int reservationID) {
+        lock_guard<mutex> lock(directoryMutex);
+        reservationsOf[guest.guestID].erase(reservationID);
+    }
+
+    // Guests with live reservations whose name, contact or one of their words starts with the
+    // query, then those sharing at least half of its trigrams; best score first, then by name.
+    vector<GuestMatch> search(const string& query, size_t limit) const {
+        string key = guestKey(query);
+        key.erase(0, key.find_first_not_of(' '));
+        key.erase(key.find_last_not_of(' ') + 1);
+        vector<GuestMatch> matches;
+        if (key.empty() || limit == 0) return matches;
+
+        lock_guard<mutex> lock(directoryMutex);
+        unordered_map<uint32_t, double> scores;
+        for (auto it = byPrefix.lower_bound(make_pair(string_view(key), 0u)); it != byPrefix.end() && it->first.substr(0, key.size()) == key; ++it) {
+            HOTEL_SCANNED(1);
+            scores[it->second] = 1.0;
+        }
+        vector<uint32_t> trigrams;
+        addTrigrams(key, trigrams);
+        distinct(trigrams);
+        unordered_map<uint32_t, size_t> shared;
+        for (uint32_t trigram : trigrams) {
+            auto postings = byTrigram.find(trigram);
+            if (postings == byTrigram.end()) continue;
+            HOTEL_SCANNED(postings->second.size());
+            for (uint32_t guestID : postings->second) ++shared[guestID];
+        }
+        for (const auto& [guestID, count] : shared) {
+            double score = static_cast<double>(count) / static_cast<double>(trigrams.size());
+            if (score < MIN_SIMILARITY) continue;
+            double& best = scores[guestID];
+            best = max(best, score);
+        }
+
+        for (const auto& [guestID, score] : scores) {
+            if (reservationsOf[guestID].empty()) continue;
+            matches.push_back(GuestMatch{ &guests[guestID], score, {} });
+        }
+        sort(matches.begin(), matches.end(), [](const GuestMatch& a, const GuestMatch& b) {
+            if (a.score != b.score) return a.score > b.score;
+            if (a.guest->name != b.guest->name) return a.guest->name < b.guest->name;
+            return a.guest->guestID < b.guest->guestID;
+        });
+        if (matches.size() > limit) matches.resize(limit);
+        for (GuestMatch& match : matches) {
+            const set<int>& ids = reservationsOf[match.guest->guestID];
+            match.reservationIDs.assign(ids.begin(), ids.end());
         }
+        return matches;
     }
 
-    string getBillingStrategyString() const {
-        return billingStrategy->getBillingType();
+    // Invalidates every Guest handed out so far; only for replacing the whole hotel state.
+    void clear() {
+        lock_guard<mutex> lock(directoryMutex);
+        guests.clear();
+        reservationsOf.clear();
+        byIdentity.clear();
+        byPrefix.clear();
+        byTrigram.clear();
+        text.clear();
     }
 };
 
 class Reservation {
 private:
-    static int idCounter;
     int reservationID;
-    string guestName;
-    string contactInfo;
+    const Guest* guest;                   // owned by the Hotel's GuestDirectory
     int roomNumber;
-    string checkInDate;
-    string checkOutDate;
+    Date checkInDate;
+    Date checkOutDate;
     int numberOfGuests;
 
 public:
-    Reservation(const string& name, const string& contact, int roomNum, const string& checkIn, const string& checkOut, int guests)
-        : guestName(name), contactInfo(contact), roomNumber(roomNum), checkInDate(checkIn), checkOutDate(checkOut), numberOfGuests(guests) {
-        reservationID = ++idCounter; 
-    }
+    // The ID comes from the owning Hotel's ReservationIDs.
+    Reservation(int id, const Guest& guestRecord, int roomNum, Date checkIn, Date checkOut, int guests)
+        : reservationID(id), guest(&guestRecord), roomNumber(roomNum), checkInDate(checkIn), checkOutDate(checkOut), numberOfGuests(guests) {}
 
     int getReservationID() const { return reservationID; }
-    string getGuestName() const { return guestName; }
-    string getContactInfo() const { return contactInfo; }
+    const Guest& getGuest() const { return *guest; }
+    string_view getGuestName() const { return guest->name; }
+    string_view getContactInfo() const { return guest->contact; }
     int getRoomNumber() const { return roomNumber; }
-    string getCheckInDate() const { return checkInDate; }
-    string getCheckOutDate() const { return checkOutDate; }
+    Date getCheckInDate() const { return checkInDate; }
+    Date getCheckOutDate() const { return checkOutDate; }
+    int getNights() const { return checkOutDate - checkInDate; }
     int getNumberOfGuests() const { return numberOfGuests; }
 
     void updateGuests(int guests) { numberOfGuests = guests; }
-    void updateDates(const string& checkIn, const string& checkOut) {
+    void updateDates(Date checkIn, Date checkOut) {
         checkInDate = checkIn;
         checkOutDate = checkOut;
     }
@@ -125,469 +1093,6960 @@ public:
     }
 };
 
-int Reservation::idCounter = 0;
+// Issues one Hotel's reservation IDs. The top bits of an ID name the shard that issued it and
+// the low SEQUENCE_BITS count that shard's bookings, so the shards of a HotelChain never hand
+// out the same ID and never ask each other; the shard is read back from the ID alone. Each
+// shard has 2^24 - 1 IDs. A standalone Hotel never sets a shard and counts 1, 2, 3, ... up to
+// INT_MAX.
+class ReservationIDs {
+public:
+    static constexpr int SEQUENCE_BITS = 24;
+    static constexpr int MAX_SHARDS = 1 << (31 - SEQUENCE_BITS);
+
+private:
+    atomic<int> last{0};            // last ID issued or seen
+    int shard = 0;
+    int64_t end = int64_t(numeric_limits<int>::max()) + 1;  // first ID past this hotel's range
+
+public:
+    // Before the first booking.
+    void setShard(int index) {
+        if (index < 0 || index >= MAX_SHARDS) throw invalid_argument("Shard index out of range.");
+        shard = index;
+        last = index << SEQUENCE_BITS;
+        end = int64_t(index + 1) << SEQUENCE_BITS;
+    }
+
+    int getShard() const { return shard; }
+    static int shardOf(int reservationID) { return reservationID >> SEQUENCE_BITS; }
+
+    // Reserves count consecutive IDs and returns the first. The range is checked before the
+    // counter moves, so a full hotel throws without ever wrapping it.
+    int issue(int count = 1) {
+        int seen = last.load();
+        do {
+            if (int64_t(seen) + count >= end) throw runtime_error("This hotel has run out of reservation IDs.");
+        } while (!last.compare_exchange_weak(seen, seen + count));
+        return seen + 1;
+    }
+
+    // Keeps later IDs above one rebuilt from a snapshot or the journal.
+    void observe(int id) {
+        int seen = last.load();
+        while (id > seen && !last.compare_exchange_weak(seen, id)) {}
+    }
+
+    int lastIssued() const { return last; }
+    void restore(int id) { last = max(id, shard << SEQUENCE_BITS); }
+};
+
+// Stable-address storage for the Hotel's rooms and reservations. Objects are built in place in
+// fixed-size slabs and named by a handle, so growing the pool never moves an object and erasing
+// one leaves every other handle and pointer valid. Erased slots go on a free list and are reused
+// first. Live objects are also linked in insertion order, which is the order iteration uses.
+template <typename T>
+class SlabPool {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle NONE = numeric_limits<Handle>::max();
+
+private:
+    static constexpr size_t SLAB_SIZE = 256;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        Handle previous;                  // insertion-order links while live
+        Handle next;                      // the free list's link while free
+        bool live;
+    };
+
+    vector<unique_ptr<Slot[]>> slabs;
+    size_t used = 0;                      // slots ever handed out; the rest of the slabs is untouched
+    size_t count = 0;
+    Handle freeList = NONE;
+    Handle first = NONE;
+    Handle last = NONE;
+
+    Slot& slot(Handle handle) const { return slabs[handle / SLAB_SIZE][handle % SLAB_SIZE]; }
+    static T* object(Slot& slot) { return launder(reinterpret_cast<T*>(slot.storage)); }
+
+public:
+    template <bool Const>
+    class Iterator {
+    private:
+        const SlabPool* pool;
+        Handle handle;
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = T;
+        using difference_type = ptrdiff_t;
+        using pointer = conditional_t<Const, const T*, T*>;
+        using reference = conditional_t<Const, const T&, T&>;
+
+        Iterator(const SlabPool* owner, Handle position) : pool(owner), handle(position) {}
+        reference operator*() const { return *object(pool->slot(handle)); }
+        pointer operator->() const { return object(pool->slot(handle)); }
+        Iterator& operator++() {
+            handle = pool->slot(handle).next;
+            return *this;
+        }
+        bool operator==(const Iterator& other) const { return handle == other.handle; }
+        bool operator!=(const Iterator& other) const { return handle != other.handle; }
+    };
+
+    SlabPool() = default;
+    ~SlabPool() { clear(); }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    // Allocates slabs for at least capacity objects up front.
+    void reserve(size_t capacity) {
+        while (slabs.size() * SLAB_SIZE < capacity) slabs.push_back(make_unique<Slot[]>(SLAB_SIZE));
+    }
+
+    // Builds an object after the last one and returns its handle.
+    template <typename... Args>
+    Handle emplace(Args&&... args) {
+        Handle handle = freeList;
+        if (handle == NONE) {
+            if (used == slabs.size() * SLAB_SIZE) slabs.push_back(make_unique<Slot[]>(SLAB_SIZE));
+            handle = static_cast<Handle>(used);
+        }
+        Slot& target = slot(handle);
+        new (target.storage) T(forward<Args>(args)...);
+        if (handle == freeList) freeList = target.next;
+        else ++used;
+        target.live = true;
+        target.previous = last;
+        target.next = NONE;
+        if (last == NONE) first = handle;
+        else slot(last).next = handle;
+        last = handle;
+        ++count;
+        return handle;
+    }
+
+    void erase(Handle handle) {
+        Slot& target = slot(handle);
+        if (target.previous == NONE) first = target.next;
+        else slot(target.previous).next = target.next;
+        if (target.next == NONE) last = target.previous;
+        else slot(target.next).previous = target.previous;
+        object(target)->~T();
+        target.live = false;
+        target.next = freeList;
+        freeList = handle;
+        --count;
+    }
+
+    // Destroys every object but keeps the slabs for reuse.
+    void clear() {
+        for (Handle handle = first; handle != NONE; handle = slot(handle).next) object(slot(handle))->~T();
+        used = count = 0;
+        freeList = first = last = NONE;
+    }
+
+    T& operator[](Handle handle) { return *object(slot(handle)); }
+    const T& operator[](Handle handle) const { return *object(slot(handle)); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Handle front() const { return first; }
+    Handle back() const { return last; }
+    Handle after(Handle handle) const { return slot(handle).next; }
+
+    Iterator<false> begin() { return Iterator<false>(this, first); }
+    Iterator<false> end() { return Iterator<false>(this, NONE); }
+    Iterator<true> begin() const { return Iterator<true>(this, first); }
+    Iterator<true> end() const { return Iterator<true>(this, NONE); }
+};
+
+// Structure-of-arrays copy of the room fields that billing needs, indexed by the room's handle in
+// Hotel::rooms, so a batch of bills is a branch-free loop over contiguous doubles.
+class RoomBillingTable {
+private:
+    vector<double> baseRate;
+    vector<double> multiplier;
+    vector<int> maxGuests;
+
+public:
+    // Handles of erased rooms are reused, so a slot is simply overwritten by the next room.
+    void set(size_t slot, double rate, const BillingStrategy& strategy, int guests) {
+        if (slot >= baseRate.size()) {
+            baseRate.resize(slot + 1);
+            multiplier.resize(slot + 1);
+            maxGuests.resize(slot + 1);
+        }
+        baseRate[slot] = rate;
+        multiplier[slot] = billingMultiplier(strategy);
+        maxGuests[slot] = guests;
+    }
+
+    void setBaseRate(size_t slot, double rate) { baseRate[slot] = rate; }
+    void setStrategy(size_t slot, const BillingStrategy& strategy) { multiplier[slot] = billingMultiplier(strategy); }
+    int getMaxGuests(size_t slot) const { return maxGuests[slot]; }
+
+    // bills[i] = rate of slots[i] * nights[i] * multiplier of slots[i], in the same
+    // order of operations as the strategies' calculateBill so results match exactly.
+    void computeBills(const vector<size_t>& slots, const vector<double>& nights, vector<double>& bills) const {
+        const size_t count = slots.size();
+        vector<double> rates(count), multipliers(count);
+        for (size_t i = 0; i < count; ++i) {
+            rates[i] = baseRate[slots[i]];
+            multipliers[i] = multiplier[slots[i]];
+        }
+        bills.resize(count);
+        const double* r = rates.data();
+        const double* n = nights.data();
+        const double* m = multipliers.data();
+        double* out = bills.data();
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = r[i] * n[i] * m[i];
+        }
+    }
+};
+
+// Bills already worked out for a room and stay, so repeated views and quotes of the same stay
+// cost a hash lookup. Entries are keyed by room number and dates and dropped per room whenever
+// something the price depends on changes: the room's rate or strategy, its type's rate calendar,
+// or the room itself. A reservation moved to other dates or another room simply asks for a
+// different key. Sharded by room number with a mutex per shard; a full shard starts over.
+// Callers hold Hotel::stateMutex at least shared and invalidation runs with it exclusive, so a
+// bill worked out before a change can never be stored after it.
+class QuoteCache {
+public:
+    struct Counters {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+    };
+
+private:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t SHARD_CAPACITY = 8192;
+
+    struct Shard {
+        mutex lock;
+        unordered_map<int, unordered_map<uint64_t, double>> byRoom; // room -> (checkIn, checkOut) -> bill
+        size_t entries = 0;
+    };
+
+    mutable array<Shard, SHARDS> shards;
+    mutable atomic<uint64_t> hits{0};
+    mutable atomic<uint64_t> misses{0};
+
+    static uint64_t stayKey(Date checkIn, Date checkOut) {
+        return uint64_t(uint32_t(checkIn.dayNumber())) << 32 | uint32_t(checkOut.dayNumber());
+    }
+
+    Shard& shard(int roomNumber) const { return shards[static_cast<unsigned>(roomNumber) % SHARDS]; }
+
+public:
+    // The cached bill, or compute()'s result, which is then cached.
+    template <typename Compute>
+    double get(int roomNumber, Date checkIn, Date checkOut, Compute compute) const {
+        Shard& target = shard(roomNumber);
+        const uint64_t key = stayKey(checkIn, checkOut);
+        {
+            lock_guard<mutex> guard(target.lock);
+            auto room = target.byRoom.find(roomNumber);
+            if (room != target.byRoom.end()) {
+                auto entry = room->second.find(key);
+                if (entry != room->second.end()) {
+                    hits.fetch_add(1, memory_order_relaxed);
+                    return entry->second;
+                }
+            }
+        }
+        misses.fetch_add(1, memory_order_relaxed);
+        double bill = compute();
+        lock_guard<mutex> guard(target.lock);
+        if (target.entries >= SHARD_CAPACITY) {
+            target.byRoom.clear();
+            target.entries = 0;
+        }
+        if (target.byRoom[roomNumber].emplace(key, bill).second) ++target.entries;
+        return bill;
+    }
+
+    void invalidate(int roomNumber) {
+        Shard& target = shard(roomNumber);
+        lock_guard<mutex> guard(target.lock);
+        auto room = target.byRoom.find(roomNumber);
+        if (room == target.byRoom.end()) return;
+        target.entries -= room->second.size();
+        target.byRoom.erase(room);
+    }
+
+    void clear() {
+        for (Shard& target : shards) {
+            lock_guard<mutex> guard(target.lock);
+            target.byRoom.clear();
+            target.entries = 0;
+        }
+    }
+
+    Counters counters() const {
+        Counters result;
+        result.hits = hits.load(memory_order_relaxed);
+        result.misses = misses.load(memory_order_relaxed);
+        for (Shard& target : shards) {
+            lock_guard<mutex> guard(target.lock);
+            result.entries += target.entries;
+        }
+        return result;
+    }
+};
+
+// A request for a room of a type that had none free, waiting for one to be freed.
+struct WaitRequest {
+    int waitID = 0;             // issue order, and so the order requests came in
+    string guestName;
+    string contactInfo;
+    Room::RoomType type = Room::RoomType::SINGLE;
+    Date checkIn;
+    Date checkOut;
+    int guests = 1;
+    int loyaltyTier = 0;        // 0 (none) to MAX_TIER
+    bool corporate = false;     // a corporate account
+
+    static constexpr int MAX_TIER = 3;
+};
+
+// Waiting requests in one priority queue per room type, stay and party size. A queue's best
+// request is the one with the highest loyalty tier, then a corporate account, then the earliest.
+// When nights of a room are freed, best() compares only the heads of the queues whose stay fits
+// a free run of the room, so finding and removing the request to promote costs one look per
+// distinct waiting stay in the run plus O(log n), never a pass over every request.
+class Waitlist {
+private:
+    using Rank = tuple<int, bool, int>;                     // (-tier, !corporate, waitID): smallest first
+    using StayKey = tuple<int32_t, int32_t, int>;           // (check-in day, check-out day, guests)
+
+    array<map<StayKey, set<Rank>>, Room::TYPE_COUNT> queues; // by Room::RoomType
+    unordered_map<int, WaitRequest> requests;               // waitID -> request
+    int lastID = 0;
+
+    static Rank rankOf(const WaitRequest& request) { return make_tuple(-request.loyaltyTier, !request.corporate, request.waitID); }
+    static StayKey stayOf(const WaitRequest& request) {
+        return make_tuple(request.checkIn.dayNumber(), request.checkOut.dayNumber(), request.guests);
+    }
+
+public:
+    // True if a is promoted ahead of b.
+    static bool before(const WaitRequest& a, const WaitRequest& b) { return rankOf(a) < rankOf(b); }
+
+    int issue() { return ++lastID; }
+    int lastIssued() const { return lastID; }
+    void restore(int last) { lastID = max(lastID, last); }
+
+    bool empty() const { return requests.empty(); }
+    size_t size() const { return requests.size(); }
+
+    void add(WaitRequest request) {
+        lastID = max(lastID, request.waitID);
+        queues[static_cast<size_t>(request.type)][stayOf(request)].insert(rankOf(request));
+        int waitID = request.waitID;
+        requests.emplace(waitID, move(request));
+    }
+
+    optional<WaitRequest> remove(int waitID) {
+        auto it = requests.find(waitID);
+        if (it == requests.end()) return nullopt;
+        WaitRequest request = move(it->second);
+        requests.erase(it);
+        auto& byStay = queues[static_cast<size_t>(request.type)];
+        auto queue = byStay.find(stayOf(request));
+        queue->second.erase(rankOf(request));
+        if (queue->second.empty()) byStay.erase(queue);
+        return request;
+    }
+
+    const WaitRequest* find(int waitID) const {
+        auto it = requests.find(waitID);
+        return it == requests.end() ? nullptr : &it->second;
+    }
+
+    // The best request of the type for at most maxGuests whose stay lies within [from, to).
+    const WaitRequest* best(Room::RoomType type, int from, int to, int maxGuests) const {
+        const auto& byStay = queues[static_cast<size_t>(type)];
+        const Rank* top = nullptr;
+        auto it = byStay.lower_bound(make_tuple(from, numeric_limits<int32_t>::min(), numeric_limits<int>::min()));
+        for (; it != byStay.end() && get<0>(it->first) < to; ++it) {
+            HOTEL_SCANNED(1);
+            if (get<1>(it->first) > to || get<2>(it->first) > maxGuests) continue;
+            const Rank& head = *it->second.begin();
+            if (!top || head < *top) top = &head;
+        }
+        return top ? &requests.at(get<2>(*top)) : nullptr;
+    }
+
+    // Every waiting request, by room type and then in promotion order.
+    vector<WaitRequest> list() const {
+        vector<WaitRequest> result;
+        result.reserve(requests.size());
+        for (const auto& [waitID, request] : requests) result.push_back(request);
+        sort(result.begin(), result.end(), [](const WaitRequest& a, const WaitRequest& b) {
+            return make_pair(a.type, rankOf(a)) < make_pair(b.type, rankOf(b));
+        });
+        return result;
+    }
+
+    void clear() {
+        for (auto& byStay : queues) byStay.clear();
+        requests.clear();
+        lastID = 0;
+    }
+};
+
+// Fixed-width fields in host byte order; strings as a 32-bit length followed by the bytes.
+class BinaryWriter {
+private:
+    string& buffer;
+
+public:
+    explicit BinaryWriter(string& target) : buffer(target) {}
+
+    template <typename T>
+    void put(T value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void putString(string_view text) {
+        put<uint32_t>(static_cast<uint32_t>(text.size()));
+        buffer.append(text);
+    }
+};
+
+class BinaryReader {
+private:
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+
+    void need(size_t bytes) const {
+        if (size - offset < bytes) throw runtime_error("Unexpected end of data.");
+    }
+
+public:
+    BinaryReader(const char* bytes, size_t length) : data(bytes), size(length) {}
+
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        T value;
+        memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    string getString() {
+        uint32_t length = get<uint32_t>();
+        need(length);
+        string text(data + offset, length);
+        offset += length;
+        return text;
+    }
+
+    void skipString() {
+        uint32_t length = get<uint32_t>();
+        need(length);
+        offset += length;
+    }
+
+    bool atEnd() const { return offset == size; }
+    size_t remaining() const { return size - offset; }
+};
+
+uint32_t checksum32(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+bool readWholeFile(const string& path, string& contents) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    contents.clear();
+    char chunk[1 << 16];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.append(chunk, read);
+    }
+    fclose(file);
+    return true;
+}
+
+// Reads size bytes at offset; contents ends short if the file does.
+bool readFileRange(const string& path, uint64_t offset, size_t size, string& contents) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+#ifdef _WIN32
+    bool placed = _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+    bool placed = fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    contents.resize(placed ? size : 0);
+    contents.resize(placed ? fread(&contents[0], 1, size, file) : 0);
+    fclose(file);
+    return placed;
+}
+
+bool syncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Write-ahead journal of Hotel mutations. Each record is [length][checksum][op][payload].
+// Appends only encode into an in-memory buffer and never touch the file. A flusher thread writes
+// and syncs the buffer as one group once it holds groupSize records or its oldest record is
+// maxDelay old, and flush() does so at once, so a booking never waits on a disk sync. Appends
+// from several threads only contend on the buffer; a flush swaps the buffer out and syncs it
+// while holding the file lock alone.
+// Record i of the file is event journalStart + i of the Hotel's change feed. The file offset of
+// every INDEX_STRIDE-th record is kept, so reading records back seeks near the first one wanted.
+class HotelJournal {
+public:
+    enum class Op : uint8_t { ADD_ROOM = 1, DELETE_ROOM, UPDATE_RATE, UPDATE_BILLING, RESERVE, CANCEL, UPDATE_GUESTS, UPDATE_ROOM, UPDATE_DATES,
+                          RESERVE_BLOCK, RATE_RULE, WAITLIST, UNWAIT, PROMOTE, REASSIGN, ARCHIVE };
+
+private:
+    string path;
+    FILE* file = nullptr;
+    string buffer;
+    string writing;                 // the group being written; guarded by fileMutex
+    size_t pendingRecords = 0;
+    static constexpr size_t INDEX_STRIDE = 64;
+    vector<uint64_t> recordIndex;   // file offset of record i * INDEX_STRIDE
+    size_t recordCount = 0;         // intact records in the file and the buffer
+    uint64_t endOffset = 0;         // file offset of the next appended record
+    size_t writtenRecords = 0;      // records that have reached the file
+    mutex fileMutex;                // taken before bufferMutex, so groups reach the file in order
+    mutex bufferMutex;
+    size_t groupSize;
+    chrono::milliseconds maxDelay;
+    chrono::steady_clock::time_point oldestPending;
+    condition_variable groupReady;  // a first record is pending, or a full group
+    bool stopping = false;
+    thread flusher;
+
+    void flushLoop() {
+        unique_lock<mutex> lock(bufferMutex);
+        while (true) {
+            groupReady.wait(lock, [&] { return stopping || pendingRecords > 0; });
+            if (stopping) return;
+            groupReady.wait_until(lock, oldestPending + maxDelay, [&] { return stopping || pendingRecords >= groupSize; });
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+public:
+    explicit HotelJournal(size_t recordsPerGroup = 256, chrono::milliseconds delay = chrono::milliseconds(20))
+        : groupSize(recordsPerGroup), maxDelay(delay) {}
+
+    ~HotelJournal() { close(); }
+
+    HotelJournal(const HotelJournal&) = delete;
+    HotelJournal& operator=(const HotelJournal&) = delete;
+
+    bool open(const string& journalPath) {
+        close();
+        unique_lock<mutex> fileLock(fileMutex);
+        unique_lock<mutex> lock(bufferMutex);
+        path = journalPath;
+        recordIndex.clear();
+        recordCount = writtenRecords = 0;
+        endOffset = 0;
+        string contents;
+        if (readWholeFile(path, contents)) {
+            forEachRecord(contents, [&](Op, BinaryReader& reader) {
+                if (recordCount++ % INDEX_STRIDE == 0) recordIndex.push_back(endOffset);
+                endOffset += 2 * sizeof(uint32_t) + 1 + reader.remaining();
+                return true;
+            });
+            writtenRecords = recordCount;
+            if (endOffset < contents.size()) {
+                // Replay stops at a torn tail, so records appended after it would be lost; drop it.
+                FILE* rewrite = fopen(path.c_str(), "wb");
+                if (rewrite) {
+                    fwrite(contents.data(), 1, static_cast<size_t>(endOffset), rewrite);
+                    syncFile(rewrite);
+                    fclose(rewrite);
+                }
+            }
+        }
+        file = fopen(path.c_str(), "ab");
+        if (!file) return false;
+        stopping = false;
+        lock.unlock();
+        fileLock.unlock();
+        flusher = thread([this] { flushLoop(); });
+        return true;
+    }
+
+    // Stops the flusher, then writes what it had not.
+    void close() {
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            stopping = true;
+        }
+        groupReady.notify_all();
+        if (flusher.joinable()) flusher.join();
+        flush();
+        lock_guard<mutex> fileLock(fileMutex);
+        lock_guard<mutex> lock(bufferMutex);
+        if (!file) return;
+        fclose(file);
+        file = nullptr;
+    }
+
+    // sequenced(payload) is called with the encoded record while the buffer is still locked, so
+    // anything it numbers is numbered in the order the records reach the file.
+    template <typename Encode, typename Sequenced>
+    void append(Op op, Encode encode, Sequenced sequenced) {
+        unique_lock<mutex> lock(bufferMutex);
+        size_t start = buffer.size();
+        BinaryWriter writer(buffer);
+        writer.put<uint32_t>(0);
+        writer.put<uint32_t>(0);
+        writer.put<uint8_t>(static_cast<uint8_t>(op));
+        encode(writer);
+        const size_t header = 2 * sizeof(uint32_t);
+        uint32_t length = static_cast<uint32_t>(buffer.size() - start - header);
+        uint32_t sum = checksum32(buffer.data() + start + header, length);
+        memcpy(&buffer[start], &length, sizeof(length));
+        memcpy(&buffer[start + sizeof(length)], &sum, sizeof(sum));
+        BinaryReader payload(buffer.data() + start + header + 1, length - 1);
+        sequenced(payload);
+        if (!file) {
+            buffer.resize(start);
+            return;
+        }
+        if (recordCount++ % INDEX_STRIDE == 0) recordIndex.push_back(endOffset);
+        endOffset += header + length;
+
+        if (pendingRecords++ == 0) oldestPending = chrono::steady_clock::now();
+        bool wake = pendingRecords == 1 || pendingRecords == groupSize;
+        lock.unlock();
+        if (wake) groupReady.notify_one();
+    }
+
+    // Writes every buffered record and syncs them to disk as one group.
+    void flush() {
+        lock_guard<mutex> fileLock(fileMutex);
+        size_t written;
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            if (!file || buffer.empty()) return;
+            writing.swap(buffer);
+            pendingRecords = 0;
+            written = recordCount;
+        }
+        if (fwrite(writing.data(), 1, writing.size(), file) != writing.size() || !syncFile(file)) {
+            cerr << "Warning: could not write journal " << path << ".\n";
+        }
+        writing.clear();
+        lock_guard<mutex> lock(bufferMutex);
+        writtenRecords = written;
+    }
+
+    // Drops every record; called once a snapshot covers them.
+    void truncate() {
+        lock_guard<mutex> fileLock(fileMutex);
+        lock_guard<mutex> lock(bufferMutex);
+        if (!file) return;
+        buffer.clear();
+        pendingRecords = 0;
+        recordIndex.clear();
+        recordCount = writtenRecords = 0;
+        endOffset = 0;
+        fclose(file);
+        file = fopen(path.c_str(), "wb");
+        if (file) {
+            fclose(file);
+            file = fopen(path.c_str(), "ab");
+        }
+    }
+
+    // Calls visit(op, reader) for each intact record of contents until it returns false, and
+    // returns how many it visited. Stops at the first torn or corrupt record, which can only be
+    // the unsynced tail.
+    template <typename Visit>
+    static size_t forEachRecord(const string& contents, Visit visit) {
+        size_t offset = 0, visited = 0;
+        const size_t header = 2 * sizeof(uint32_t);
+        while (contents.size() - offset >= header) {
+            uint32_t length, sum;
+            memcpy(&length, contents.data() + offset, sizeof(length));
+            memcpy(&sum, contents.data() + offset + sizeof(length), sizeof(sum));
+            if (length == 0 || contents.size() - offset - header < length) break;
+            const char* record = contents.data() + offset + header;
+            if (checksum32(record, length) != sum) break;
+            BinaryReader reader(record + 1, length - 1);
+            ++visited;
+            if (!visit(static_cast<Op>(record[0]), reader)) break;
+            offset += header + length;
+        }
+        return visited;
+    }
+
+    // Calls apply(op, reader) for each intact record and returns how many were applied.
+    template <typename Apply>
+    static size_t replay(const string& journalPath, Apply apply) {
+        string contents;
+        if (!readWholeFile(journalPath, contents)) return 0;
+        return forEachRecord(contents, [&](Op op, BinaryReader& reader) {
+            apply(op, reader);
+            return true;
+        });
+    }
+
+    // Calls visit(op, reader) for up to limit records from the first-th record of the file on, and
+    // returns how many it visited. Only the bytes of those records are read, starting from the
+    // nearest indexed offset; the buffer is flushed first only if some of them have not reached
+    // the file yet. Appends and flushes go on meanwhile.
+    template <typename Visit>
+    size_t readBack(size_t first, size_t limit, Visit visit) {
+        uint64_t from, to;
+        size_t skip;
+        for (bool flushed = false;; flushed = true) {
+            {
+                lock_guard<mutex> lock(bufferMutex);
+                if (!file || limit == 0 || first >= recordCount) return 0;
+                size_t last = first + min(limit, recordCount - first);
+                if (last <= writtenRecords) {
+                    from = recordIndex[first / INDEX_STRIDE];
+                    skip = first % INDEX_STRIDE;
+                    size_t next = (last + INDEX_STRIDE - 1) / INDEX_STRIDE;
+                    to = next < recordIndex.size() ? recordIndex[next] : endOffset;
+                    break;
+                }
+            }
+            if (flushed) return 0;   // the write failed; nothing more will reach the file
+            flush();
+        }
+        string contents;
+        if (!readFileRange(path, from, static_cast<size_t>(to - from), contents)) return 0;
+        size_t index = 0, visited = 0;
+        forEachRecord(contents, [&](Op op, BinaryReader& reader) {
+            if (index++ < skip) return true;
+            visit(op, reader);
+            return ++visited < limit;
+        });
+        return visited;
+    }
+};
+
+// One Hotel mutation as the change feed hands it to subscribers. It is decoded from the journal
+// record of the mutation, so an event read back from the journal is the one the ring carried.
+// Guest names are left out to keep events fixed-size; getReservation has them.
+struct ChangeEvent {
+    uint64_t offset;            // position in the feed, counted across restarts
+    double rate;                // ADD_ROOM, UPDATE_RATE: base rate; RATE_RULE: the rule's value; ARCHIVE: the first stay's bill
+    int32_t roomNumber;         // room changes, RESERVE, UPDATE_ROOM (the new room), RESERVE_BLOCK (first room), REASSIGN (first new room)
+    int32_t reservationID;      // reservation changes, PROMOTE; RESERVE_BLOCK: first of count consecutive IDs; REASSIGN, ARCHIVE: the first
+    int32_t from;               // stays: check-in day; RATE_RULE: the rule's from
+    int32_t to;                 // the check-out day, or the rule's to
+    int32_t guests;             // stays, UPDATE_GUESTS; ADD_ROOM: max guests
+    int32_t count;              // RESERVE_BLOCK: rooms in the block; REASSIGN: moves; ARCHIVE: stays; all listed in the journal record
+    HotelJournal::Op kind;
+    uint8_t roomType;           // ADD_ROOM, RATE_RULE, WAITLIST, ARCHIVE
+    uint8_t billing;            // ADD_ROOM, UPDATE_BILLING, ARCHIVE: BillingStrategy::index()
+    uint8_t ruleKind;           // RATE_RULE: RateRule::Kind
+    int32_t waitID;             // WAITLIST, UNWAIT, PROMOTE
+    uint8_t loyaltyTier;        // WAITLIST
+    uint8_t corporate;          // WAITLIST
+    uint8_t reserved[6];
+
+    static const char* kindName(HotelJournal::Op kind) {
+        static const char* const names[] = {
+            "ADD_ROOM", "DELETE_ROOM", "UPDATE_RATE", "UPDATE_BILLING", "RESERVE", "CANCEL", "UPDATE_GUESTS",
+            "UPDATE_ROOM", "UPDATE_DATES", "RESERVE_BLOCK", "RATE_RULE", "WAITLIST", "UNWAIT", "PROMOTE",
+            "REASSIGN", "ARCHIVE"
+        };
+        size_t index = static_cast<size_t>(kind) - 1;
+        return index < size(names) ? names[index] : "UNKNOWN";
+    }
+
+    // Reads the payload of a journal record; the offset is left for the caller to set.
+    static ChangeEvent fromRecord(HotelJournal::Op kind, BinaryReader& reader) {
+        using Op = HotelJournal::Op;
+        ChangeEvent event = {};
+        event.kind = kind;
+        switch (kind) {
+            case Op::ADD_ROOM:
+                event.roomNumber = reader.get<int32_t>();
+                event.roomType = reader.get<uint8_t>();
+                event.rate = reader.get<double>();
+                event.billing = reader.get<uint8_t>();
+                event.guests = reader.get<int32_t>();
+                break;
+            case Op::DELETE_ROOM:
+                event.roomNumber = reader.get<int32_t>();
+                break;
+            case Op::UPDATE_RATE:
+                event.roomNumber = reader.get<int32_t>();
+                event.rate = reader.get<double>();
+                break;
+            case Op::UPDATE_BILLING:
+                event.roomNumber = reader.get<int32_t>();
+                event.billing = reader.get<uint8_t>();
+                break;
+            case Op::PROMOTE:
+                event.waitID = reader.get<int32_t>();
+                [[fallthrough]];
+            case Op::RESERVE:
+                event.reservationID = reader.get<int32_t>();
+                event.roomNumber = reader.get<int32_t>();
+                event.from = reader.get<int32_t>();
+                event.to = reader.get<int32_t>();
+                event.guests = reader.get<int32_t>();
+                event.count = 1;
+                break;
+            case Op::RESERVE_BLOCK:
+                event.reservationID = reader.get<int32_t>();
+                event.from = reader.get<int32_t>();
+                event.to = reader.get<int32_t>();
+                event.guests = reader.get<int32_t>();
+                reader.skipString();
+                reader.skipString();
+                event.count = static_cast<int32_t>(reader.get<uint32_t>());
+                if (event.count > 0) event.roomNumber = reader.get<int32_t>();
+                break;
+            case Op::CANCEL:
+                event.reservationID = reader.get<int32_t>();
+                break;
+            case Op::RATE_RULE:
+                event.roomType = reader.get<uint8_t>();
+                event.ruleKind = reader.get<uint8_t>();
+                event.from = reader.get<int32_t>();
+                event.to = reader.get<int32_t>();
+                event.rate = reader.get<double>();
+                break;
+            case Op::UPDATE_GUESTS:
+                event.reservationID = reader.get<int32_t>();
+                event.guests = reader.get<int32_t>();
+                break;
+            case Op::UPDATE_ROOM:
+                event.reservationID = reader.get<int32_t>();
+                event.roomNumber = reader.get<int32_t>();
+                break;
+            case Op::UPDATE_DATES:
+                event.reservationID = reader.get<int32_t>();
+                event.from = reader.get<int32_t>();
+                event.to = reader.get<int32_t>();
+                break;
+            case Op::WAITLIST:
+                event.waitID = reader.get<int32_t>();
+                event.roomType = reader.get<uint8_t>();
+                event.from = reader.get<int32_t>();
+                event.to = reader.get<int32_t>();
+                event.guests = reader.get<int32_t>();
+                event.loyaltyTier = reader.get<uint8_t>();
+                event.corporate = reader.get<uint8_t>();
+                break;
+            case Op::UNWAIT:
+                event.waitID = reader.get<int32_t>();
+                break;
+            case Op::REASSIGN:
+                event.count = static_cast<int32_t>(reader.get<uint32_t>());
+                if (event.count > 0) {
+                    event.reservationID = reader.get<int32_t>();
+                    reader.get<int32_t>();
+                    event.roomNumber = reader.get<int32_t>();
+                }
+                break;
+            case Op::ARCHIVE:
+                event.count = static_cast<int32_t>(reader.get<uint32_t>());
+                if (event.count > 0) {
+                    event.reservationID = reader.get<int32_t>();
+                    event.roomNumber = reader.get<int32_t>();
+                    event.from = reader.get<int32_t>();
+                    event.to = reader.get<int32_t>();
+                    event.guests = reader.get<int32_t>();
+                    event.roomType = reader.get<uint8_t>();
+                    event.billing = reader.get<uint8_t>();
+                    event.rate = static_cast<double>(reader.get<int64_t>()) / 100.0;
+                }
+                break;
+            default:
+                throw runtime_error("Unknown journal record.");
+        }
+        return event;
+    }
+};
+
+static_assert(sizeof(ChangeEvent) == 56 && is_trivially_copyable_v<ChangeEvent>, "change event layout changed");
+
+// Lock-free ring holding the latest CAPACITY change events. A publisher claims an offset with one
+// atomic increment and writes the event into slot offset % CAPACITY between two stores of the
+// slot's sequence (odd while writing, even once readable), so it never waits on a reader or on
+// a publisher of another slot. Readers copy an event out and check the sequence again: a slot
+// reused for a later offset means the reader fell a whole ring behind and has to catch up from
+// the journal. The event words are atomics stored with release and loaded with acquire, so a
+// copy that sees any word of a reuse also sees the new sequence, and is discarded instead of
+// being a data race.
+class ChangeFeed {
+public:
+    static constexpr size_t CAPACITY = size_t(1) << 14;
+
+private:
+    static constexpr size_t WORDS = sizeof(ChangeEvent) / sizeof(uint64_t);
+
+    struct Slot {
+        atomic<uint64_t> sequence{0};   // 2 * offset + 1 while offset is written, 2 * offset + 2 once readable
+        array<atomic<uint64_t>, WORDS> words{};
+    };
+
+    unique_ptr<Slot[]> slots;
+    atomic<uint64_t> first{0};          // offset of the first event published since restart
+    atomic<uint64_t> next{0};           // offset the next publish claims
+
+public:
+    ChangeFeed() : slots(new Slot[CAPACITY]) {}
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    uint64_t end() const { return next.load(memory_order_acquire); }
+
+    // Lowest offset the ring may still hold.
+    uint64_t oldest() const {
+        uint64_t last = next.load(memory_order_acquire), start = first.load(memory_order_acquire);
+        return last - start > CAPACITY ? last - CAPACITY : start;
+    }
+
+    // Empties the ring and numbers the next event offset; nothing may publish or read meanwhile.
+    void restart(uint64_t offset) {
+        for (size_t i = 0; i < CAPACITY; ++i) slots[i].sequence.store(0, memory_order_relaxed);
+        first.store(offset, memory_order_release);
+        next.store(offset, memory_order_release);
+    }
+
+    uint64_t publish(ChangeEvent event) {
+        uint64_t offset = next.fetch_add(1, memory_order_relaxed);
+        event.offset = offset;
+        Slot& slot = slots[offset & (CAPACITY - 1)];
+        // Only a publisher a whole ring earlier can still be writing this slot.
+        while (slot.sequence.load(memory_order_acquire) & 1) this_thread::yield();
+        slot.sequence.store(2 * offset + 1, memory_order_relaxed);
+        uint64_t words[WORDS];
+        memcpy(words, &event, sizeof(event));
+        for (size_t i = 0; i < WORDS; ++i) slot.words[i].store(words[i], memory_order_release);
+        slot.sequence.store(2 * offset + 2, memory_order_release);
+        return offset;
+    }
+
+    // Appends up to limit events from offset on to batch, stopping early at one still being
+    // written, and returns the offset after the last one appended. Returns nullopt, with nothing
+    // appended, if the event at offset is no longer in the ring.
+    optional<uint64_t> read(uint64_t offset, size_t limit, vector<ChangeEvent>& batch) const {
+        if (offset < first.load(memory_order_acquire)) return nullopt;
+        for (size_t copied = 0; copied < limit && offset < end(); ++copied, ++offset) {
+            const Slot& slot = slots[offset & (CAPACITY - 1)];
+            uint64_t ready = 2 * offset + 2;
+            uint64_t before = slot.sequence.load(memory_order_acquire);
+            if (before < ready) break;
+            uint64_t words[WORDS];
+            for (size_t i = 0; i < WORDS; ++i) words[i] = slot.words[i].load(memory_order_acquire);
+            if (before > ready || slot.sequence.load(memory_order_relaxed) != ready) {
+                if (copied == 0) return nullopt;
+                break;
+            }
+            ChangeEvent event;
+            memcpy(&event, words, sizeof(event));
+            batch.push_back(event);
+        }
+        return offset;
+    }
+};
+
+// Events returned by Hotel::changesSince.
+struct ChangeBatch {
+    vector<ChangeEvent> events;
+    uint64_t next = 0;          // offset to ask for next time
+    bool gap = false;           // events after the requested offset were folded into a snapshot and skipped
+};
+
+// Read-only view of a whole file, memory-mapped where the platform allows it.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { close(); return false; }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) { close(); return false; }
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!bytes) { close(); return false; }
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) { ::close(fd); return false; }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        bytes = static_cast<const char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Snapshot format version 6: fixed-size records so the file can be mapped and read in place.
+//   SnapshotHeader | SnapshotRoomRecord[roomCount] | uint32_t room slots sorted by room number
+//   | SnapshotReservationRecord[reservationCount] sorted by ID | SnapshotRateRecord[rateRuleCount]
+//   | SnapshotWaitRecord[waitlistCount] | stay archive blocks | string heap
+// Every section starts on an 8-byte boundary. Guest names and contacts live in the string heap
+// and are referenced by offset and length. Version 5 is the same without the stay archive and
+// the two header fields after lastWaitID, version 4 also lacks the waitlist and the header
+// fields after changeOffset, version 3 also lacks changeOffset, and version 2 also lacks the
+// rate rules and the two header fields after stringHeapSize.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t lastIssuedID;
+    uint32_t roomCount;
+    uint32_t reservationCount;
+    uint64_t roomOffset;
+    uint64_t roomOrderOffset;
+    uint64_t reservationOffset;
+    uint64_t stringHeapOffset;
+    uint64_t stringHeapSize;
+    uint64_t rateRuleOffset;
+    uint32_t rateRuleCount;
+    uint32_t reserved;
+    uint64_t changeOffset;      // change feed offset of the first mutation after the snapshot
+    uint64_t waitlistOffset;
+    uint32_t waitlistCount;
+    int32_t lastWaitID;
+    uint64_t archiveOffset;     // StayArchive::write output of archiveSize bytes
+    uint64_t archiveSize;
+};
+
+struct SnapshotRoomRecord {
+    double baseRate;
+    int32_t roomNumber;
+    int32_t maxGuests;
+    uint8_t type;
+    uint8_t billing;
+    uint8_t reserved[6];
+};
+
+struct SnapshotReservationRecord {
+    int32_t reservationID;
+    int32_t roomNumber;
+    int32_t checkIn;
+    int32_t checkOut;
+    int32_t numberOfGuests;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t contactOffset;
+    uint32_t contactLength;
+    uint32_t reserved;
+};
+
+// One RateRule of the room type's calendar; applied in file order to flat calendars.
+struct SnapshotRateRecord {
+    double value;
+    int32_t from;
+    int32_t to;
+    uint8_t type;
+    uint8_t kind;
+    uint8_t reserved[6];
+};
+
+// One waiting request; in the string heap like a reservation's guest.
+struct SnapshotWaitRecord {
+    int32_t waitID;
+    int32_t checkIn;
+    int32_t checkOut;
+    int32_t guests;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t contactOffset;
+    uint32_t contactLength;
+    uint8_t type;
+    uint8_t loyaltyTier;
+    uint8_t corporate;
+    uint8_t reserved[5];
+};
+
+static_assert(sizeof(SnapshotHeader) == 120, "snapshot header layout changed");
+static_assert(sizeof(SnapshotRoomRecord) == 24, "snapshot room record layout changed");
+static_assert(sizeof(SnapshotReservationRecord) == 40, "snapshot reservation record layout changed");
+static_assert(sizeof(SnapshotRateRecord) == 24, "snapshot rate record layout changed");
+static_assert(sizeof(SnapshotWaitRecord) == 40, "snapshot waitlist record layout changed");
+
+// A validated version 2 to 6 snapshot, mapped (or read, if mapping fails) and queried in place.
+class SnapshotImage {
+private:
+    string sourcePath;
+    MappedFile mapping;
+    string buffer;
+    const char* base = nullptr;
+    size_t size = 0;
+    const SnapshotHeader* header = nullptr;
+
+    bool sectionFits(uint64_t offset, uint64_t bytes) const {
+        return offset % 8 == 0 && offset <= size && bytes <= size - offset;
+    }
+
+public:
+    // Returns false if there is no file; throws runtime_error if it is not a valid version 2 to 6 snapshot.
+    bool open(const string& path, const char (&magic)[8]) {
+        sourcePath = path;
+        if (mapping.open(path)) {
+            base = mapping.data();
+            size = mapping.size();
+        } else {
+            if (!readWholeFile(path, buffer)) return false;
+            base = buffer.data();
+            size = buffer.size();
+        }
+        if (size < offsetof(SnapshotHeader, rateRuleOffset)) throw runtime_error("'" + path + "' is truncated.");
+        header = reinterpret_cast<const SnapshotHeader*>(base);
+        if ((header->version == 3 && size < offsetof(SnapshotHeader, changeOffset)) ||
+            (header->version == 4 && size < offsetof(SnapshotHeader, waitlistOffset)) ||
+            (header->version == 5 && size < offsetof(SnapshotHeader, archiveOffset)) ||
+            (header->version == 6 && size < sizeof(SnapshotHeader))) {
+            throw runtime_error("'" + path + "' is truncated.");
+        }
+        if (memcmp(header->magic, magic, sizeof(header->magic)) != 0 || header->version < 2 || header->version > 6 ||
+            !sectionFits(header->roomOffset, uint64_t(header->roomCount) * sizeof(SnapshotRoomRecord)) ||
+            !sectionFits(header->roomOrderOffset, uint64_t(header->roomCount) * sizeof(uint32_t)) ||
+            !sectionFits(header->reservationOffset, uint64_t(header->reservationCount) * sizeof(SnapshotReservationRecord)) ||
+            !sectionFits(header->stringHeapOffset, header->stringHeapSize) ||
+            (header->version >= 3 && !sectionFits(header->rateRuleOffset, uint64_t(header->rateRuleCount) * sizeof(SnapshotRateRecord))) ||
+            (header->version >= 5 && !sectionFits(header->waitlistOffset, uint64_t(header->waitlistCount) * sizeof(SnapshotWaitRecord))) ||
+            (header->version >= 6 && !sectionFits(header->archiveOffset, header->archiveSize))) {
+            throw runtime_error("'" + path + "' is not a valid version 2 to 6 snapshot.");
+        }
+        return true;
+    }
+
+    const string& path() const { return sourcePath; }
+    int lastIssuedID() const { return header->lastIssuedID; }
+    size_t roomCount() const { return header->roomCount; }
+    size_t reservationCount() const { return header->reservationCount; }
+    size_t rateRuleCount() const { return header->version >= 3 ? header->rateRuleCount : 0; }
+    uint64_t changeOffset() const { return header->version >= 4 ? header->changeOffset : 0; }
+    size_t waitlistCount() const { return header->version >= 5 ? header->waitlistCount : 0; }
+    int lastWaitID() const { return header->version >= 5 ? header->lastWaitID : 0; }
+
+    // The archive section, empty before version 6.
+    BinaryReader archive() const {
+        return header->version >= 6 ? BinaryReader(base + header->archiveOffset, header->archiveSize) : BinaryReader(nullptr, 0);
+    }
+
+    const SnapshotRoomRecord& room(size_t slot) const {
+        return reinterpret_cast<const SnapshotRoomRecord*>(base + header->roomOffset)[slot];
+    }
+
+    const SnapshotReservationRecord& reservation(size_t slot) const {
+        return reinterpret_cast<const SnapshotReservationRecord*>(base + header->reservationOffset)[slot];
+    }
+
+    const SnapshotRateRecord& rateRule(size_t slot) const {
+        return reinterpret_cast<const SnapshotRateRecord*>(base + header->rateRuleOffset)[slot];
+    }
+
+    const SnapshotWaitRecord& waitRecord(size_t slot) const {
+        return reinterpret_cast<const SnapshotWaitRecord*>(base + header->waitlistOffset)[slot];
+    }
+
+    const SnapshotRoomRecord* findRoom(int roomNumber) const {
+        const uint32_t* order = reinterpret_cast<const uint32_t*>(base + header->roomOrderOffset);
+        const uint32_t* slot = lower_bound(order, order + header->roomCount, roomNumber,
+            [&](uint32_t candidate, int number) { return candidate < header->roomCount && room(candidate).roomNumber < number; });
+        if (slot == order + header->roomCount || *slot >= header->roomCount || room(*slot).roomNumber != roomNumber) return nullptr;
+        return &room(*slot);
+    }
+
+    const SnapshotReservationRecord* findReservation(int reservationID) const {
+        const SnapshotReservationRecord* first = &reservation(0);
+        const SnapshotReservationRecord* last = first + header->reservationCount;
+        const SnapshotReservationRecord* found = lower_bound(first, last, reservationID,
+            [](const SnapshotReservationRecord& record, int id) { return record.reservationID < id; });
+        return found != last && found->reservationID == reservationID ? found : nullptr;
+    }
+
+    string_view text(uint32_t offset, uint32_t length) const {
+        if (offset > header->stringHeapSize || length > header->stringHeapSize - offset) return string_view();
+        return string_view(base + header->stringHeapOffset + offset, length);
+    }
+};
+
+// One checked-out stay as the archive keeps it. Bills are whole cents, so archive sums are exact.
+struct ArchivedStay {
+    int32_t reservationID = 0;
+    int32_t roomNumber = 0;
+    int32_t checkIn = 0;              // day numbers; checkOut is when the guest actually left
+    int32_t checkOut = 0;
+    int32_t guests = 0;
+    uint8_t type = 0;                 // Room::RoomType
+    uint8_t billing = 0;              // BillingStrategy::index()
+    int64_t billedCents = 0;
+};
+
+// One calendar month of Hotel::archiveSummary, by room type.
+struct ArchiveMonth {
+    struct TypeFigures {
+        long long stays = 0;          // stays whose last night falls in the month
+        long long stayNights = 0;     // the length of those stays
+        long long revenueCents = 0;   // and their bills
+        long long roomNights = 0;     // nights of any archived stay that fall in the month
+    };
+
+    int year = 0;
+    int month = 0;
+    int nights = 0;                   // nights of the month inside the queried range
+    array<TypeFigures, Room::TYPE_COUNT> byType{};
+};
+
+struct ArchiveSummary {
+    Date from, to;                    // the nights [from, to) looked at
+    vector<ArchiveMonth> months;      // every month the range touches, in order
+    size_t stays = 0;                 // in the whole archive
+    size_t blocks = 0;                // sealed blocks in the archive
+    size_t storedBytes = 0;           // their compressed columns
+    size_t blocksRead = 0;            // blocks decoded for this summary; the others missed the range
+    size_t rowsRead = 0;              // rows of those blocks and the unsealed rows
+};
+
+// Append-only store of checked-out stays, kept apart from the live booking structures so that
+// finished stays no longer slow their scans down. Rows are kept by column: the newest in plain
+// arrays, and every BLOCK_ROWS rows sealed into a block whose columns are compressed on their
+// own (IDs and check-ins as zigzag deltas, other numbers as zigzag varints, type and billing
+// run-length coded). Each block records the nights it spans, so a summary skips the blocks
+// outside its range and decodes only the four columns it reads of the rest. Not synchronized;
+// Hotel guards it with archiveMutex.
+class StayArchive {
+public:
+    static constexpr size_t BLOCK_ROWS = 4096;
+    static constexpr int32_t MAX_SUMMARY_NIGHTS = 100 * 366;
+
+private:
+    enum Column : size_t { ID, ROOM, CHECK_IN, NIGHTS, GUESTS, TYPE, BILLING, BILLED, COLUMNS };
+    using Columns = array<vector<int64_t>, COLUMNS>;
+
+    struct Span {
+        int32_t first = numeric_limits<int32_t>::max();   // earliest check-in
+        int32_t last = numeric_limits<int32_t>::min();    // latest check-out
+
+        void add(int32_t checkIn, int32_t checkOut) {
+            first = min(first, checkIn);
+            last = max(last, checkOut);
+        }
+        bool misses(int32_t from, int32_t to) const { return last <= from || to <= first; }
+    };
+
+    struct Block {
+        uint32_t rows = 0;
+        Span span;
+        array<uint32_t, COLUMNS + 1> offsets{};   // column c is bytes [offsets[c], offsets[c + 1])
+        string bytes;
+    };
+
+    vector<Block> blocks;
+    Columns tail;                     // rows not sealed yet
+    Span tailSpan;
+    Span span;                        // of every row
+    size_t rows = 0;
+    size_t storedBytes = 0;
+
+    static uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+    static bool deltaCoded(size_t column) { return column == ID || column == CHECK_IN; }
+    static bool runCoded(size_t column) { return column == TYPE || column == BILLING; }
+
+    static void putVarint(string& out, uint64_t value) {
+        for (; value >= 0x80; value >>= 7) out += static_cast<char>(value | 0x80);
+        out += static_cast<char>(value);
+    }
+
+    static void encode(size_t column, const vector<int64_t>& values, string& out) {
+        if (runCoded(column)) {
+            for (size_t i = 0, end; i < values.size(); i = end) {
+                for (end = i + 1; end < values.size() && values[end] == values[i]; ++end) {}
+                putVarint(out, zigzag(values[i]));
+                putVarint(out, end - i);
+            }
+            return;
+        }
+        int64_t previous = 0;
+        for (int64_t value : values) {
+            putVarint(out, zigzag(value - previous));
+            if (deltaCoded(column)) previous = value;
+        }
+    }
+
+    // Decodes count values of a column; throws runtime_error if the bytes do not hold exactly that.
+    static void decode(size_t column, const char* at, const char* end, size_t count, int64_t* values) {
+        auto next = [&] {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (at == end) break;
+                uint8_t byte = static_cast<uint8_t>(*at++);
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return value;
+            }
+            throw runtime_error("Damaged archive block.");
+        };
+        if (runCoded(column)) {
+            for (size_t i = 0; i < count;) {
+                int64_t value = unzigzag(next());
+                uint64_t length = next();
+                if (length == 0 || length > count - i) throw runtime_error("Damaged archive block.");
+                fill(values + i, values + i + length, value);
+                i += static_cast<size_t>(length);
+            }
+        } else {
+            int64_t previous = 0;
+            for (size_t i = 0; i < count; ++i) {
+                values[i] = static_cast<int64_t>(static_cast<uint64_t>(previous) + static_cast<uint64_t>(unzigzag(next())));
+                if (deltaCoded(column)) previous = values[i];
+            }
+        }
+        if (at != end) throw runtime_error("Damaged archive block.");
+    }
+
+    static Block pack(const Columns& columns, const Span& span) {
+        Block block;
+        block.rows = static_cast<uint32_t>(columns[ID].size());
+        block.span = span;
+        for (size_t column = 0; column < COLUMNS; ++column) {
+            block.offsets[column] = static_cast<uint32_t>(block.bytes.size());
+            encode(column, columns[column], block.bytes);
+        }
+        block.offsets[COLUMNS] = static_cast<uint32_t>(block.bytes.size());
+        return block;
+    }
+
+    void decodeColumn(const Block& block, size_t column, int64_t* values) const {
+        decode(column, block.bytes.data() + block.offsets[column], block.bytes.data() + block.offsets[column + 1], block.rows, values);
+    }
+
+    void seal() {
+        blocks.push_back(pack(tail, tailSpan));
+        blocks.back().bytes.shrink_to_fit();
+        storedBytes += blocks.back().bytes.size();
+        for (vector<int64_t>& values : tail) values.clear();
+        tailSpan = Span();
+    }
+
+    void push(const int64_t (&row)[COLUMNS]) {
+        for (size_t column = 0; column < COLUMNS; ++column) tail[column].push_back(row[column]);
+        int32_t checkIn = static_cast<int32_t>(row[CHECK_IN]), checkOut = static_cast<int32_t>(row[CHECK_IN] + row[NIGHTS]);
+        tailSpan.add(checkIn, checkOut);
+        span.add(checkIn, checkOut);
+        ++rows;
+        if (tail[ID].size() == BLOCK_ROWS) seal();
+    }
+
+    // Throws runtime_error if the first count decoded rows hold values no stay could have.
+    static void check(const Columns& columns, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (columns[NIGHTS][i] < 1 || columns[CHECK_IN][i] < numeric_limits<int32_t>::min() ||
+                columns[CHECK_IN][i] + columns[NIGHTS][i] > numeric_limits<int32_t>::max() ||
+                columns[TYPE][i] < 0 || columns[TYPE][i] >= static_cast<int64_t>(Room::TYPE_COUNT) ||
+                columns[BILLING][i] < 0 || columns[BILLING][i] >= static_cast<int64_t>(BILLING_KINDS.size())) {
+                throw runtime_error("Damaged archive block.");
+            }
+        }
+    }
+
+public:
+    size_t size() const { return rows; }
+    size_t blockCount() const { return blocks.size(); }
+    size_t compressedBytes() const { return storedBytes; }
+    bool empty() const { return rows == 0; }
+
+    // The nights [first, last) some archived stay covers; only meaningful when not empty.
+    int32_t firstNight() const { return span.first; }
+    int32_t lastNight() const { return span.last; }
+
+    void clear() { *this = StayArchive(); }
+
+    void append(const ArchivedStay& stay) {
+        const int64_t row[COLUMNS] = { stay.reservationID, stay.roomNumber, stay.checkIn, stay.checkOut - stay.checkIn,
+                                       stay.guests, stay.type, stay.billing, stay.billedCents };
+        push(row);
+    }
+
+    // Monthly figures for the nights [from, to). Each block the range touches is decoded a
+    // column at a time into arrays, and one branch-free loop over them tallies every row:
+    // stays and their bills land in the month of their last night, and each stay marks its
+    // nights in the range on a per-type difference array that is summed into room nights at the
+    // end. Throws invalid_argument for an empty or overlong range.
+    ArchiveSummary summarize(Date from, Date to) const {
+        const int32_t first = from.dayNumber(), nights = to - from;
+        if (nights <= 0) throw invalid_argument("Invalid date range.");
+        if (nights > MAX_SUMMARY_NIGHTS) throw invalid_argument("An archive summary covers at most 100 years.");
+        ArchiveSummary summary;
+        summary.from = from;
+        summary.to = to;
+        summary.stays = rows;
+        summary.blocks = blocks.size();
+        summary.storedBytes = storedBytes;
+
+        vector<uint32_t> monthOf(static_cast<size_t>(nights));
+        for (int32_t night = 0; night < nights; ++night) {
+            int year, month, day;
+            Date(first + night).toCivil(year, month, day);
+            if (summary.months.empty() || summary.months.back().month != month || summary.months.back().year != year) {
+                summary.months.emplace_back();
+                summary.months.back().year = year;
+                summary.months.back().month = month;
+            }
+            ++summary.months.back().nights;
+            monthOf[static_cast<size_t>(night)] = static_cast<uint32_t>(summary.months.size() - 1);
+        }
+
+        constexpr size_t TYPES = Room::TYPE_COUNT;
+        vector<long long> stays(summary.months.size() * TYPES), stayNights(stays.size()), revenue(stays.size());
+        vector<long long> marks((static_cast<size_t>(nights) + 1) * TYPES);
+        auto tally = [&](const int64_t* checkIn, const int64_t* length, const int64_t* type, const int64_t* billed, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                const int64_t start = checkIn[i] - first, end = start + length[i];
+                const size_t t = static_cast<size_t>(type[i]);
+                // A stay outside the range marks the same edge twice and so counts no nights.
+                marks[static_cast<size_t>(clamp<int64_t>(start, 0, nights)) * TYPES + t] += 1;
+                marks[static_cast<size_t>(clamp<int64_t>(end, 0, nights)) * TYPES + t] -= 1;
+                const int64_t lastNight = end - 1;
+                const long long inside = static_cast<uint64_t>(lastNight) < static_cast<uint64_t>(nights);
+                const size_t cell = monthOf[static_cast<size_t>(inside ? lastNight : 0)] * TYPES + t;
+                stays[cell] += inside;
+                stayNights[cell] += inside * length[i];
+                revenue[cell] += inside * billed[i];
+            }
+        };
+
+        vector<int64_t> checkIn(BLOCK_ROWS), length(BLOCK_ROWS), type(BLOCK_ROWS), billed(BLOCK_ROWS);
+        for (const Block& block : blocks) {
+            if (block.span.misses(first, first + nights)) continue;
+            ++summary.blocksRead;
+            summary.rowsRead += block.rows;
+            decodeColumn(block, CHECK_IN, checkIn.data());
+            decodeColumn(block, NIGHTS, length.data());
+            decodeColumn(block, TYPE, type.data());
+            decodeColumn(block, BILLED, billed.data());
+            tally(checkIn.data(), length.data(), type.data(), billed.data(), block.rows);
+        }
+        tally(tail[CHECK_IN].data(), tail[NIGHTS].data(), tail[TYPE].data(), tail[BILLED].data(), tail[ID].size());
+        summary.rowsRead += tail[ID].size();
+
+        array<long long, TYPES> occupied{};
+        for (int32_t night = 0; night < nights; ++night) {
+            ArchiveMonth& month = summary.months[monthOf[static_cast<size_t>(night)]];
+            for (size_t t = 0; t < TYPES; ++t) {
+                occupied[t] += marks[static_cast<size_t>(night) * TYPES + t];
+                month.byType[t].roomNights += occupied[t];
+            }
+        }
+        for (size_t m = 0; m < summary.months.size(); ++m) {
+            for (size_t t = 0; t < TYPES; ++t) {
+                ArchiveMonth::TypeFigures& figures = summary.months[m].byType[t];
+                figures.stays = stays[m * TYPES + t];
+                figures.stayNights = stayNights[m * TYPES + t];
+                figures.revenueCents = revenue[m * TYPES + t];
+            }
+        }
+        return summary;
+    }
+
+    // The sealed blocks, then the unsealed rows as one more, shorter block.
+    void write(BinaryWriter& writer) const {
+        auto put = [&](const Block& block) {
+            writer.put<uint32_t>(block.rows);
+            writer.put<int32_t>(block.span.first);
+            writer.put<int32_t>(block.span.last);
+            for (size_t column = 0; column < COLUMNS; ++column) writer.put<uint32_t>(block.offsets[column]);
+            writer.putString(block.bytes);
+        };
+        writer.put<uint32_t>(static_cast<uint32_t>(blocks.size() + (tail[ID].empty() ? 0 : 1)));
+        for (const Block& block : blocks) put(block);
+        if (!tail[ID].empty()) put(pack(tail, tailSpan));
+    }
+
+    // Replaces the contents with what write produced, checking every block; a block shorter than
+    // BLOCK_ROWS is taken back into the unsealed rows. Throws runtime_error if anything is damaged.
+    void read(BinaryReader& reader) {
+        clear();
+        uint32_t count = reader.get<uint32_t>();
+        Columns columns;
+        for (vector<int64_t>& values : columns) values.resize(BLOCK_ROWS);
+        for (uint32_t b = 0; b < count; ++b) {
+            Block block;
+            block.rows = reader.get<uint32_t>();
+            block.span.first = reader.get<int32_t>();
+            block.span.last = reader.get<int32_t>();
+            for (size_t column = 0; column < COLUMNS; ++column) block.offsets[column] = reader.get<uint32_t>();
+            block.bytes = reader.getString();
+            block.offsets[COLUMNS] = static_cast<uint32_t>(block.bytes.size());
+            if (block.rows == 0 || block.rows > BLOCK_ROWS || block.offsets[0] != 0 ||
+                !is_sorted(block.offsets.begin(), block.offsets.end())) {
+                throw runtime_error("Damaged archive block.");
+            }
+            for (size_t column = 0; column < COLUMNS; ++column) decodeColumn(block, column, columns[column].data());
+            check(columns, block.rows);
+            if (block.rows < BLOCK_ROWS) {
+                for (size_t i = 0; i < block.rows; ++i) {
+                    int64_t row[COLUMNS];
+                    for (size_t column = 0; column < COLUMNS; ++column) row[column] = columns[column][i];
+                    push(row);
+                }
+                continue;
+            }
+            Span decoded;
+            for (size_t i = 0; i < block.rows; ++i) {
+                decoded.add(static_cast<int32_t>(columns[CHECK_IN][i]), static_cast<int32_t>(columns[CHECK_IN][i] + columns[NIGHTS][i]));
+            }
+            if (decoded.first != block.span.first || decoded.last != block.span.last) throw runtime_error("Damaged archive block.");
+            span.add(decoded.first, decoded.last);
+            rows += block.rows;
+            storedBytes += block.bytes.size();
+            blocks.push_back(move(block));
+        }
+    }
+};
+
+// Filters for Hotel::findRooms. Unset fields match every room.
+struct RoomFilter {
+    optional<Room::RoomType> type;
+    optional<size_t> billing;             // BillingStrategy::index()
+    double minRate = 0.0;
+    double maxRate = numeric_limits<double>::infinity();
+    int minGuests = 0;
+    optional<Date> freeFrom, freeTo;      // free for the whole stay [freeFrom, freeTo)
+};
+
+// Position after the last room of a page; rooms are ordered by type, then rate, then number.
+struct RoomCursor {
+    int type = 0;
+    double rate = 0.0;
+    int roomNumber = 0;
+
+    string toString() const {
+        char text[64];
+        snprintf(text, sizeof(text), "%d:%.17g:%d", type, rate, roomNumber);
+        return text;
+    }
+
+    static RoomCursor parse(const string& text) {
+        RoomCursor cursor;
+        char extra;
+        if (sscanf(text.c_str(), "%d:%lf:%d%c", &cursor.type, &cursor.rate, &cursor.roomNumber, &extra) != 3) {
+            throw invalid_argument("Invalid room cursor '" + text + "'.");
+        }
+        return cursor;
+    }
+};
+
+struct RoomPage {
+    vector<int> roomNumbers;
+    optional<RoomCursor> next;            // set when the page is full; the next page may be empty
+};
+
+struct RoomOffer {
+    int roomNumber;
+    double bill;
+};
+
+// Rows of a bulk import (see BulkImporter), already parsed; line is the row's line in its file.
+struct ImportedRoom {
+    size_t line;
+    int number;
+    Room::RoomType type;
+    double rate;
+    BillingStrategy billing;
+    int maxGuests;
+};
+
+struct ImportedStay {
+    size_t line;
+    string guestName;
+    string contactInfo;
+    int roomNumber;
+    Date checkIn;
+    Date checkOut;
+    int guests;
+};
+
+struct ImportRejection {
+    size_t line;
+    string reason;
+};
+
+// Filters for Hotel::findReservations. Unset fields match every reservation.
+struct ReservationFilter {
+    string guestPrefix;                   // case-insensitive
+    optional<Date> from, to;              // stays overlapping [from, to)
+};
+
+// Position after the last reservation of a page. Pages with a guest prefix are ordered by
+// guest name, others by check-in date; ties go by ID.
+struct ReservationCursor {
+    string guestKey;
+    int32_t checkIn = 0;
+    int reservationID = 0;
+
+    string toString() const { return to_string(checkIn) + ":" + to_string(reservationID) + ":" + guestKey; }
+
+    static ReservationCursor parse(const string& text) {
+        ReservationCursor cursor;
+        int consumed = 0;
+        if (sscanf(text.c_str(), "%d:%d:%n", &cursor.checkIn, &cursor.reservationID, &consumed) != 2 || consumed == 0) {
+            throw invalid_argument("Invalid reservation cursor '" + text + "'.");
+        }
+        cursor.guestKey = text.substr(static_cast<size_t>(consumed));
+        return cursor;
+    }
+};
+
+struct ReservationPage {
+    vector<Reservation> reservations;
+    optional<ReservationCursor> next;
+};
+
+// Running figures behind Hotel::stats(). Every mutation adjusts them by the rooms and stays it
+// touches, so reading them never walks rooms or reservations. Occupancy is for the night of
+// day; revenue is the billed total of the stays currently booked, by the room's strategy.
+struct HotelStats {
+    struct TypeFigures {
+        int rooms = 0;
+        int occupied = 0;
+    };
+    struct BillingFigures {
+        int rooms = 0;
+        long long bookedNights = 0;
+        double projectedRevenue = 0.0;
+    };
+
+    Date day = Date::today();
+    size_t reservations = 0;
+    array<TypeFigures, Room::TYPE_COUNT> byType{};                   // by Room::RoomType
+    array<BillingFigures, BILLING_KINDS.size()> byBilling{};         // by BillingStrategy::index()
+
+    int rooms() const {
+        int total = 0;
+        for (const TypeFigures& figures : byType) total += figures.rooms;
+        return total;
+    }
+
+    int occupied() const {
+        int total = 0;
+        for (const TypeFigures& figures : byType) total += figures.occupied;
+        return total;
+    }
+
+    double occupancyPercent() const { return rooms() ? 100.0 * occupied() / rooms() : 0.0; }
+
+    double projectedRevenue() const {
+        double total = 0.0;
+        for (const BillingFigures& figures : byBilling) total += figures.projectedRevenue;
+        return total;
+    }
+};
+
+// Settings of one Hotel::optimizeAssignments run. Only stays checking in during the horizon,
+// and after today, may move; the rest of the calendar is kept as it is.
+struct AssignmentOptions {
+    Date from = Date::today() + 1;
+    Date to = Date::today() + 31;
+    unordered_set<int> locked;            // reservations that keep their room
+    int shortGap = 1;                     // free runs of up to this many nights between two stays are gaps
+    chrono::milliseconds budget{2000};    // planning time for the whole run
+    size_t threads = 4;                   // room types planned at the same time
+};
+
+// One reservation's change of room in an assignment plan.
+struct AssignmentMove {
+    int reservationID;
+    int fromRoom;
+    int toRoom;
+};
+
+// Plans the rooms of one room type's stays so the calendar is left with as few gap nights as
+// possible, then as few spare beds (capacity the party does not use), then as few moves. The
+// stays that may move are placed in check-in order, each into the room that best fills around
+// it; every stay is then offered each other room it fits for as long as that lowers the cost
+// or until the deadline. The same local search also runs from the current rooms, and the
+// cheaper of the two plans wins. Rooms are interchangeable only at the same base rate and
+// billing strategy, so a move never changes what a guest pays. The planner works on a copy of
+// the calendars and takes no locks.
+class AssignmentPlanner {
+public:
+    struct PlanRoom {
+        int roomNumber;
+        int maxGuests;
+        double unitPrice;                 // base rate times the billing multiplier
+    };
+
+    struct PlanStay {
+        int reservationID;
+        int32_t checkIn;
+        int32_t checkOut;
+        int guests;
+        size_t room;                      // index into the rooms, as booked now
+        bool movable;
+    };
+
+    struct Cost {
+        long long gapNights = 0;
+        long long spareBeds = 0;          // over the stays that may move
+        long long moves = 0;
+
+        bool operator<(const Cost& other) const {
+            return tie(gapNights, spareBeds, moves) < tie(other.gapNights, other.spareBeds, other.moves);
+        }
+    };
+
+    struct Plan {
+        vector<AssignmentMove> moves;
+        Cost before;
+        Cost after;
+        bool complete = true;             // false when the deadline cut the search short
+    };
+
+private:
+    vector<PlanRoom> rooms;
+    vector<PlanStay> stays;
+    int32_t from;
+    int32_t to;
+    int shortGap;
+    chrono::steady_clock::time_point deadline;
+    bool timedOut = false;
+    vector<size_t> placement;                  // stay -> room
+    vector<map<int32_t, size_t>> calendars;    // by room: check-in -> stay
+
+    bool expired() {
+        if (!timedOut && chrono::steady_clock::now() >= deadline) timedOut = true;
+        return timedOut;
+    }
+
+    // Nights of the free run from one stay's check-out to the next stay's check-in, if they are a gap.
+    long long gapBetween(int32_t end, int32_t start) const {
+        int32_t nights = start - end;
+        return nights > 0 && nights <= shortGap && end >= from && end < to ? nights : 0;
+    }
+
+    // Change in gap nights from adding the stay to a room's calendar.
+    long long insertDelta(size_t room, const PlanStay& stay) const {
+        const auto& calendar = calendars[room];
+        auto next = calendar.lower_bound(stay.checkIn);
+        bool hasNext = next != calendar.end();
+        bool hasPrev = next != calendar.begin();
+        int32_t prevEnd = hasPrev ? stays[prev(next)->second].checkOut : 0;
+        int32_t nextStart = hasNext ? next->first : 0;
+        long long before = hasPrev && hasNext ? gapBetween(prevEnd, nextStart) : 0;
+        long long after = (hasPrev ? gapBetween(prevEnd, stay.checkIn) : 0) + (hasNext ? gapBetween(stay.checkOut, nextStart) : 0);
+        return after - before;
+    }
+
+    // Nights between the stay and the stay before it in the room, for tightest-fit ties.
+    long long leadIn(size_t room, const PlanStay& stay) const {
+        const auto& calendar = calendars[room];
+        auto next = calendar.lower_bound(stay.checkIn);
+        return next == calendar.begin() ? numeric_limits<int32_t>::max() : stay.checkIn - stays[prev(next)->second].checkOut;
+    }
+
+    bool fits(size_t room, const PlanStay& stay) const {
+        if (rooms[room].maxGuests < stay.guests || rooms[room].unitPrice != rooms[stay.room].unitPrice) return false;
+        const auto& calendar = calendars[room];
+        auto next = calendar.lower_bound(stay.checkIn);
+        if (next != calendar.end() && next->first < stay.checkOut) return false;
+        return next == calendar.begin() || stays[prev(next)->second].checkOut <= stay.checkIn;
+    }
+
+    void place(size_t stay, size_t room) {
+        placement[stay] = room;
+        calendars[room].emplace(stays[stay].checkIn, stay);
+    }
+
+    void unplace(size_t stay) { calendars[placement[stay]].erase(stays[stay].checkIn); }
+
+    Cost cost() const {
+        Cost total;
+        for (const auto& calendar : calendars) {
+            for (auto it = calendar.begin(); it != calendar.end() && next(it) != calendar.end(); ++it) {
+                total.gapNights += gapBetween(stays[it->second].checkOut, next(it)->first);
+            }
+        }
+        for (size_t s = 0; s < stays.size(); ++s) {
+            if (!stays[s].movable) continue;
+            total.spareBeds += rooms[placement[s]].maxGuests - stays[s].guests;
+            if (placement[s] != stays[s].room) ++total.moves;
+        }
+        return total;
+    }
+
+    void reset() {
+        calendars.assign(rooms.size(), {});
+        placement.assign(stays.size(), 0);
+    }
+
+    // Places the fixed stays where they are and the others greedily in check-in order.
+    // Returns false if some stay found no room.
+    bool placeGreedy(const vector<size_t>& order) {
+        reset();
+        for (size_t s = 0; s < stays.size(); ++s) {
+            if (!stays[s].movable) place(s, stays[s].room);
+        }
+        for (size_t s : order) {
+            if (expired()) return false;
+            const PlanStay& stay = stays[s];
+            optional<size_t> best;
+            tuple<long long, int, long long, bool, int> bestKey;
+            for (size_t room = 0; room < rooms.size(); ++room) {
+                if (!fits(room, stay)) continue;
+                auto key = make_tuple(insertDelta(room, stay), rooms[room].maxGuests, leadIn(room, stay), room != stay.room, rooms[room].roomNumber);
+                if (!best || key < bestKey) {
+                    best = room;
+                    bestKey = key;
+                }
+            }
+            if (!best) return false;
+            place(s, *best);
+        }
+        return true;
+    }
+
+    // Moves single stays to other rooms while that lowers the cost.
+    void improve(const vector<size_t>& order) {
+        bool changed = true;
+        while (changed && !expired()) {
+            changed = false;
+            for (size_t s : order) {
+                if (expired()) break;
+                const PlanStay& stay = stays[s];
+                size_t current = placement[s];
+                unplace(s);
+                long long removed = -insertDelta(current, stay);
+                size_t best = current;
+                Cost bestDelta;
+                for (size_t room = 0; room < rooms.size(); ++room) {
+                    if (room == current || !fits(room, stay)) continue;
+                    Cost delta;
+                    delta.gapNights = removed + insertDelta(room, stay);
+                    delta.spareBeds = rooms[room].maxGuests - rooms[current].maxGuests;
+                    delta.moves = (room != stay.room ? 1 : 0) - (current != stay.room ? 1 : 0);
+                    if (delta < bestDelta) {
+                        best = room;
+                        bestDelta = delta;
+                    }
+                }
+                place(s, best);
+                if (best != current) changed = true;
+            }
+        }
+    }
+
+public:
+    AssignmentPlanner(vector<PlanRoom> typeRooms, vector<PlanStay> typeStays, int32_t horizonFrom, int32_t horizonTo, int gapNights)
+        : rooms(move(typeRooms)), stays(move(typeStays)), from(horizonFrom), to(horizonTo), shortGap(gapNights) {}
+
+    Plan plan(chrono::steady_clock::time_point until) {
+        deadline = until;
+        timedOut = false;
+        vector<size_t> order;
+        for (size_t s = 0; s < stays.size(); ++s) {
+            if (stays[s].movable) order.push_back(s);
+        }
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return make_tuple(stays[a].checkIn, stays[b].checkOut, stays[b].guests, stays[a].reservationID) <
+                   make_tuple(stays[b].checkIn, stays[a].checkOut, stays[a].guests, stays[b].reservationID);
+        });
+
+        Plan result;
+        reset();
+        for (size_t s = 0; s < stays.size(); ++s) place(s, stays[s].room);
+        result.before = cost();
+        improve(order);
+        Cost best = cost();
+        vector<size_t> bestPlacement = placement;
+        if (placeGreedy(order)) {
+            improve(order);
+            if (cost() < best) {
+                best = cost();
+                bestPlacement = placement;
+            }
+        }
+        result.complete = !timedOut;
+        if (!(best < result.before)) {
+            result.after = result.before;
+            return result;
+        }
+        result.after = best;
+        for (size_t s : order) {
+            if (bestPlacement[s] != stays[s].room) {
+                result.moves.push_back({ stays[s].reservationID, rooms[stays[s].room].roomNumber, rooms[bestPlacement[s]].roomNumber });
+            }
+        }
+        return result;
+    }
+};
+
+// What one Hotel::optimizeAssignments run did, by room type.
+struct AssignmentReport {
+    enum class Status { UNCHANGED, PLANNED, TIMED_OUT, STALE };
+
+    struct TypeFigures {
+        Status status = Status::UNCHANGED;  // UNCHANGED: nothing touched the type since its last run
+        int movable = 0;
+        int moved = 0;
+        AssignmentPlanner::Cost before;
+        AssignmentPlanner::Cost after;
+    };
+
+    array<TypeFigures, Room::TYPE_COUNT> byType{};   // by Room::RoomType
+
+    int moved() const {
+        int total = 0;
+        for (const TypeFigures& figures : byType) total += figures.moved;
+        return total;
+    }
+};
+
+enum class ListingFormat { TEXT, CSV, JSON };
+
+// Builds listing rows in one reserved string and hands them to the stream in large writes, so a
+// long listing costs a few write calls instead of several formatted insertions per row.
+// TEXT reproduces the padded console tables; CSV writes a header row and one line per row;
+// JSON writes one object per line. Banners and padding exist only in TEXT.
+class RowBuffer {
+private:
+    static constexpr size_t FLUSH_AT = 64 * 1024;
+
+    ostream& out;
+    ListingFormat format;
+    string buffer;
+    size_t cellsInRow = 0;
+
+    void pad(size_t used, size_t width) {
+        if (used < width) buffer.append(width - used, ' ');
+    }
+
+    void separator(const char* name) {
+        if (format == ListingFormat::CSV) {
+            if (cellsInRow) buffer += ',';
+        } else if (format == ListingFormat::JSON) {
+            buffer += cellsInRow ? ",\"" : "{\"";
+            buffer += name;
+            buffer += "\":";
+        }
+        ++cellsInRow;
+    }
+
+    void quoted(string_view value) {
+        if (format == ListingFormat::CSV) {
+            if (value.find_first_of(",\"\n\r") == string_view::npos) {
+                buffer.append(value);
+                return;
+            }
+            buffer += '"';
+            for (char c : value) {
+                if (c == '"') buffer += '"';
+                buffer += c;
+            }
+            buffer += '"';
+            return;
+        }
+        buffer += '"';
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+                buffer += escape;
+            } else {
+                buffer += c;
+            }
+        }
+        buffer += '"';
+    }
+
+public:
+    RowBuffer(ostream& target, ListingFormat rowFormat) : out(target), format(rowFormat) {
+        buffer.reserve(FLUSH_AT + 4096);
+    }
+
+    ~RowBuffer() { flush(); }
+
+    RowBuffer(const RowBuffer&) = delete;
+    RowBuffer& operator=(const RowBuffer&) = delete;
+
+    bool isText() const { return format == ListingFormat::TEXT; }
+
+    // Banner and header text, written in TEXT only.
+    void line(string_view text) {
+        if (isText()) buffer.append(text);
+    }
+
+    // Comma-separated column names, written in CSV only.
+    void header(string_view names) {
+        if (format != ListingFormat::CSV) return;
+        buffer.append(names);
+        buffer += '\n';
+    }
+
+    // Left-aligned in TEXT.
+    RowBuffer& cell(const char* name, string_view value, size_t width) {
+        separator(name);
+        if (isText()) {
+            buffer.append(value);
+            pad(value.size(), width);
+        } else {
+            quoted(value);
+        }
+        return *this;
+    }
+
+    RowBuffer& cell(const char* name, long long value, size_t width, bool alignRight = false) {
+        char digits[24];
+        int length = snprintf(digits, sizeof(digits), "%lld", value);
+        separator(name);
+        if (isText() && alignRight) pad(static_cast<size_t>(length), width);
+        buffer.append(digits, static_cast<size_t>(length));
+        if (isText() && !alignRight) pad(static_cast<size_t>(length), width);
+        return *this;
+    }
+
+    RowBuffer& cell(const char* name, Date value, size_t width) {
+        char text[16];
+        value.format(text);
+        return cell(name, string_view(text), width);
+    }
+
+    // Two decimals; in TEXT a "$" and the amount right-aligned in ten columns.
+    RowBuffer& money(const char* name, double value) {
+        char digits[48];
+        int length = snprintf(digits, sizeof(digits), "%.2f", value);
+        separator(name);
+        if (isText()) {
+            buffer += " $";
+            pad(static_cast<size_t>(length), 10);
+        }
+        buffer.append(digits, static_cast<size_t>(length));
+        return *this;
+    }
+
+    // Blank columns between cells, TEXT only.
+    RowBuffer& gap(size_t width) {
+        if (isText()) buffer.append(width, ' ');
+        return *this;
+    }
+
+    void endRow() {
+        if (format == ListingFormat::JSON) buffer += '}';
+        buffer += '\n';
+        cellsInRow = 0;
+        if (buffer.size() >= FLUSH_AT) flush();
+    }
+
+    void flush() {
+        if (buffer.empty()) return;
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        buffer.clear();
+    }
+};
+
+// Numbered lists of the catalogs for the interactive menus; choices count from 1.
+void printRoomTypeMenu() {
+    cout << "\nRoom Types:\n";
+    for (size_t i = 0; i < ROOM_TYPES.size(); ++i) {
+        int guests = ROOM_TYPES[i].defaultMaxGuests;
+        cout << i + 1 << ". " << ROOM_TYPES[i].label << " (Max " << guests << (guests == 1 ? " guest)\n" : " guests)\n");
+    }
+}
+
+void printBillingMenu() {
+    cout << "\nBilling Strategies:\n";
+    for (size_t i = 0; i < BILLING_KINDS.size(); ++i) cout << i + 1 << ". " << BILLING_KINDS[i].menuText << "\n";
+}
+
+optional<BillingStrategy> billingFromMenu(int choice) {
+    if (choice < 1 || static_cast<size_t>(choice) > BILLING_STRATEGIES.size()) return nullopt;
+    return BILLING_STRATEGIES[static_cast<size_t>(choice - 1)];
+}
+
+class Hotel {
+private:
+    static constexpr char SNAPSHOT_MAGIC[8] = { 'H', 'O', 'T', 'E', 'L', 'S', 'N', 'P' };
+    static constexpr uint32_t SNAPSHOT_VERSION = 6;
+    static constexpr size_t ROOM_LOCK_STRIPES = 64;
+    static constexpr size_t LISTING_CHUNK = 256;
+
+    using RoomHandle = SlabPool<Room>::Handle;
+    using ReservationHandle = SlabPool<Reservation>::Handle;
+
+    SlabPool<Room> rooms;                 // listed in the order they were added
+    SlabPool<Reservation> reservations;
+    vector<bool> reservationLive;         // by handle; false for a cancelled slot kept for a listing
+    mutable vector<ReservationHandle> retiredReservations; // cancelled while a listing was running
+    mutable size_t activeListings = 0;    // cancelled slots are kept while a listing walks them
+    unordered_map<int, RoomHandle> roomIndex;               // room number -> handle in rooms
+    unordered_map<int, ReservationHandle> reservationIndex; // reservation ID -> handle in reservations
+    RoomBillingTable billingTable;
+    array<RateCalendar, Room::TYPE_COUNT> rateCalendars;  // by Room::RoomType
+    QuoteCache quotes;                     // its own shard mutexes, innermost like guestDirectory
+    // Secondary indexes behind findRooms and findReservations; the reservation ones are
+    // guarded by reservationMutex like the containers they index.
+    set<tuple<int, double, int>> roomsByTypeRate;      // (type, base rate, room number)
+    set<tuple<int, int, double, int>> roomsByTypeFit;  // (type, max guests, base rate, room number): best fit first
+    set<pair<string_view, int>> reservationsByGuest;   // (Guest::key, reservation ID)
+    set<pair<int32_t, int>> reservationsByCheckIn;     // (check-in day, reservation ID)
+    int longestStay = 0;                               // nights; bounds the check-in scan of a date filter
+    GuestDirectory guestDirectory;       // the guest record every reservation points at
+    Waitlist waitlist;                   // guarded by waitlistMutex, or stateMutex held exclusively
+    StayArchive archive;                 // checked-out stays; guarded by archiveMutex
+    ReservationIDs issuedIDs;            // atomic; bookings on different stripes issue in parallel
+    mutable HotelStats aggregates;       // guarded by reservationMutex, or stateMutex held exclusively
+    ostream* out = &cout;                // where result messages and listings go
+    ListingFormat listingFormat = ListingFormat::TEXT;
+    static inline thread_local ostream* threadOut = nullptr; // per-session override of out
+    HotelJournal* journal = nullptr;     // not owned; null when running without persistence
+    ChangeFeed changes;                  // every journaled mutation, journal or not
+    uint64_t journalStart = 0;           // feed offset of the journal's first record; guarded by stateMutex
+    bool quiet = false;                  // inside a QuietScope
+    unique_ptr<SnapshotImage> image;     // set while reads are served straight from a mapped snapshot
+    atomic<bool> mapped{false};          // image is set; checked before taking any lock
+
+    // The previous optimizeAssignments run, so that the next one plans only what changed.
+    struct OptimizerState {
+        bool ran = false;
+        uint64_t offset = 0;                        // change feed offset the run started from
+        uint64_t epoch = 0;                         // stateEpoch of that run
+        int32_t from = 0;
+        int32_t to = 0;
+        int shortGap = 0;
+        unordered_set<int> locked;
+        array<bool, Room::TYPE_COUNT> settled{};    // planned to the end and applied, by room type
+        unordered_map<int, size_t> reservationTypes; // room type of every stay a run looked at
+    };
+
+    // Locking, always in this order:
+    //   optimizerMutex  held through an optimizeAssignments run
+    //   stateMutex      shared by bookings and queries; exclusive for room changes and whole-state loads
+    //   waitlistMutex   the waitlist; held while its requests are promoted into freed nights
+    //   roomLocks       the stripe of every room whose calendar is read or changed, lower stripe first
+    //   reservationMutex the reservation containers and the fields of each Reservation
+    //   guestDirectory  its own mutex, innermost; the quote cache's shard mutexes and archiveMutex too
+    // Bookings for rooms on different stripes only meet on reservationMutex, which is held for an
+    // index insert. Members named ...Locked expect the caller to hold stateMutex already.
+    mutable shared_mutex stateMutex;
+    mutable array<mutex, ROOM_LOCK_STRIPES> roomLocks;
+    mutable mutex reservationMutex;
+    mutable mutex waitlistMutex;
+    mutable shared_mutex archiveMutex;   // shared by archive summaries, which take no other lock
+    mutex optimizerMutex;                // one optimizeAssignments run at a time; taken before stateMutex
+    OptimizerState lastOptimization;     // guarded by optimizerMutex
+    uint64_t stateEpoch = 0;             // counts clearState calls; guarded by stateMutex
+
+    // Sends result messages nowhere and stops journaling and change events for the lifetime of
+    // the scope; used while rebuilding state that is already persisted, with stateMutex held
+    // exclusively.
+    class QuietScope {
+    private:
+        Hotel& hotel;
+        ostream* previousOut;
+        bool previousQuiet;
+
+    public:
+        explicit QuietScope(Hotel& target) : hotel(target), previousOut(threadOut), previousQuiet(target.quiet) {
+            static thread_local ostream discard(nullptr);
+            threadOut = &discard;
+            hotel.quiet = true;
+        }
+        ~QuietScope() {
+            threadOut = previousOut;
+            hotel.quiet = previousQuiet;
+        }
+    };
+
+    // Keeps reservation slots from being compacted while a listing reads them in chunks.
+    class ListingScope {
+    private:
+        const Hotel& hotel;
+
+    public:
+        explicit ListingScope(const Hotel& target) : hotel(target) {
+            lock_guard<mutex> lock(hotel.reservationMutex);
+            ++hotel.activeListings;
+        }
+        ~ListingScope() {
+            lock_guard<mutex> lock(hotel.reservationMutex);
+            if (--hotel.activeListings == 0) hotel.releaseRetiredReservations();
+        }
+    };
+
+    ostream& output() const { return threadOut ? *threadOut : *out; }
+
+    mutex& roomLock(int roomNumber) const {
+        return roomLocks[static_cast<unsigned>(roomNumber) % ROOM_LOCK_STRIPES];
+    }
+
+    void clearState() {
+        image.reset();
+        mapped.store(false, memory_order_release);
+        rooms.clear();
+        reservations.clear();
+        reservationLive.clear();
+        retiredReservations.clear();
+        roomIndex.clear();
+        reservationIndex.clear();
+        billingTable = RoomBillingTable();
+        for (RateCalendar& rates : rateCalendars) rates.reset();
+        quotes.clear();
+        roomsByTypeRate.clear();
+        roomsByTypeFit.clear();
+        reservationsByGuest.clear();
+        reservationsByCheckIn.clear();
+        longestStay = 0;
+        guestDirectory.clear();
+        waitlist.clear();
+        {
+            unique_lock<shared_mutex> lock(archiveMutex);
+            archive.clear();
+        }
+        aggregates = HotelStats();
+        ++stateEpoch;
+    }
+
+    // Copies the mapped snapshot into the regular containers. Every mutation, and every query
+    // that has no read path over the mapping, goes through this first; it is a no-op once done.
+    void materializeLocked() {
+        if (!image) return;
+        unique_ptr<SnapshotImage> source = move(image);
+        mapped.store(false, memory_order_release);
+        QuietScope quiet(*this);
+        rooms.reserve(source->roomCount());
+        for (size_t i = 0; i < source->roomCount(); ++i) {
+            const SnapshotRoomRecord& record = source->room(i);
+            addRoomLocked(record.roomNumber, static_cast<Room::RoomType>(record.type), record.baseRate,
+                          billingStrategyFromIndex(record.billing), record.maxGuests);
+        }
+        reservations.reserve(source->reservationCount());
+        reservationIndex.reserve(source->reservationCount());
+        for (size_t i = 0; i < source->reservationCount(); ++i) {
+            const SnapshotReservationRecord& record = source->reservation(i);
+            const Guest& guest = guestDirectory.intern(source->text(record.nameOffset, record.nameLength),
+                                                       source->text(record.contactOffset, record.contactLength));
+            insertReservation(Reservation(record.reservationID, guest, record.roomNumber, Date(record.checkIn), Date(record.checkOut), record.numberOfGuests));
+        }
+    }
+
+    unique_lock<shared_mutex> lockExclusive() {
+        unique_lock<shared_mutex> lock(stateMutex);
+        materializeLocked();
+        return lock;
+    }
+
+    // Shared lock on materialized state. Materializing does not change what a query would see,
+    // so const queries may trigger it.
+    shared_lock<shared_mutex> lockMaterialized() const {
+        while (true) {
+            if (mapped.load(memory_order_acquire)) {
+                unique_lock<shared_mutex> exclusive(stateMutex);
+                const_cast<Hotel*>(this)->materializeLocked();
+            }
+            shared_lock<shared_mutex> lock(stateMutex);
+            if (!image) return lock;
+        }
+    }
+
+    void appendRoomRow(RowBuffer& rows, int number, const char* type, double rate, const char* status, const char* billing, int maxGuests) const {
+        rows.cell("room", number, 8)
+            .cell("type", type, 12)
+            .money("rate", rate)
+            .gap(15);
+        if (status) rows.cell("status", status, 12);
+        rows.cell("billing", billing, 15)
+            .cell("max_guests", maxGuests, 12, true)
+            .endRow();
+    }
+
+    void appendReservationRow(RowBuffer& rows, int id, string_view guestName, int roomNumber, Date checkIn, Date checkOut) const {
+        rows.cell("id", id, 8)
+            .cell("guest", guestName, 22)
+            .cell("room", roomNumber, 10)
+            .cell("check_in", checkIn, 15)
+            .cell("check_out", checkOut, 15)
+            .endRow();
+    }
+
+    // Text header of the room tables, with or without the status column.
+    static void appendRoomHeader(RowBuffer& rows, bool withStatus) {
+        rows.line(withStatus ? "Room #  Type           Base Rate               Status      Billing Type     Max Guests\n"
+                             : "Room #  Type           Base Rate               Billing Type     Max Guests\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header(withStatus ? "room,type,rate,status,billing,max_guests" : "room,type,rate,billing,max_guests");
+    }
+
+    void writeReservationDetails(int id, string_view guestName, string_view contactInfo, int roomNumber,
+                                 Date checkIn, Date checkOut, int guests, double totalBill) const {
+        ostream& os = output();
+        os << "\n=========== RESERVATION DETAILS ===========\n";
+        os << "Reservation #" << id << "\n";
+        os << "Guest: " << guestName << "\n";
+        os << "Contact: " << contactInfo << "\n";
+        os << "Room: " << roomNumber << "\n";
+        os << "Check-in: " << checkIn << "\n";
+        os << "Check-out: " << checkOut << "\n";
+        os << "Guests: " << guests << "\n";
+        os << "Total Bill: $" << fixed << setprecision(2) << totalBill << "\n";
+        os << "===============================\n";
+    }
+
+    // Journals the mutation and publishes its change event, decoded from the same record. With a
+    // journal the event is published under the journal's buffer lock, so feed offsets follow
+    // record order; without one the record is encoded into a scratch buffer just for the event.
+    template <typename Encode>
+    void logMutation(HotelJournal::Op op, Encode encode) {
+        if (quiet) return;
+        if (journal) {
+            journal->append(op, encode, [&](BinaryReader& payload) { changes.publish(ChangeEvent::fromRecord(op, payload)); });
+            return;
+        }
+        publishMutation(op, encode);
+    }
+
+    // Publishes the mutation's change event without journaling it.
+    template <typename Encode>
+    void publishMutation(HotelJournal::Op op, Encode encode) {
+        if (quiet) return;
+        static thread_local string scratch;
+        scratch.clear();
+        BinaryWriter writer(scratch);
+        encode(writer);
+        BinaryReader payload(scratch.data(), scratch.size());
+        changes.publish(ChangeEvent::fromRecord(op, payload));
+    }
+
+    static void encodeRoom(BinaryWriter& writer, int number, Room::RoomType type, double rate, BillingStrategy strategy, int guests) {
+        writer.put<int32_t>(number);
+        writer.put<uint8_t>(static_cast<uint8_t>(type));
+        writer.put<double>(rate);
+        writer.put<uint8_t>(static_cast<uint8_t>(strategy.index()));
+        writer.put<int32_t>(guests);
+    }
+
+    static void encodeReservation(BinaryWriter& writer, const Reservation& reservation) {
+        writer.put<int32_t>(reservation.getReservationID());
+        writer.put<int32_t>(reservation.getRoomNumber());
+        writer.put<int32_t>(reservation.getCheckInDate().dayNumber());
+        writer.put<int32_t>(reservation.getCheckOutDate().dayNumber());
+        writer.put<int32_t>(reservation.getNumberOfGuests());
+        writer.putString(reservation.getGuestName());
+        writer.putString(reservation.getContactInfo());
+    }
+
+    void logReservation(const Reservation& reservation) {
+        logMutation(HotelJournal::Op::RESERVE, [&](BinaryWriter& writer) { encodeReservation(writer, reservation); });
+    }
+
+    // The row a reservation leaves in the archive when its guest leaves on checkOut, billed as
+    // its room is priced now; nothing if the room was deleted and there is no bill to record.
+    optional<ArchivedStay> archivedStayLocked(const Reservation& reservation, Date checkOut) const {
+        const Room* room = findRoom(reservation.getRoomNumber());
+        if (!room) return nullopt;
+        ArchivedStay stay;
+        stay.reservationID = reservation.getReservationID();
+        stay.roomNumber = room->getRoomNumber();
+        stay.checkIn = reservation.getCheckInDate().dayNumber();
+        stay.checkOut = checkOut.dayNumber();
+        stay.guests = reservation.getNumberOfGuests();
+        stay.type = static_cast<uint8_t>(room->getType());
+        stay.billing = static_cast<uint8_t>(room->getBillingStrategy().index());
+        stay.billedCents = llround(quoteLocked(*room, reservation.getCheckInDate(), checkOut) * 100.0);
+        return stay;
+    }
+
+    // Takes checked-out reservations out of the live structures and appends their rows to the
+    // archive, journaled as one record. The caller holds reservationMutex and the stripes of
+    // their rooms, or reservationMutex with stateMutex held exclusively.
+    void archiveStaysLocked(const vector<ArchivedStay>& stays) {
+        for (const ArchivedStay& stay : stays) {
+            if (Reservation* reservation = findReservation(stay.reservationID)) removeReservationLocked(*reservation);
+        }
+        {
+            unique_lock<shared_mutex> lock(archiveMutex);
+            for (const ArchivedStay& stay : stays) archive.append(stay);
+        }
+        logMutation(HotelJournal::Op::ARCHIVE, [&](BinaryWriter& writer) {
+            writer.put<uint32_t>(static_cast<uint32_t>(stays.size()));
+            for (const ArchivedStay& stay : stays) {
+                writer.put<int32_t>(stay.reservationID);
+                writer.put<int32_t>(stay.roomNumber);
+                writer.put<int32_t>(stay.checkIn);
+                writer.put<int32_t>(stay.checkOut);
+                writer.put<int32_t>(stay.guests);
+                writer.put<uint8_t>(stay.type);
+                writer.put<uint8_t>(stay.billing);
+                writer.put<int64_t>(stay.billedCents);
+            }
+        });
+    }
+
+    // Nights a cancellation or a change gave back: the stay [checkIn, checkOut) in roomNumber.
+    struct FreedStay {
+        int roomNumber = 0;
+        Date checkIn;
+        Date checkOut;
+    };
+
+    // Books the best waiting requests into the free nights around a freed stay, for as long as
+    // one fits the room; requests whose stay has begun are left alone. Runs with stateMutex held
+    // and takes waitlistMutex, then the room's stripe. Returns the new reservation IDs.
+    vector<int> promoteWaiting(const FreedStay& freed) {
+        vector<int> promoted;
+        lock_guard<mutex> waiting(waitlistMutex);
+        Room* room = findRoom(freed.roomNumber);
+        if (waitlist.empty() || !room) return promoted;
+        lock_guard<mutex> roomGuard(roomLock(freed.roomNumber));
+        const int today = Date::today().dayNumber();
+        while (true) {
+            const WaitRequest* best = nullptr;
+            room->forEachFreeRun(freed.checkIn.dayNumber(), freed.checkOut.dayNumber(), [&](int start, int end) {
+                const WaitRequest* candidate = waitlist.best(room->getType(), max(start, today), end, room->getMaxGuests());
+                if (candidate && (!best || Waitlist::before(*candidate, *best))) best = candidate;
+            });
+            if (!best) break;
+            WaitRequest request = *waitlist.remove(best->waitID);
+            Reservation reservation(issuedIDs.issue(), guestDirectory.intern(request.guestName, request.contactInfo),
+                                    room->getRoomNumber(), request.checkIn, request.checkOut, request.guests);
+            logMutation(HotelJournal::Op::PROMOTE, [&](BinaryWriter& writer) {
+                writer.put<int32_t>(request.waitID);
+                encodeReservation(writer, reservation);
+            });
+            int reservationID = reservation.getReservationID();
+            insertReservation(move(reservation));
+            promoted.push_back(reservationID);
+            output() << "\n===========================================\n";
+            output() << "Waitlist #" << request.waitID << " (" << request.guestName << ") booked into room " << room->getRoomNumber()
+                     << " as reservation #" << reservationID << "!\n";
+            output() << "=============================================\n";
+        }
+        return promoted;
+    }
+
+    // Copies the rooms of a type and their stays from the start of the horizon on into a
+    // planner, and lists the room numbers for locking them again when the plan is applied.
+    AssignmentPlanner collectAssignments(Room::RoomType type, int32_t from, int32_t to, const AssignmentOptions& options,
+                                         vector<int>& roomNumbers, int& movable) {
+        int t = static_cast<int>(type);
+        auto first = roomsByTypeRate.lower_bound(make_tuple(t, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        auto last = roomsByTypeRate.lower_bound(make_tuple(t + 1, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        for (auto it = first; it != last; ++it) roomNumbers.push_back(get<2>(*it));
+        vector<AssignmentPlanner::PlanRoom> planRooms;
+        vector<AssignmentPlanner::PlanStay> planStays;
+        auto stripes = lockRoomStripes(roomNumbers);
+        lock_guard<mutex> lock(reservationMutex);
+        for (int number : roomNumbers) {
+            const Room* room = findRoom(number);
+            size_t index = planRooms.size();
+            planRooms.push_back({ number, room->getMaxGuests(), room->getBaseRate() * billingMultiplier(room->getBillingStrategy()) });
+            room->forEachBooking(from, numeric_limits<int>::max(), [&](int checkIn, int checkOut, int reservationID) {
+                const Reservation* reservation = findReservation(reservationID);
+                if (!reservation) return;
+                bool canMove = checkIn >= from && checkIn < to && !options.locked.count(reservationID);
+                planStays.push_back({ reservationID, checkIn, checkOut, reservation->getNumberOfGuests(), index, canMove });
+                lastOptimization.reservationTypes[reservationID] = static_cast<size_t>(t);
+                if (canMove) ++movable;
+            });
+        }
+        HOTEL_SCANNED(planStays.size());
+        return AssignmentPlanner(move(planRooms), move(planStays), from, to, options.shortGap);
+    }
+
+    // Moves every listed reservation from its old room to its new one as one step: all the stays
+    // leave their rooms before any is booked again, so stays may trade rooms. The caller holds
+    // the stripes of every room involved, or stateMutex exclusively. Changes nothing and returns
+    // false if a reservation is no longer in its old room or a new room cannot take it.
+    bool reassignLocked(const vector<AssignmentMove>& moves, vector<FreedStay>* freed = nullptr) {
+        lock_guard<mutex> lock(reservationMutex);
+        vector<Reservation*> moving;
+        for (const AssignmentMove& move : moves) {
+            Reservation* reservation = findReservation(move.reservationID);
+            Room* target = findRoom(move.toRoom);
+            if (!reservation || reservation->getRoomNumber() != move.fromRoom || !target ||
+                reservation->getNumberOfGuests() > target->getMaxGuests()) {
+                return false;
+            }
+            moving.push_back(reservation);
+        }
+        vector<bool> released(moves.size());
+        for (size_t i = 0; i < moves.size(); ++i) {
+            Room* source = findRoom(moves[i].fromRoom);
+            released[i] = source && source->release(moving[i]->getCheckInDate(), moves[i].reservationID);
+        }
+        size_t booked = 0;
+        while (booked < moves.size() &&
+               findRoom(moves[booked].toRoom)->book(moving[booked]->getCheckInDate(), moving[booked]->getCheckOutDate(), moves[booked].reservationID)) {
+            ++booked;
+        }
+        if (booked < moves.size()) {
+            for (size_t i = 0; i < booked; ++i) findRoom(moves[i].toRoom)->release(moving[i]->getCheckInDate(), moves[i].reservationID);
+            for (size_t i = 0; i < moves.size(); ++i) {
+                if (released[i]) findRoom(moves[i].fromRoom)->book(moving[i]->getCheckInDate(), moving[i]->getCheckOutDate(), moves[i].reservationID);
+            }
+            return false;
+        }
+        for (size_t i = 0; i < moves.size(); ++i) {
+            Date checkIn = moving[i]->getCheckInDate(), checkOut = moving[i]->getCheckOutDate();
+            if (released[i]) countStay(findRoom(moves[i].fromRoom), checkIn, checkOut, -1);
+            countStay(findRoom(moves[i].toRoom), checkIn, checkOut, 1);
+            moving[i]->updateRoomNumber(moves[i].toRoom);
+            if (freed) freed->push_back({ moves[i].fromRoom, checkIn, checkOut });
+        }
+        logMutation(HotelJournal::Op::REASSIGN, [&](BinaryWriter& writer) {
+            writer.put<uint32_t>(static_cast<uint32_t>(moves.size()));
+            for (const AssignmentMove& move : moves) {
+                writer.put<int32_t>(move.reservationID);
+                writer.put<int32_t>(move.fromRoom);
+                writer.put<int32_t>(move.toRoom);
+            }
+        });
+        return true;
+    }
+
+    void showAssignmentReport(const AssignmentReport& report) const {
+        static const char* const statusNames[] = { "Unchanged", "Planned", "Timed out", "Stale" };
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n============================== ROOM ASSIGNMENT ===============================================\n");
+        rows.line("Type      Status      Stays   Moved   Gap nights      Spare beds\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("type,status,stays,moved,gap_nights_before,gap_nights_after,spare_beds_before,spare_beds_after");
+        for (size_t type = 0; type < report.byType.size(); ++type) {
+            const AssignmentReport::TypeFigures& figures = report.byType[type];
+            rows.cell("type", Room::typeLabel(static_cast<Room::RoomType>(type)), 10)
+                .cell("status", statusNames[static_cast<size_t>(figures.status)], 12);
+            if (figures.status == AssignmentReport::Status::UNCHANGED) {
+                if (!rows.isText()) {
+                    for (const char* name : { "stays", "moved", "gap_nights_before", "gap_nights_after", "spare_beds_before", "spare_beds_after" }) {
+                        rows.cell(name, "", 0);
+                    }
+                }
+                rows.endRow();
+                continue;
+            }
+            char gaps[32], spare[32];
+            snprintf(gaps, sizeof(gaps), "%lld -> %lld", figures.before.gapNights, figures.after.gapNights);
+            snprintf(spare, sizeof(spare), "%lld -> %lld", figures.before.spareBeds, figures.after.spareBeds);
+            rows.cell("stays", figures.movable, 8).cell("moved", figures.moved, 8);
+            if (rows.isText()) {
+                rows.cell("gap_nights", gaps, 16).cell("spare_beds", spare, 0);
+            } else {
+                rows.cell("gap_nights_before", figures.before.gapNights, 0).cell("gap_nights_after", figures.after.gapNights, 0)
+                    .cell("spare_beds_before", figures.before.spareBeds, 0).cell("spare_beds_after", figures.after.spareBeds, 0);
+            }
+            rows.endRow();
+        }
+        rows.line("================================================================================================\n");
+    }
+
+    void writeArchiveReport(const ArchiveSummary& summary) const {
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n============================= STAY ARCHIVE " + summary.from.toString() + " - " + summary.to.toString() +
+                  " =============================\n");
+        rows.line("Month     Type      Stays   Avg nights  Room nights  Avg occupied      Revenue\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("month,type,stays,average_nights,room_nights,average_occupied,revenue");
+        auto row = [&](const string& month, size_t type, const ArchiveMonth::TypeFigures& figures, int nights) {
+            char averageNights[32], averageOccupied[32];
+            snprintf(averageNights, sizeof(averageNights), "%.2f", figures.stays ? static_cast<double>(figures.stayNights) / figures.stays : 0.0);
+            snprintf(averageOccupied, sizeof(averageOccupied), "%.2f", static_cast<double>(figures.roomNights) / nights);
+            rows.cell("month", month, 10)
+                .cell("type", Room::typeLabel(static_cast<Room::RoomType>(type)), 10)
+                .cell("stays", figures.stays, 8)
+                .cell("average_nights", averageNights, 12)
+                .cell("room_nights", figures.roomNights, 13)
+                .cell("average_occupied", averageOccupied, 13)
+                .money("revenue", static_cast<double>(figures.revenueCents) / 100.0)
+                .endRow();
+        };
+        array<ArchiveMonth::TypeFigures, Room::TYPE_COUNT> totals{};
+        int nights = 0;
+        for (const ArchiveMonth& month : summary.months) {
+            char label[16];
+            snprintf(label, sizeof(label), "%02d/%04d", month.month, month.year);
+            nights += month.nights;
+            for (size_t type = 0; type < Room::TYPE_COUNT; ++type) {
+                const ArchiveMonth::TypeFigures& figures = month.byType[type];
+                totals[type].stays += figures.stays;
+                totals[type].stayNights += figures.stayNights;
+                totals[type].revenueCents += figures.revenueCents;
+                totals[type].roomNights += figures.roomNights;
+                if (figures.stays || figures.roomNights) row(label, type, figures, month.nights);
+            }
+        }
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        for (size_t type = 0; type < Room::TYPE_COUNT; ++type) {
+            if (totals[type].stays || totals[type].roomNights) row("Total", type, totals[type], nights);
+        }
+        char footer[160];
+        snprintf(footer, sizeof(footer), "%zu archived stays in %zu blocks (%zu bytes compressed); read %zu blocks and %zu rows\n",
+                 summary.stays, summary.blocks, summary.storedBytes, summary.blocksRead, summary.rowsRead);
+        rows.line(footer);
+        rows.line("================================================================================================\n");
+    }
+
+    void indexRoom(const Room& room) {
+        int type = static_cast<int>(room.getType());
+        roomsByTypeRate.emplace(type, room.getBaseRate(), room.getRoomNumber());
+        roomsByTypeFit.emplace(type, room.getMaxGuests(), room.getBaseRate(), room.getRoomNumber());
+    }
+
+    void unindexRoom(const Room& room) {
+        int type = static_cast<int>(room.getType());
+        roomsByTypeRate.erase(make_tuple(type, room.getBaseRate(), room.getRoomNumber()));
+        roomsByTypeFit.erase(make_tuple(type, room.getMaxGuests(), room.getBaseRate(), room.getRoomNumber()));
+    }
+
+    // Books a room already checked free for the stay, with its stripe held; returns the new ID.
+    int bookRoomLocked(const Room& room, const string& guestName, const string& contactInfo, Date checkIn, Date checkOut, int guests) {
+        Reservation reservation(issuedIDs.issue(), guestDirectory.intern(guestName, contactInfo), room.getRoomNumber(), checkIn, checkOut, guests);
+        int reservationID = reservation.getReservationID();
+        logReservation(reservation);
+        insertReservation(move(reservation));
+        return reservationID;
+    }
+
+    const RateCalendar& ratesFor(Room::RoomType type) const { return rateCalendars[static_cast<size_t>(type)]; }
+
+    // The bill for a stay in a room, through the quote cache; stateMutex is held at least shared.
+    double quoteLocked(const Room& room, Date checkIn, Date checkOut) const {
+        return quotes.get(room.getRoomNumber(), checkIn, checkOut, [&] { return room.calculateBill(ratesFor(room.getType()), checkIn, checkOut); });
+    }
+
+    // Adds (sign 1) or takes back (sign -1) one stay of a room in the aggregates, after the
+    // room's calendar was changed. Stays of reservations whose room was deleted are not counted.
+    void countStay(Room* room, Date checkIn, Date checkOut, int sign) {
+        if (!room) return;
+        HotelStats::BillingFigures& billing = aggregates.byBilling[room->getBillingStrategy().index()];
+        int nights = checkOut - checkIn;
+        billing.bookedNights += sign * nights;
+        double rated = ratesFor(room->getType()).ratedNights(checkIn, checkOut);
+        billing.projectedRevenue += sign * Room::billFor(room->getBillingStrategy(), room->getBaseRate(), rated);
+        room->addRatedNights(sign * rated);
+        if (billing.bookedNights == 0) billing.projectedRevenue = 0.0; // no rounding residue
+        if (checkIn <= aggregates.day && aggregates.day < checkOut) aggregates.byType[static_cast<size_t>(room->getType())].occupied += sign;
+    }
+
+    // Adds or takes back a room together with all of its booked stays, around a change to the
+    // room's rate or strategy, or when it is added or deleted.
+    void countRoom(const Room& room, int sign) {
+        HotelStats::TypeFigures& type = aggregates.byType[static_cast<size_t>(room.getType())];
+        HotelStats::BillingFigures& billing = aggregates.byBilling[room.getBillingStrategy().index()];
+        type.rooms += sign;
+        billing.rooms += sign;
+        long long nights = room.getBookedNights();
+        if (nights == 0) return;
+        billing.bookedNights += sign * nights;
+        billing.projectedRevenue += sign * room.getBaseRate() * room.getRatedNights() * billingMultiplier(room.getBillingStrategy());
+        if (billing.bookedNights == 0) billing.projectedRevenue = 0.0;
+        if (!room.isAvailableFor(aggregates.day, aggregates.day + 1)) type.occupied += sign;
+    }
+
+    // Locks the stripes of all the given rooms, lowest stripe first, each once.
+    vector<unique_lock<mutex>> lockRoomStripes(const vector<int>& roomNumbers) const {
+        array<bool, ROOM_LOCK_STRIPES> wanted{};
+        for (int number : roomNumbers) wanted[static_cast<unsigned>(number) % ROOM_LOCK_STRIPES] = true;
+        vector<unique_lock<mutex>> guards;
+        for (size_t stripe = 0; stripe < ROOM_LOCK_STRIPES; ++stripe) {
+            if (wanted[stripe]) guards.emplace_back(roomLocks[stripe]);
+        }
+        return guards;
+    }
+
+    // Books a block of rooms already checked free for the stay, with all their stripes held.
+    // The IDs are one consecutive range and the block is journaled as a single record, so
+    // replay after a crash restores all of it or none of it. Returns the new IDs.
+    vector<int> bookBlockLocked(const vector<Room*>& block, const string& guestName, const string& contactInfo,
+                                Date checkIn, Date checkOut, int guests) {
+        int count = static_cast<int>(block.size());
+        int firstID = issuedIDs.issue(count);
+        logMutation(HotelJournal::Op::RESERVE_BLOCK, [&](BinaryWriter& writer) {
+            writer.put<int32_t>(firstID);
+            writer.put<int32_t>(checkIn.dayNumber());
+            writer.put<int32_t>(checkOut.dayNumber());
+            writer.put<int32_t>(guests);
+            writer.putString(guestName);
+            writer.putString(contactInfo);
+            writer.put<uint32_t>(static_cast<uint32_t>(count));
+            for (const Room* room : block) writer.put<int32_t>(room->getRoomNumber());
+        });
+        const Guest& guest = guestDirectory.intern(guestName, contactInfo);
+        vector<int> reservationIDs;
+        reservationIDs.reserve(block.size());
+        for (int i = 0; i < count; ++i) {
+            insertReservation(Reservation(firstID + i, guest, block[i]->getRoomNumber(), checkIn, checkOut, guests));
+            reservationIDs.push_back(firstID + i);
+        }
+        return reservationIDs;
+    }
+
+    void reportBlock(const vector<int>& reservationIDs) {
+        output() << "\n===========================================\n";
+        output() << "Block of " << reservationIDs.size() << " rooms reserved successfully!\n";
+        output() << "Reservations #" << reservationIDs.front() << " to #" << reservationIDs.back() << "\n";
+        output() << "=============================================\n";
+    }
+
+    void rejectBlock(const string& reason) {
+        output() << "============================================\n";
+        output() << reason << "\n";
+        output() << "No rooms were reserved.\n";
+        output() << "===========================================\n";
+    }
+
+    // Stores a reservation whose room and dates were already validated and books its room.
+    // The caller holds the room's stripe, or stateMutex exclusively.
+    void insertReservation(Reservation&& reservation) {
+        Room* room = findRoom(reservation.getRoomNumber());
+        if (room) room->book(reservation.getCheckInDate(), reservation.getCheckOutDate(), reservation.getReservationID());
+        lock_guard<mutex> lock(reservationMutex);
+        countStay(room, reservation.getCheckInDate(), reservation.getCheckOutDate(), 1);
+        ++aggregates.reservations;
+        reservationsByGuest.emplace(reservation.getGuest().key, reservation.getReservationID());
+        guestDirectory.attach(reservation.getGuest(), reservation.getReservationID());
+        reservationsByCheckIn.emplace(reservation.getCheckInDate().dayNumber(), reservation.getReservationID());
+        longestStay = max(longestStay, reservation.getNights());
+        int reservationID = reservation.getReservationID();
+        issuedIDs.observe(reservationID);
+        ReservationHandle handle = reservations.emplace(move(reservation));
+        reservationIndex[reservationID] = handle;
+        if (reservationLive.size() <= handle) reservationLive.resize(handle + 1);
+        reservationLive[handle] = true;
+    }
+
+    void applyJournalRecord(HotelJournal::Op op, BinaryReader& reader) {
+        materializeLocked();
+        switch (op) {
+            case HotelJournal::Op::ADD_ROOM: {
+                int number = reader.get<int32_t>();
+                auto type = static_cast<Room::RoomType>(reader.get<uint8_t>());
+                double rate = reader.get<double>();
+                BillingStrategy strategy = billingStrategyFromIndex(reader.get<uint8_t>());
+                int guests = reader.get<int32_t>();
+                addRoomLocked(number, type, rate, strategy, guests);
+                break;
+            }
+            case HotelJournal::Op::DELETE_ROOM:
+                deleteRoomLocked(reader.get<int32_t>());
+                break;
+            case HotelJournal::Op::UPDATE_RATE: {
+                int number = reader.get<int32_t>();
+                updateRoomRateLocked(number, reader.get<double>());
+                break;
+            }
+            case HotelJournal::Op::UPDATE_BILLING: {
+                int number = reader.get<int32_t>();
+                updateRoomBillingStrategyLocked(number, billingStrategyFromIndex(reader.get<uint8_t>()));
+                break;
+            }
+            case HotelJournal::Op::PROMOTE:
+                waitlist.remove(reader.get<int32_t>());
+                [[fallthrough]];
+            case HotelJournal::Op::RESERVE: {
+                int id = reader.get<int32_t>();
+                int roomNumber = reader.get<int32_t>();
+                Date checkIn(reader.get<int32_t>());
+                Date checkOut(reader.get<int32_t>());
+                int guests = reader.get<int32_t>();
+                string name = reader.getString();
+                string contact = reader.getString();
+                insertReservation(Reservation(id, guestDirectory.intern(name, contact), roomNumber, checkIn, checkOut, guests));
+                break;
+            }
+            case HotelJournal::Op::RESERVE_BLOCK: {
+                int firstID = reader.get<int32_t>();
+                Date checkIn(reader.get<int32_t>());
+                Date checkOut(reader.get<int32_t>());
+                int guests = reader.get<int32_t>();
+                string name = reader.getString();
+                string contact = reader.getString();
+                const Guest& guest = guestDirectory.intern(name, contact);
+                uint32_t count = reader.get<uint32_t>();
+                for (uint32_t i = 0; i < count; ++i) {
+                    insertReservation(Reservation(firstID + static_cast<int>(i), guest, reader.get<int32_t>(), checkIn, checkOut, guests));
+                }
+                break;
+            }
+            case HotelJournal::Op::CANCEL:
+                cancelReservationLocked(reader.get<int32_t>());
+                break;
+            case HotelJournal::Op::RATE_RULE: {
+                auto type = static_cast<Room::RoomType>(reader.get<uint8_t>());
+                RateRule rule;
+                rule.kind = static_cast<RateRule::Kind>(reader.get<uint8_t>());
+                rule.from = reader.get<int32_t>();
+                rule.to = reader.get<int32_t>();
+                rule.value = reader.get<double>();
+                applyRateRuleLocked(type, rule);
+                break;
+            }
+            case HotelJournal::Op::UPDATE_GUESTS: {
+                int id = reader.get<int32_t>();
+                changeReservationGuestsLocked(id, reader.get<int32_t>());
+                break;
+            }
+            case HotelJournal::Op::UPDATE_ROOM: {
+                int id = reader.get<int32_t>();
+                changeReservationRoomLocked(id, reader.get<int32_t>());
+                break;
+            }
+            case HotelJournal::Op::UPDATE_DATES: {
+                int id = reader.get<int32_t>();
+                Date checkIn(reader.get<int32_t>());
+                Date checkOut(reader.get<int32_t>());
+                changeReservationDatesLocked(id, checkIn, checkOut);
+                break;
+            }
+            case HotelJournal::Op::WAITLIST: {
+                WaitRequest request;
+                request.waitID = reader.get<int32_t>();
+                request.type = static_cast<Room::RoomType>(reader.get<uint8_t>());
+                request.checkIn = Date(reader.get<int32_t>());
+                request.checkOut = Date(reader.get<int32_t>());
+                request.guests = reader.get<int32_t>();
+                request.loyaltyTier = reader.get<uint8_t>();
+                request.corporate = reader.get<uint8_t>() != 0;
+                request.guestName = reader.getString();
+                request.contactInfo = reader.getString();
+                waitlist.add(move(request));
+                break;
+            }
+            case HotelJournal::Op::UNWAIT:
+                waitlist.remove(reader.get<int32_t>());
+                break;
+            case HotelJournal::Op::REASSIGN: {
+                uint32_t count = reader.get<uint32_t>();
+                vector<AssignmentMove> moves;
+                for (uint32_t i = 0; i < count; ++i) {
+                    AssignmentMove move;
+                    move.reservationID = reader.get<int32_t>();
+                    move.fromRoom = reader.get<int32_t>();
+                    move.toRoom = reader.get<int32_t>();
+                    moves.push_back(move);
+                }
+                reassignLocked(moves);
+                break;
+            }
+            case HotelJournal::Op::ARCHIVE: {
+                uint32_t count = reader.get<uint32_t>();
+                vector<ArchivedStay> stays(count);
+                for (ArchivedStay& stay : stays) {
+                    stay.reservationID = reader.get<int32_t>();
+                    stay.roomNumber = reader.get<int32_t>();
+                    stay.checkIn = reader.get<int32_t>();
+                    stay.checkOut = reader.get<int32_t>();
+                    stay.guests = reader.get<int32_t>();
+                    stay.type = reader.get<uint8_t>();
+                    stay.billing = reader.get<uint8_t>();
+                    stay.billedCents = reader.get<int64_t>();
+                }
+                lock_guard<mutex> lock(reservationMutex);
+                archiveStaysLocked(stays);
+                break;
+            }
+            default:
+                throw runtime_error("Unknown journal record.");
+        }
+    }
+
+    Room* findRoom(int roomNumber) {
+        auto it = roomIndex.find(roomNumber);
+        return it == roomIndex.end() ? nullptr : &rooms[it->second];
+    }
+
+    const Room* findRoom(int roomNumber) const {
+        auto it = roomIndex.find(roomNumber);
+        return it == roomIndex.end() ? nullptr : &rooms[it->second];
+    }
+
+    // The reservation lookups expect reservationMutex to be held.
+    Reservation* findReservation(int reservationID) {
+        auto it = reservationIndex.find(reservationID);
+        return it == reservationIndex.end() ? nullptr : &reservations[it->second];
+    }
+
+    const Reservation* findReservation(int reservationID) const {
+        auto it = reservationIndex.find(reservationID);
+        return it == reservationIndex.end() ? nullptr : &reservations[it->second];
+    }
+
+    bool reservationRoom(int reservationID, int& roomNumber) const {
+        lock_guard<mutex> lock(reservationMutex);
+        const Reservation* reservation = findReservation(reservationID);
+        if (!reservation) return false;
+        roomNumber = reservation->getRoomNumber();
+        return true;
+    }
+
+    // Runs action(reservation) with the stripe of the reservation's room and reservationMutex held,
+    // retrying if the reservation moves to another room in between. Returns action's result, or
+    // false after reporting that there is no such reservation.
+    template <typename Action>
+    bool withReservation(int reservationID, Action action) {
+        int roomNumber;
+        while (reservationRoom(reservationID, roomNumber)) {
+            lock_guard<mutex> roomGuard(roomLock(roomNumber));
+            lock_guard<mutex> lock(reservationMutex);
+            Reservation* reservation = findReservation(reservationID);
+            if (!reservation) break;
+            if (reservation->getRoomNumber() != roomNumber) continue;
+            return action(*reservation);
+        }
+        output() << "Reservation not found.\n";
+        return false;
+    }
+
+    // Takes a reservation out of its room's calendar, the aggregates and every index, then frees
+    // its slot, so the reference is dangling afterwards. Runs with reservationMutex held and the
+    // room's stripe, or stateMutex held exclusively.
+    void removeReservationLocked(Reservation& reservation) {
+        const int reservationID = reservation.getReservationID();
+        Room* room = findRoom(reservation.getRoomNumber());
+        if (room && room->release(reservation.getCheckInDate(), reservationID)) {
+            countStay(room, reservation.getCheckInDate(), reservation.getCheckOutDate(), -1);
+        }
+        --aggregates.reservations;
+        ReservationHandle handle = reservationIndex[reservationID];
+        reservationIndex.erase(reservationID);
+        reservationsByGuest.erase(make_pair(reservation.getGuest().key, reservationID));
+        guestDirectory.detach(reservation.getGuest(), reservationID);
+        reservationsByCheckIn.erase(make_pair(reservation.getCheckInDate().dayNumber(), reservationID));
+        retireReservation(handle);
+    }
+
+    // Frees a cancelled reservation's slot, or keeps it for the listing that may be walking it
+    // and frees it when the last listing ends. Runs with reservationMutex held.
+    void retireReservation(ReservationHandle handle) {
+        reservationLive[handle] = false;
+        if (activeListings > 0) retiredReservations.push_back(handle);
+        else reservations.erase(handle);
+    }
+
+    void releaseRetiredReservations() const {
+        HOTEL_SCANNED(retiredReservations.size());
+        for (ReservationHandle handle : retiredReservations) const_cast<Hotel*>(this)->reservations.erase(handle);
+        retiredReservations.clear();
+    }
+
+    bool writeSnapshotLocked(const string& path) const {
+        lock_guard<mutex> waitlistGuard(waitlistMutex);
+        lock_guard<mutex> lock(reservationMutex);
+        vector<const Reservation*> liveSlots;
+        liveSlots.reserve(reservationIndex.size());
+        for (const auto& [reservationID, handle] : reservationIndex) liveSlots.push_back(&reservations[handle]);
+        sort(liveSlots.begin(), liveSlots.end(), [](const Reservation* a, const Reservation* b) {
+            return a->getReservationID() < b->getReservationID();
+        });
+        vector<const Room*> roomList;
+        roomList.reserve(rooms.size());
+        for (const Room& room : rooms) roomList.push_back(&room);
+        vector<uint32_t> roomOrder(roomList.size());
+        for (size_t i = 0; i < roomList.size(); ++i) roomOrder[i] = static_cast<uint32_t>(i);
+        sort(roomOrder.begin(), roomOrder.end(), [&](uint32_t a, uint32_t b) {
+            return roomList[a]->getRoomNumber() < roomList[b]->getRoomNumber();
+        });
+
+        vector<SnapshotRateRecord> rateRecords;
+        for (size_t type = 0; type < rateCalendars.size(); ++type) {
+            for (const RateRule& rule : rateCalendars[type].rules()) {
+                SnapshotRateRecord record = {};
+                record.value = rule.value;
+                record.from = rule.from;
+                record.to = rule.to;
+                record.type = static_cast<uint8_t>(type);
+                record.kind = static_cast<uint8_t>(rule.kind);
+                rateRecords.push_back(record);
+            }
+        }
+
+        auto align8 = [](uint64_t offset) { return (offset + 7) & ~uint64_t(7); };
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.lastIssuedID = issuedIDs.lastIssued();
+        header.roomCount = static_cast<uint32_t>(rooms.size());
+        header.reservationCount = static_cast<uint32_t>(liveSlots.size());
+        header.roomOffset = sizeof(SnapshotHeader);
+        header.roomOrderOffset = align8(header.roomOffset + rooms.size() * sizeof(SnapshotRoomRecord));
+        header.reservationOffset = align8(header.roomOrderOffset + rooms.size() * sizeof(uint32_t));
+        header.rateRuleOffset = header.reservationOffset + liveSlots.size() * sizeof(SnapshotReservationRecord);
+        header.rateRuleCount = static_cast<uint32_t>(rateRecords.size());
+        header.changeOffset = changes.end();
+        vector<WaitRequest> waiting = waitlist.list();
+        header.waitlistOffset = header.rateRuleOffset + rateRecords.size() * sizeof(SnapshotRateRecord);
+        header.waitlistCount = static_cast<uint32_t>(waiting.size());
+        header.lastWaitID = waitlist.lastIssued();
+        string archived;
+        {
+            shared_lock<shared_mutex> archiveLock(archiveMutex);
+            BinaryWriter archiveWriter(archived);
+            archive.write(archiveWriter);
+        }
+        header.archiveOffset = align8(header.waitlistOffset + waiting.size() * sizeof(SnapshotWaitRecord));
+        header.archiveSize = archived.size();
+        header.stringHeapOffset = align8(header.archiveOffset + archived.size());
+
+        string data(header.stringHeapOffset, '\0');
+        for (size_t i = 0; i < roomList.size(); ++i) {
+            SnapshotRoomRecord record = {};
+            record.baseRate = roomList[i]->getBaseRate();
+            record.roomNumber = roomList[i]->getRoomNumber();
+            record.maxGuests = roomList[i]->getMaxGuests();
+            record.type = static_cast<uint8_t>(roomList[i]->getType());
+            record.billing = static_cast<uint8_t>(roomList[i]->getBillingStrategy().index());
+            memcpy(&data[header.roomOffset + i * sizeof(record)], &record, sizeof(record));
+        }
+        memcpy(&data[header.roomOrderOffset], roomOrder.data(), roomOrder.size() * sizeof(uint32_t));
+        string heap;
+        for (size_t i = 0; i < liveSlots.size(); ++i) {
+            const Reservation& reservation = *liveSlots[i];
+            SnapshotReservationRecord record = {};
+            record.reservationID = reservation.getReservationID();
+            record.roomNumber = reservation.getRoomNumber();
+            record.checkIn = reservation.getCheckInDate().dayNumber();
+            record.checkOut = reservation.getCheckOutDate().dayNumber();
+            record.numberOfGuests = reservation.getNumberOfGuests();
+            record.nameOffset = static_cast<uint32_t>(heap.size());
+            record.nameLength = static_cast<uint32_t>(reservation.getGuestName().size());
+            heap += reservation.getGuestName();
+            record.contactOffset = static_cast<uint32_t>(heap.size());
+            record.contactLength = static_cast<uint32_t>(reservation.getContactInfo().size());
+            heap += reservation.getContactInfo();
+            memcpy(&data[header.reservationOffset + i * sizeof(record)], &record, sizeof(record));
+        }
+        for (size_t i = 0; i < waiting.size(); ++i) {
+            const WaitRequest& request = waiting[i];
+            SnapshotWaitRecord record = {};
+            record.waitID = request.waitID;
+            record.checkIn = request.checkIn.dayNumber();
+            record.checkOut = request.checkOut.dayNumber();
+            record.guests = request.guests;
+            record.nameOffset = static_cast<uint32_t>(heap.size());
+            record.nameLength = static_cast<uint32_t>(request.guestName.size());
+            heap += request.guestName;
+            record.contactOffset = static_cast<uint32_t>(heap.size());
+            record.contactLength = static_cast<uint32_t>(request.contactInfo.size());
+            heap += request.contactInfo;
+            record.type = static_cast<uint8_t>(request.type);
+            record.loyaltyTier = static_cast<uint8_t>(request.loyaltyTier);
+            record.corporate = request.corporate ? 1 : 0;
+            memcpy(&data[header.waitlistOffset + i * sizeof(record)], &record, sizeof(record));
+        }
+        if (!rateRecords.empty()) memcpy(&data[header.rateRuleOffset], rateRecords.data(), rateRecords.size() * sizeof(SnapshotRateRecord));
+        if (!archived.empty()) memcpy(&data[header.archiveOffset], archived.data(), archived.size());
+        header.stringHeapSize = heap.size();
+        memcpy(&data[0], &header, sizeof(header));
+        data += heap;
+
+        string tempPath = path + ".tmp";
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file) return false;
+        bool written = fwrite(data.data(), 1, data.size(), file) == data.size() && syncFile(file);
+        fclose(file);
+#ifdef _WIN32
+        remove(path.c_str());
+#endif
+        return written && rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+
+    bool addRoomLocked(int number, Room::RoomType type, double rate, BillingStrategy strategy, int guests) {
+        if (roomIndex.count(number)) {
+            output() << "Room " << number << " already exists.\n";
+            return false;
+        }
+        RoomHandle handle = rooms.emplace(number, type, rate, strategy, guests);
+        roomIndex[number] = handle;
+        billingTable.set(handle, rate, strategy, guests);
+        indexRoom(rooms[handle]);
+        countRoom(rooms[handle], 1);
+        logMutation(HotelJournal::Op::ADD_ROOM, [&](BinaryWriter& writer) { encodeRoom(writer, number, type, rate, strategy, guests); });
+        return true;
+    }
+
+    bool deleteRoomLocked(int roomNumber) {
+        auto it = roomIndex.find(roomNumber);
+        if (it == roomIndex.end()) {
+            output() << "Room not found.\n";
+            return false;
+        }
+        // The pool unlinks the room from the listing order; no other room moves.
+        RoomHandle handle = it->second;
+        roomIndex.erase(it);
+        quotes.invalidate(roomNumber);
+        unindexRoom(rooms[handle]);
+        countRoom(rooms[handle], -1);
+        rooms.erase(handle);
+        logMutation(HotelJournal::Op::DELETE_ROOM, [&](BinaryWriter& writer) {
+            writer.put<int32_t>(roomNumber);
+        });
+        output() << "\n===========================================\n";
+        output() << "Room " << roomNumber << " deleted successfully!\n";
+        output() << "=============================================\n";
+        return true;
+    }
+
+    bool updateRoomRateLocked(int roomNumber, double newRate) {
+        auto it = roomIndex.find(roomNumber);
+        if (it == roomIndex.end()) {
+            output() << "Room not found.\n";
+            return false;
+        }
+        Room& room = rooms[it->second];
+        unindexRoom(room);
+        countRoom(room, -1);
+        room.setBaseRate(newRate);
+        quotes.invalidate(roomNumber);
+        countRoom(room, 1);
+        indexRoom(room);
+        billingTable.setBaseRate(it->second, newRate);
+        logMutation(HotelJournal::Op::UPDATE_RATE, [&](BinaryWriter& writer) {
+            writer.put<int32_t>(roomNumber);
+            writer.put<double>(newRate);
+        });
+        output() << "\n===========================================\n";
+        output() << "Room " << roomNumber << " rate updated to $" << fixed << setprecision(2) << newRate << " successfully!\n";
+        output() << "=============================================\n";
+        return true;
+    }
+
+    bool updateRoomBillingStrategyLocked(int roomNumber, BillingStrategy strategy) {
+        auto it = roomIndex.find(roomNumber);
+        if (it == roomIndex.end()) {
+            output() << "Room not found.\n";
+            return false;
+        }
+        countRoom(rooms[it->second], -1);
+        rooms[it->second].setBillingStrategy(strategy);
+        quotes.invalidate(roomNumber);
+        countRoom(rooms[it->second], 1);
+        billingTable.setStrategy(it->second, strategy);
+        logMutation(HotelJournal::Op::UPDATE_BILLING, [&](BinaryWriter& writer) {
+            writer.put<int32_t>(roomNumber);
+            writer.put<uint8_t>(static_cast<uint8_t>(strategy.index()));
+        });
+        output() << "\n===========================================\n";
+        output() << "Room " << roomNumber << " billing strategy updated successfully!\n";
+        output() << "============================================\n";
+        return true;
+    }
+
+    // Applies a rule to a room type's calendar and reprices the booked stays it touches in the
+    // aggregates. Returns false after reporting why the rule was rejected.
+    bool applyRateRuleLocked(Room::RoomType type, const RateRule& rule) {
+        RateCalendar& rates = rateCalendars[static_cast<size_t>(type)];
+        if (const char* problem = rates.problem(rule)) {
+            output() << "============================================\n";
+            output() << problem << "\n";
+            output() << "===========================================\n";
+            return false;
+        }
+        auto [from, to] = rule.affectedNights();
+        auto stayTotal = [&](const Room& room) {
+            double nights = 0.0;
+            room.forEachStay(from, to, [&](int checkIn, int checkOut) { nights += rates.ratedNights(Date(checkIn), Date(checkOut)); });
+            return nights;
+        };
+        vector<pair<Room*, double>> touched; // rooms with stays in the affected nights, and their total before
+        const int typeKey = static_cast<int>(type);
+        auto it = roomsByTypeRate.lower_bound(make_tuple(typeKey, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        for (; it != roomsByTypeRate.end() && get<0>(*it) == typeKey; ++it) {
+            Room* room = findRoom(get<2>(*it));
+            quotes.invalidate(room->getRoomNumber());
+            if (room->getBookedNights() > 0) touched.emplace_back(room, stayTotal(*room));
+        }
+        HOTEL_SCANNED(touched.size());
+        rates.apply(rule);
+        for (auto& [room, before] : touched) {
+            countRoom(*room, -1);
+            room->addRatedNights(stayTotal(*room) - before);
+            countRoom(*room, 1);
+        }
+        logMutation(HotelJournal::Op::RATE_RULE, [&](BinaryWriter& writer) {
+            writer.put<uint8_t>(static_cast<uint8_t>(type));
+            writer.put<uint8_t>(static_cast<uint8_t>(rule.kind));
+            writer.put<int32_t>(rule.from);
+            writer.put<int32_t>(rule.to);
+            writer.put<double>(rule.value);
+        });
+        return true;
+    }
+
+    bool changeRates(Room::RoomType type, const RateRule& rule) {
+        HOTEL_PROFILE(SET_RATE_RULE);
+        auto lock = lockExclusive();
+        if (!applyRateRuleLocked(type, rule)) return false;
+        output() << "\n===========================================\n";
+        output() << Room::typeLabel(type) << " rate calendar updated successfully!\n";
+        output() << "=============================================\n";
+        return true;
+    }
+
+    bool cancelReservationLocked(int reservationID, FreedStay* freed = nullptr) {
+        return withReservation(reservationID, [&](Reservation& reservation) {
+            if (freed) *freed = { reservation.getRoomNumber(), reservation.getCheckInDate(), reservation.getCheckOutDate() };
+            removeReservationLocked(reservation);
+            logMutation(HotelJournal::Op::CANCEL, [&](BinaryWriter& writer) {
+                writer.put<int32_t>(reservationID);
+            });
+            output() << "\n===========================================\n";
+            output() << "Reservation " << reservationID << " cancelled successfully!\n";
+            output() << "============================================\n";
+            return true;
+        });
+    }
+
+    bool changeReservationGuestsLocked(int reservationID, int newGuests) {
+        return withReservation(reservationID, [&](Reservation& reservation) {
+            if (const Room* room = findRoom(reservation.getRoomNumber())) {
+                if (newGuests > room->getMaxGuests()) {
+                    output() << "Error: Room " << room->getRoomNumber() << " can only accommodate " << room->getMaxGuests() << " guests.\n";
+                    return false;
+                }
+            }
+
+            reservation.updateGuests(newGuests);
+            logMutation(HotelJournal::Op::UPDATE_GUESTS, [&](BinaryWriter& writer) {
+                writer.put<int32_t>(reservationID);
+                writer.put<int32_t>(newGuests);
+            });
+            output() << "\n===========================================\n";
+            output() << "Number of guests updated successfully.\n";
+            output() << "============================================\n";
+            return true;
+        });
+    }
+
+    // Needs the stripes of both rooms, so it cannot use withReservation.
+    bool changeReservationRoomLocked(int reservationID, int newRoomNumber, FreedStay* freed = nullptr) {
+        Room* room = findRoom(newRoomNumber);
+        int oldRoomNumber;
+        while (reservationRoom(reservationID, oldRoomNumber)) {
+            mutex* first = &roomLock(oldRoomNumber);
+            mutex* second = &roomLock(newRoomNumber);
+            if (second < first) swap(first, second);
+            lock_guard<mutex> firstGuard(*first);
+            unique_lock<mutex> secondGuard(*second, defer_lock);
+            if (second != first) secondGuard.lock();
+            lock_guard<mutex> lock(reservationMutex);
+            Reservation* reservation = findReservation(reservationID);
+            if (!reservation) break;
+            if (reservation->getRoomNumber() != oldRoomNumber) continue;
+
+            if (!room) {
+                output() << "Room not available.\n";
+                return false;
+            }
+            if (reservation->getNumberOfGuests() > room->getMaxGuests()) {
+                output() << "Error: Room " << newRoomNumber << " can only accommodate " << room->getMaxGuests() << " guests.\n";
+                return false;
+            }
+            if (newRoomNumber == oldRoomNumber) {
+                output() << "Reservation is already in room " << newRoomNumber << ".\n";
+                return false;
+            }
+
+            if (!room->book(reservation->getCheckInDate(), reservation->getCheckOutDate(), reservationID)) {
+                output() << "Room " << newRoomNumber << " is not available for the reservation dates.\n";
+                return false;
+            }
+            Room* oldRoom = findRoom(oldRoomNumber);
+            if (oldRoom && oldRoom->release(reservation->getCheckInDate(), reservationID)) {
+                countStay(oldRoom, reservation->getCheckInDate(), reservation->getCheckOutDate(), -1);
+            }
+            countStay(room, reservation->getCheckInDate(), reservation->getCheckOutDate(), 1);
+            if (freed) *freed = { oldRoomNumber, reservation->getCheckInDate(), reservation->getCheckOutDate() };
+
+            reservation->updateRoomNumber(newRoomNumber);
+            logMutation(HotelJournal::Op::UPDATE_ROOM, [&](BinaryWriter& writer) {
+                writer.put<int32_t>(reservationID);
+                writer.put<int32_t>(newRoomNumber);
+            });
+            output() << "\n===========================================\n";
+            output() << "Room changed successfully.\n";
+            output() << "============================================\n";
+            return true;
+        }
+        output() << "Reservation not found.\n";
+        return false;
+    }
+
+    bool changeReservationDatesLocked(int reservationID, Date newCheckIn, Date newCheckOut, FreedStay* freed = nullptr) {
+        return withReservation(reservationID, [&](Reservation& reservation) {
+            if (newCheckOut <= newCheckIn) throw invalid_argument("Invalid date range.");
+
+            if (Room* room = findRoom(reservation.getRoomNumber())) {
+                bool held = room->release(reservation.getCheckInDate(), reservationID);
+                if (!room->book(newCheckIn, newCheckOut, reservationID)) {
+                    if (held) room->book(reservation.getCheckInDate(), reservation.getCheckOutDate(), reservationID);
+                    output() << "Room " << room->getRoomNumber() << " is not available for the new dates.\n";
+                    return false;
+                }
+                if (held) countStay(room, reservation.getCheckInDate(), reservation.getCheckOutDate(), -1);
+                countStay(room, newCheckIn, newCheckOut, 1);
+            }
+            reservationsByCheckIn.erase(make_pair(reservation.getCheckInDate().dayNumber(), reservationID));
+            reservationsByCheckIn.emplace(newCheckIn.dayNumber(), reservationID);
+            longestStay = max(longestStay, newCheckOut - newCheckIn);
+            if (freed) *freed = { reservation.getRoomNumber(), reservation.getCheckInDate(), reservation.getCheckOutDate() };
+            reservation.updateDates(newCheckIn, newCheckOut);
+            logMutation(HotelJournal::Op::UPDATE_DATES, [&](BinaryWriter& writer) {
+                writer.put<int32_t>(reservationID);
+                writer.put<int32_t>(newCheckIn.dayNumber());
+                writer.put<int32_t>(newCheckOut.dayNumber());
+            });
+            output() << "\n===========================================\n";
+            output() << "Reservation dates updated successfully.\n";
+            output() << "============================================\n";
+            return true;
+        });
+    }
+
+    // Walks only the rooms of the type that take the party, in roomsByTypeFit's best-fit order.
+    vector<int> findAvailableRoomsLocked(Date checkIn, Date checkOut, int guests, Room::RoomType type) const {
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        int t = static_cast<int>(type);
+        auto first = roomsByTypeFit.lower_bound(make_tuple(t, guests, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        auto last = roomsByTypeFit.lower_bound(make_tuple(t + 1, numeric_limits<int>::min(), -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        vector<int> result;
+        for (auto it = first; it != last; ++it) {
+            HOTEL_SCANNED(1);
+            int roomNumber = get<3>(*it);
+            lock_guard<mutex> roomGuard(roomLock(roomNumber));
+            if (findRoom(roomNumber)->isAvailableFor(checkIn, checkOut)) result.push_back(roomNumber);
+        }
+        return result;
+    }
+
+    bool isRoomAvailableLocked(const Room& room) const {
+        lock_guard<mutex> roomGuard(roomLock(room.getRoomNumber()));
+        return room.isRoomAvailable();
+    }
+
+    // Walks roomsByTypeRate from the cursor (or the filter's lowest rate) within each requested
+    // type, so the cost is the page plus the rooms in that rate band rejected by the other filters.
+    RoomPage findRoomsLocked(const RoomFilter& filter, const optional<RoomCursor>& after, size_t limit) const {
+        if (filter.freeFrom.has_value() != filter.freeTo.has_value()) throw invalid_argument("A free-room filter needs both dates.");
+        if (filter.freeFrom && *filter.freeTo <= *filter.freeFrom) throw invalid_argument("Invalid date range.");
+        RoomPage page;
+        if (limit == 0) return page;
+        int firstType = filter.type ? static_cast<int>(*filter.type) : static_cast<int>(Room::RoomType::SINGLE);
+        int lastType = filter.type ? firstType : static_cast<int>(Room::TYPE_COUNT) - 1;
+        for (int type = firstType; type <= lastType && !page.next; ++type) {
+            if (after && after->type > type) continue;
+            tuple<int, double, int> start(type, filter.minRate, numeric_limits<int>::min());
+            auto it = roomsByTypeRate.lower_bound(start);
+            if (after && after->type == type && make_tuple(type, after->rate, after->roomNumber) >= start) {
+                it = roomsByTypeRate.upper_bound(make_tuple(type, after->rate, after->roomNumber));
+            }
+            for (; it != roomsByTypeRate.end() && get<0>(*it) == type && get<1>(*it) <= filter.maxRate; ++it) {
+                HOTEL_SCANNED(1);
+                const Room& room = rooms[roomIndex.at(get<2>(*it))];
+                if (room.getMaxGuests() < filter.minGuests) continue;
+                if (filter.billing && room.getBillingStrategy().index() != *filter.billing) continue;
+                if (filter.freeFrom) {
+                    lock_guard<mutex> roomGuard(roomLock(room.getRoomNumber()));
+                    if (!room.isAvailableFor(*filter.freeFrom, *filter.freeTo)) continue;
+                }
+                page.roomNumbers.push_back(room.getRoomNumber());
+                if (page.roomNumbers.size() == limit) {
+                    page.next = RoomCursor{ type, get<1>(*it), get<2>(*it) };
+                    break;
+                }
+            }
+        }
+        return page;
+    }
+
+    // With a guest prefix, walks reservationsByGuest over the names sharing it; otherwise walks
+    // reservationsByCheckIn from the earliest check-in that could still overlap the date range.
+    ReservationPage findReservationsLocked(const ReservationFilter& filter, const optional<ReservationCursor>& after, size_t limit) const {
+        if (filter.from && filter.to && *filter.to <= *filter.from) throw invalid_argument("Invalid date range.");
+        lock_guard<mutex> lock(reservationMutex);
+        ReservationPage page;
+        if (limit == 0) return page;
+        // Returns true once the page is full.
+        auto take = [&](int reservationID) {
+            HOTEL_SCANNED(1);
+            const Reservation& reservation = reservations[reservationIndex.at(reservationID)];
+            if (filter.from && reservation.getCheckOutDate() <= *filter.from) return false;
+            if (filter.to && *filter.to <= reservation.getCheckInDate()) return false;
+            page.reservations.push_back(reservation);
+            if (page.reservations.size() < limit) return false;
+            page.next = ReservationCursor{ string(reservation.getGuest().key), reservation.getCheckInDate().dayNumber(), reservationID };
+            return true;
+        };
+
+        if (!filter.guestPrefix.empty()) {
+            string prefix = guestKey(filter.guestPrefix);
+            pair<string_view, int> start(prefix, numeric_limits<int>::min());
+            auto it = reservationsByGuest.lower_bound(start);
+            if (after && make_pair(string_view(after->guestKey), after->reservationID) >= start) {
+                it = reservationsByGuest.upper_bound(make_pair(string_view(after->guestKey), after->reservationID));
+            }
+            for (; it != reservationsByGuest.end() && it->first.substr(0, prefix.size()) == prefix; ++it) {
+                if (take(it->second)) break;
+            }
+        } else {
+            pair<int32_t, int> start(filter.from ? filter.from->dayNumber() - longestStay : numeric_limits<int32_t>::min(),
+                                     numeric_limits<int>::min());
+            auto it = reservationsByCheckIn.lower_bound(start);
+            if (after && make_pair(after->checkIn, after->reservationID) >= start) {
+                it = reservationsByCheckIn.upper_bound(make_pair(after->checkIn, after->reservationID));
+            }
+            for (; it != reservationsByCheckIn.end() && (!filter.to || it->first < filter.to->dayNumber()); ++it) {
+                if (take(it->second)) break;
+            }
+        }
+        return page;
+    }
+
+public:
+    // The capacities are hints: that many rooms and reservations fit before the pools grow.
+    explicit Hotel(size_t roomCapacity = 0, size_t reservationCapacity = 0) {
+        rooms.reserve(roomCapacity);
+        reservations.reserve(reservationCapacity);
+    }
+    Hotel(const Hotel&) = delete;
+    Hotel& operator=(const Hotel&) = delete;
+
+    void setOutput(ostream& stream) { out = &stream; }
+    // Redirects result messages from the calling thread only (null restores setOutput's stream),
+    // so concurrent sessions each get their own output instead of interleaving on one.
+    static void setThreadOutput(ostream* stream) { threadOut = stream; }
+    void attachJournal(HotelJournal* target) { journal = target; }
+    void setListingFormat(ListingFormat format) { listingFormat = format; }
+
+    // Makes this Hotel shard index of a HotelChain; call before the first booking.
+    void setShard(int index) { issuedIDs.setShard(index); }
+    int lastReservationID() const { return issuedIDs.lastIssued(); }
+
+    // Writes rooms, live reservations, rate rules, the waitlist and the stay archive as a version 6
+    // snapshot to a temporary file and renames it over path, so a crash mid-write leaves the
+    // previous snapshot intact.
+    bool saveSnapshot(const string& path) const {
+        HOTEL_PROFILE(SAVE_SNAPSHOT);
+        {
+            // Nothing has changed since the mapped snapshot was loaded, and it may not be replaced while mapped.
+            shared_lock<shared_mutex> lock(stateMutex);
+            if (image && image->path() == path) return true;
+        }
+        auto lock = lockMaterialized();
+        return writeSnapshotLocked(path);
+    }
+
+    // Saves a snapshot and empties the journal under one exclusive lock, so no mutation can be
+    // journaled after the snapshot was taken and then dropped with the journal.
+    bool checkpoint(const string& path) {
+        HOTEL_PROFILE(CHECKPOINT);
+        unique_lock<shared_mutex> lock(stateMutex);
+        if (!(image && image->path() == path)) {
+            materializeLocked();
+            if (!writeSnapshotLocked(path)) return false;
+        }
+        if (journal) journal->truncate();
+        journalStart = changes.end();
+        return true;
+    }
+
+    // Replaces the current state with the snapshot at path. Returns false if there is none;
+    // throws runtime_error if it exists but cannot be read. Version 2 to 6 snapshots are mapped and
+    // served in place until the first mutation; version 1 snapshots are parsed record by record.
+    // The change feed restarts at the snapshot's offset (0 before version 4).
+    bool loadSnapshot(const string& path) {
+        HOTEL_PROFILE(LOAD_SNAPSHOT);
+        unique_lock<shared_mutex> lock(stateMutex);
+        clearState();
+        journalStart = 0;
+        changes.restart(0);
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        char prefix[sizeof(SNAPSHOT_MAGIC) + sizeof(uint32_t)];
+        bool recognized = fread(prefix, 1, sizeof(prefix), file) == sizeof(prefix) && memcmp(prefix, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+        fclose(file);
+        if (!recognized) throw runtime_error("'" + path + "' is not a hotel snapshot.");
+        uint32_t version;
+        memcpy(&version, prefix + sizeof(SNAPSHOT_MAGIC), sizeof(version));
+        if (version >= 2 && version <= SNAPSHOT_VERSION) {
+            auto snapshot = make_unique<SnapshotImage>();
+            if (!snapshot->open(path, SNAPSHOT_MAGIC)) return false;
+            // The rate calendars are small and needed by the bills served from the mapping.
+            for (size_t i = 0; i < snapshot->rateRuleCount(); ++i) {
+                const SnapshotRateRecord& record = snapshot->rateRule(i);
+                RateRule rule = { static_cast<RateRule::Kind>(record.kind), record.from, record.to, record.value };
+                if (record.type >= rateCalendars.size() || record.kind > static_cast<uint8_t>(RateRule::Kind::RESET) ||
+                    rateCalendars[record.type].problem(rule)) {
+                    throw runtime_error("'" + path + "' has an invalid rate rule.");
+                }
+                rateCalendars[record.type].apply(rule);
+            }
+            // So is the waitlist, which only holds requests still waiting.
+            for (size_t i = 0; i < snapshot->waitlistCount(); ++i) {
+                const SnapshotWaitRecord& record = snapshot->waitRecord(i);
+                if (record.type >= rateCalendars.size() || record.checkOut <= record.checkIn || record.guests < 1) {
+                    throw runtime_error("'" + path + "' has an invalid waitlist entry.");
+                }
+                WaitRequest request;
+                request.waitID = record.waitID;
+                request.guestName = string(snapshot->text(record.nameOffset, record.nameLength));
+                request.contactInfo = string(snapshot->text(record.contactOffset, record.contactLength));
+                request.type = static_cast<Room::RoomType>(record.type);
+                request.checkIn = Date(record.checkIn);
+                request.checkOut = Date(record.checkOut);
+                request.guests = record.guests;
+                request.loyaltyTier = record.loyaltyTier;
+                request.corporate = record.corporate != 0;
+                waitlist.add(move(request));
+            }
+            waitlist.restore(snapshot->lastWaitID());
+            // And the stay archive, every block of which is decoded once to check it.
+            BinaryReader archived = snapshot->archive();
+            if (!archived.atEnd()) {
+                unique_lock<shared_mutex> archiveLock(archiveMutex);
+                try {
+                    archive.read(archived);
+                } catch (const runtime_error&) {
+                    throw runtime_error("'" + path + "' has a damaged stay archive.");
+                }
+                if (!archived.atEnd()) throw runtime_error("'" + path + "' has a damaged stay archive.");
+            }
+            issuedIDs.restore(snapshot->lastIssuedID());
+            journalStart = snapshot->changeOffset();
+            changes.restart(journalStart);
+            image = move(snapshot);
+            mapped.store(true, memory_order_release);
+            return true;
+        }
+        if (version != 1) throw runtime_error("Unsupported snapshot version in '" + path + "'.");
+
+        string data;
+        if (!readWholeFile(path, data)) return false;
+        BinaryReader reader(data.data() + sizeof(prefix), data.size() - sizeof(prefix));
+
+        QuietScope quiet(*this);
+        int lastIssuedID = reader.get<int32_t>();
+        uint32_t roomCount = reader.get<uint32_t>();
+        rooms.reserve(roomCount);
+        for (uint32_t i = 0; i < roomCount; ++i) {
+            int number = reader.get<int32_t>();
+            auto type = static_cast<Room::RoomType>(reader.get<uint8_t>());
+            double rate = reader.get<double>();
+            BillingStrategy strategy = billingStrategyFromIndex(reader.get<uint8_t>());
+            int guests = reader.get<int32_t>();
+            addRoomLocked(number, type, rate, strategy, guests);
+        }
+        uint32_t reservationCount = reader.get<uint32_t>();
+        reservations.reserve(reservationCount);
+        for (uint32_t i = 0; i < reservationCount; ++i) {
+            int id = reader.get<int32_t>();
+            int roomNumber = reader.get<int32_t>();
+            Date checkIn(reader.get<int32_t>());
+            Date checkOut(reader.get<int32_t>());
+            int guests = reader.get<int32_t>();
+            string name = reader.getString();
+            string contact = reader.getString();
+            insertReservation(Reservation(id, guestDirectory.intern(name, contact), roomNumber, checkIn, checkOut, guests));
+        }
+        issuedIDs.restore(lastIssuedID);
+        return true;
+    }
+
+    // Re-applies journaled mutations on top of the current state without logging them again.
+    // Their events are not republished; the feed carries on after them and changesSince reads
+    // them back from the journal.
+    size_t replayJournal(const string& path) {
+        HOTEL_PROFILE(REPLAY_JOURNAL);
+        unique_lock<shared_mutex> lock(stateMutex);
+        QuietScope quiet(*this);
+        size_t applied = HotelJournal::replay(path, [&](HotelJournal::Op op, BinaryReader& reader) {
+            applyJournalRecord(op, reader);
+        });
+        changes.restart(journalStart + applied);
+        return applied;
+    }
+
+    // Not synchronized beyond the call itself; for single-session use.
+    const SlabPool<Room>& getRooms() const {
+        auto lock = lockMaterialized();
+        return rooms;
+    }
+
+    bool hasRoom(int roomNumber) const {
+        auto lock = lockMaterialized();
+        return roomIndex.count(roomNumber) != 0;
+    }
+
+    optional<Room::RoomType> roomTypeOf(int roomNumber) const {
+        auto lock = lockMaterialized();
+        const Room* room = findRoom(roomNumber);
+        if (!room) return nullopt;
+        return room->getType();
+    }
+
+    // A copy, since the stored reservation may be changed by another session at any time.
+    optional<Reservation> getReservation(int reservationID) const {
+        HOTEL_PROFILE(GET_RESERVATION);
+        auto state = lockMaterialized();
+        lock_guard<mutex> lock(reservationMutex);
+        const Reservation* reservation = findReservation(reservationID);
+        if (!reservation) return nullopt;
+        return *reservation;
+    }
+
+    bool addRoom(int number, Room::RoomType type, double rate, BillingStrategy strategy, int guests) {
+        HOTEL_PROFILE(ADD_ROOM);
+        auto lock = lockExclusive();
+        return addRoomLocked(number, type, rate, strategy, guests);
+    }
+
+    // Bulk loads for BulkImporter. Rows are taken in order, each checked against the hotel and
+    // the rows before it, and the rejected ones are appended to rejected with the reason. The
+    // sorted indexes are filled once at the end from runs sorted on up to threads threads,
+    // instead of per row. Each added row is published to the change feed, but nothing is
+    // journaled: the caller checkpoints afterwards, which costs far less than a journal record a
+    // row and must happen before anything else is journaled, so that journal records line up
+    // with feed offsets again. Both return the number of rows added.
+    size_t importRooms(const vector<ImportedRoom>& rows, vector<ImportRejection>& rejected, size_t threads = 1) {
+        HOTEL_PROFILE(IMPORT_ROOMS);
+        auto lock = lockExclusive();
+        HOTEL_SCANNED(rows.size());
+        vector<tuple<int, double, int>> byRate;
+        vector<tuple<int, int, double, int>> byFit;
+        byRate.reserve(rows.size());
+        byFit.reserve(rows.size());
+        rooms.reserve(rooms.size() + rows.size());
+        roomIndex.reserve(roomIndex.size() + rows.size());
+        for (const ImportedRoom& row : rows) {
+            if (roomIndex.count(row.number)) {
+                rejected.push_back({ row.line, "Room " + to_string(row.number) + " already exists." });
+                continue;
+            }
+            RoomHandle handle = rooms.emplace(row.number, row.type, row.rate, row.billing, row.maxGuests);
+            roomIndex.emplace(row.number, handle);
+            billingTable.set(handle, row.rate, row.billing, row.maxGuests);
+            countRoom(rooms[handle], 1);
+            publishMutation(HotelJournal::Op::ADD_ROOM, [&](BinaryWriter& writer) {
+                encodeRoom(writer, row.number, row.type, row.rate, row.billing, row.maxGuests);
+            });
+            int type = static_cast<int>(row.type);
+            byRate.emplace_back(type, row.rate, row.number);
+            byFit.emplace_back(type, row.maxGuests, row.rate, row.number);
+        }
+        size_t added = byRate.size();
+        insertSorted(roomsByTypeRate, byRate, threads);
+        insertSorted(roomsByTypeFit, byFit, threads);
+        return added;
+    }
+
+    // Stays may be in the past; each must fit its room's capacity and be free in its calendar.
+    // The rows are checked and booked into the room calendars first, then their guests are
+    // interned in one batch, then the reservations are stored.
+    size_t importReservations(const vector<ImportedStay>& rows, vector<ImportRejection>& rejected, size_t threads = 1) {
+        HOTEL_PROFILE(IMPORT_RESERVATIONS);
+        auto lock = lockExclusive();
+        HOTEL_SCANNED(rows.size());
+        struct Accepted {
+            const ImportedStay* row;
+            Room* room;
+            int reservationID;
+        };
+        vector<Accepted> accepted;
+        vector<pair<string_view, string_view>> identities;
+        accepted.reserve(rows.size());
+        identities.reserve(rows.size());
+        for (const ImportedStay& row : rows) {
+            Room* room = findRoom(row.roomNumber);
+            string problem;
+            if (!room) problem = "Room " + to_string(row.roomNumber) + " not found.";
+            else if (row.guests > room->getMaxGuests()) problem = "Room " + to_string(row.roomNumber) + " can only accommodate " + to_string(room->getMaxGuests()) + " guests.";
+            else if (!room->isAvailableFor(row.checkIn, row.checkOut)) problem = "Room " + to_string(row.roomNumber) + " not available for the selected dates.";
+            if (!problem.empty()) {
+                rejected.push_back({ row.line, move(problem) });
+                continue;
+            }
+            int reservationID;
+            try {
+                reservationID = issuedIDs.issue();
+            } catch (const runtime_error& e) {
+                rejected.push_back({ row.line, e.what() });
+                continue;
+            }
+            room->book(row.checkIn, row.checkOut, reservationID);
+            accepted.push_back({ &row, room, reservationID });
+            identities.emplace_back(row.guestName, row.contactInfo);
+        }
+
+        vector<const Guest*> guests = guestDirectory.internAll(identities, threads);
+        vector<pair<string_view, int>> byGuest;
+        vector<pair<int32_t, int>> byCheckIn;
+        byGuest.reserve(accepted.size());
+        byCheckIn.reserve(accepted.size());
+        reservations.reserve(reservations.size() + accepted.size());
+        reservationIndex.reserve(reservationIndex.size() + accepted.size());
+        for (size_t i = 0; i < accepted.size(); ++i) {
+            const ImportedStay& row = *accepted[i].row;
+            int reservationID = accepted[i].reservationID;
+            countStay(accepted[i].room, row.checkIn, row.checkOut, 1);
+            guestDirectory.attach(*guests[i], reservationID);
+            longestStay = max(longestStay, row.checkOut - row.checkIn);
+            ReservationHandle handle = reservations.emplace(Reservation(reservationID, *guests[i], row.roomNumber, row.checkIn, row.checkOut, row.guests));
+            reservationIndex.emplace(reservationID, handle);
+            if (reservationLive.size() <= handle) reservationLive.resize(handle + 1);
+            reservationLive[handle] = true;
+            publishMutation(HotelJournal::Op::RESERVE, [&](BinaryWriter& writer) { encodeReservation(writer, reservations[handle]); });
+            byGuest.emplace_back(guests[i]->key, reservationID);
+            byCheckIn.emplace_back(row.checkIn.dayNumber(), reservationID);
+        }
+        aggregates.reservations += accepted.size();
+        insertSorted(reservationsByGuest, byGuest, threads);
+        insertSorted(reservationsByCheckIn, byCheckIn, threads);
+        return accepted.size();
+    }
+
+void addRoomWithValidation() {
+    cout << "\n========== ADD NEW ROOM ==========\n";
+    int roomNumber;
+    bool roomExists;
+
+    do {
+        roomNumber = getValidatedInt("Enter room number: ");
+        roomExists = hasRoom(roomNumber);
+        if (roomExists) {
+            cout << "Room " << roomNumber << " already exists. Please enter a different room number.\n";
+        }
+    } while (roomExists); 
+
+    double baseRate;
+    while (true) {
+        cout << "Enter base rate per night: $";
+        string input;
+        cin >> input;
+
+        try {
+            baseRate = stod(input); // Convert string to double
+            if (baseRate <= 0) {
+                cout << "Invalid input. Please enter a positive number for the base rate.\n";
+            } else {
+                break; // Valid input
+            }
+        } catch (const invalid_argument&) {
+            cout << "Invalid input. Please enter a valid number for the base rate.\n";
+        } catch (const out_of_range&) {
+            cout << "Input is out of range. Please enter a valid number for the base rate.\n";
+        }
+    }
+
+    printRoomTypeMenu();
+    const string typeRange = "(1-" + to_string(Room::TYPE_COUNT) + ")";
+    optional<Room::RoomType> roomType;
+    while (!(roomType = Room::typeFromMenu(getValidatedInt("Select room type " + typeRange + ": ")))) {
+        cout << "Invalid room type choice. Please select a valid option " << typeRange << ".\n";
+    }
+    int maxGuests = Room::defaultMaxGuests(*roomType);
+
+    printBillingMenu();
+    const string billingRange = "(1-" + to_string(BILLING_KINDS.size()) + ")";
+    optional<BillingStrategy> billingStrategy;
+    while (!(billingStrategy = billingFromMenu(getValidatedInt("Select billing strategy " + billingRange + ": ")))) {
+        cout << "Invalid billing strategy choice. Please select a valid option " << billingRange << ".\n";
+    }
+
+    addRoom(roomNumber, *roomType, baseRate, *billingStrategy, maxGuests);
+    cout << "\n==========================\n";
+    cout << "Room added successfully!\n";
+    cout << "============================\n";
+}
+
+    bool deleteRoom(int roomNumber) {
+        HOTEL_PROFILE(DELETE_ROOM);
+        auto lock = lockExclusive();
+        return deleteRoomLocked(roomNumber);
+    }
+
+    bool updateRoomRate(int roomNumber, double newRate) {
+        HOTEL_PROFILE(UPDATE_RATE);
+        auto lock = lockExclusive();
+        return updateRoomRateLocked(roomNumber, newRate);
+    }
+
+    bool updateRoomBillingStrategy(int roomNumber, BillingStrategy strategy) {
+        HOTEL_PROFILE(UPDATE_BILLING);
+        auto lock = lockExclusive();
+        return updateRoomBillingStrategyLocked(roomNumber, strategy);
+    }
+
+    // Rate calendar of a room type: price factors of the base rate per season, weekday and night,
+    // and length-of-stay discounts. A change applies to every room of the type from the next bill
+    // on, and the booked stays it touches are repriced in the statistics.
+    bool setSeasonRate(Room::RoomType type, Date from, Date to, double factor) {
+        return changeRates(type, RateRule{ RateRule::Kind::SEASON, from.dayNumber(), to.dayNumber(), factor });
+    }
+
+    // Replaces the season and weekday factors of one night.
+    bool setNightRate(Room::RoomType type, Date night, double factor) {
+        return changeRates(type, RateRule{ RateRule::Kind::NIGHT, night.dayNumber(), night.dayNumber() + 1, factor });
+    }
+
+    // weekday: 0 = Monday.
+    bool setWeekdayRate(Room::RoomType type, int weekday, double factor) {
+        return changeRates(type, RateRule{ RateRule::Kind::WEEKDAY, weekday, weekday + 1, factor });
+    }
+
+    // Stays of at least minNights get percent off; percent 0 removes the tier.
+    bool setStayDiscount(Room::RoomType type, int minNights, double percent) {
+        return changeRates(type, RateRule{ RateRule::Kind::STAY_DISCOUNT, minNights, 0, percent });
+    }
+
+    bool clearRates(Room::RoomType type) {
+        return changeRates(type, RateRule{ RateRule::Kind::RESET, 0, 0, 0.0 });
+    }
+
+    // The bill for staying in a room, at its type's calendar prices; empty if there is no such room.
+    optional<double> quoteStay(int roomNumber, Date checkIn, Date checkOut) const {
+        HOTEL_PROFILE(QUOTE_STAY);
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        auto lock = lockMaterialized();
+        const Room* room = findRoom(roomNumber);
+        if (!room) return nullopt;
+        return quoteLocked(*room, checkIn, checkOut);
+    }
+    // Bills for a batch of reservations, in order; IDs that are unknown (or whose room was deleted) bill 0.
+    // Matches Room::calculateBill at the rate calendar's prices for every reservation found.
+    vector<double> computeBills(const vector<int>& reservationIDs) const {
+        HOTEL_PROFILE(COMPUTE_BILLS);
+        auto state = lockMaterialized();
+        vector<size_t> slots;
+        vector<double> nights;
+        vector<size_t> positions;
+        slots.reserve(reservationIDs.size());
+        nights.reserve(reservationIDs.size());
+        positions.reserve(reservationIDs.size());
+        HOTEL_SCANNED(reservationIDs.size());
+        {
+            lock_guard<mutex> lock(reservationMutex);
+            for (size_t i = 0; i < reservationIDs.size(); ++i) {
+                const Reservation* reservation = findReservation(reservationIDs[i]);
+                if (!reservation) continue;
+                auto room = roomIndex.find(reservation->getRoomNumber());
+                if (room == roomIndex.end()) continue;
+                slots.push_back(room->second);
+                nights.push_back(ratesFor(rooms[room->second].getType()).ratedNights(reservation->getCheckInDate(), reservation->getCheckOutDate()));
+                positions.push_back(i);
+            }
+        }
+
+        vector<double> found;
+        billingTable.computeBills(slots, nights, found);
+        if (found.size() == reservationIDs.size()) return found;
+
+        vector<double> bills(reservationIDs.size(), 0.0);
+        for (size_t i = 0; i < positions.size(); ++i) {
+            bills[positions[i]] = found[i];
+        }
+        return bills;
+    }
+
+   void showRoomPriceRates() const {
+    HOTEL_PROFILE(SHOW_RATES);
+    auto state = lockMaterialized();
+    HOTEL_SCANNED(rooms.size());
+    RowBuffer rows(output(), listingFormat);
+    rows.line("\n=============================== ROOM PRICE RATES =============================================\n");
+    appendRoomHeader(rows, false);
+    for (const auto& room : rooms) {
+        appendRoomRow(rows, room.getRoomNumber(), Room::typeLabel(room.getType()), room.getBaseRate(), nullptr,
+                      room.getBillingStrategyString(), room.getMaxGuests());
+    }
+    rows.line("================================================================================================\n");
+}
+    void showAvailableRooms() const {
+    HOTEL_PROFILE(SHOW_AVAILABLE);
+    auto state = lockMaterialized();
+    HOTEL_SCANNED(rooms.size());
+    RowBuffer rows(output(), listingFormat);
+    rows.line("\n==================================== AVAILABLE ROOMS =========================================\n");
+    appendRoomHeader(rows, false);
+    for (const auto& room : rooms) {
+        if (isRoomAvailableLocked(room)) {
+            appendRoomRow(rows, room.getRoomNumber(), Room::typeLabel(room.getType()), room.getBaseRate(), nullptr,
+                          room.getBillingStrategyString(), room.getMaxGuests());
+        }
+    }
+    rows.line("================================================================================================\n");
+}
+    // Rooms of the given type that fit the party and are free for the whole stay.
+    vector<int> findAvailableRooms(Date checkIn, Date checkOut, int guests, Room::RoomType type) const {
+        HOTEL_PROFILE(SEARCH_AVAILABLE);
+        auto state = lockMaterialized();
+        return findAvailableRoomsLocked(checkIn, checkOut, guests, type);
+    }
+
+    // One page of the rooms matching filter, starting after the cursor of the previous page.
+    RoomPage findRooms(const RoomFilter& filter, const optional<RoomCursor>& after = nullopt, size_t limit = 20) const {
+        HOTEL_PROFILE(FIND_ROOMS);
+        auto state = lockMaterialized();
+        return findRoomsLocked(filter, after, limit);
+    }
+
+    // The room of a type that fits the party and is free for the stay with the lowest bill at the
+    // calendar's prices, ties going to the lower number; empty if there is none. Every room of
+    // the type shares the calendar, so the rated nights are worked out once, and a room is only
+    // checked for the dates when its bill would beat the best so far.
+    optional<RoomOffer> cheapestAvailable(Room::RoomType type, Date checkIn, Date checkOut, int guests) const {
+        HOTEL_PROFILE(CHEAPEST_AVAILABLE);
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        auto state = lockMaterialized();
+        int wanted = static_cast<int>(type);
+        double rated = ratesFor(type).ratedNights(checkIn, checkOut);
+        optional<RoomOffer> best;
+        for (auto it = roomsByTypeRate.lower_bound(make_tuple(wanted, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+             it != roomsByTypeRate.end() && get<0>(*it) == wanted; ++it) {
+            HOTEL_SCANNED(1);
+            const Room& room = rooms[roomIndex.at(get<2>(*it))];
+            if (room.getMaxGuests() < guests) continue;
+            double bill = Room::billFor(room.getBillingStrategy(), room.getBaseRate(), rated);
+            if (best && make_pair(best->bill, best->roomNumber) < make_pair(bill, room.getRoomNumber())) continue;
+            lock_guard<mutex> roomGuard(roomLock(room.getRoomNumber()));
+            if (room.isAvailableFor(checkIn, checkOut)) best = RoomOffer{ room.getRoomNumber(), bill };
+        }
+        return best;
+    }
+
+    // One page of the reservations matching filter, starting after the cursor of the previous page.
+    ReservationPage findReservations(const ReservationFilter& filter, const optional<ReservationCursor>& after = nullopt, size_t limit = 20) const {
+        HOTEL_PROFILE(FIND_RESERVATIONS);
+        auto state = lockMaterialized();
+        return findReservationsLocked(filter, after, limit);
+    }
+
+    // Prints one page of findRooms and returns the cursor of the next page, if there may be one.
+    optional<RoomCursor> showRoomPage(const RoomFilter& filter, const optional<RoomCursor>& after, size_t limit) const {
+        auto state = lockMaterialized();
+        RoomPage page = findRoomsLocked(filter, after, limit);
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n======================================= MATCHING ROOMS =======================================\n");
+        appendRoomHeader(rows, false);
+        for (int roomNumber : page.roomNumbers) {
+            const Room* room = findRoom(roomNumber);
+            appendRoomRow(rows, room->getRoomNumber(), Room::typeLabel(room->getType()), room->getBaseRate(), nullptr,
+                          room->getBillingStrategyString(), room->getMaxGuests());
+        }
+        if (page.roomNumbers.empty()) rows.line("No more matching rooms.\n");
+        rows.line("================================================================================================\n");
+        return page.next;
+    }
+
+    // Prints one page of findReservations and returns the cursor of the next page, if there may be one.
+    optional<ReservationCursor> showReservationPage(const ReservationFilter& filter, const optional<ReservationCursor>& after, size_t limit) const {
+        ReservationPage page = findReservations(filter, after, limit);
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n=================================== MATCHING RESERVATIONS ====================================\n");
+        rows.line("ID      Guest Name            Room #    Check-in       Check-out      \n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("id,guest,room,check_in,check_out");
+        for (const Reservation& reservation : page.reservations) {
+            appendReservationRow(rows, reservation.getReservationID(), reservation.getGuestName(), reservation.getRoomNumber(),
+                                 reservation.getCheckInDate(), reservation.getCheckOutDate());
+        }
+        if (page.reservations.empty()) rows.line("No more matching reservations.\n");
+        rows.line("================================================================================================\n");
+        return page.next;
+    }
+
+    // Guests matching a name or contact fragment, by prefix or by trigram similarity.
+    vector<GuestMatch> findGuests(const string& query, size_t limit = 10) const {
+        HOTEL_PROFILE(FIND_GUESTS);
+        auto state = lockMaterialized();
+        return guestDirectory.search(query, limit);
+    }
+
+    void showGuests(const string& query, size_t limit = 10) const {
+        vector<GuestMatch> matches = findGuests(query, limit);
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n====================================== GUEST SEARCH ==========================================\n");
+        rows.line("Guest Name            Contact               Match   Reservations\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("guest,contact,match,reservations");
+        for (const GuestMatch& match : matches) {
+            string ids;
+            for (int id : match.reservationIDs) {
+                if (!ids.empty()) ids += ' ';
+                ids += to_string(id);
+            }
+            rows.cell("guest", match.guest->name, 22)
+                .cell("contact", match.guest->contact, 22)
+                .cell("match", static_cast<long long>(match.score * 100 + 0.5), 8)
+                .cell("reservations", ids, 0)
+                .endRow();
+        }
+        if (matches.empty()) rows.line("No matching guests.\n");
+        rows.line("================================================================================================\n");
+    }
+
+    // Offset the next change event will get.
+    uint64_t changeOffset() const { return changes.end(); }
+
+    // Up to limit change events from offset on, oldest first, for a subscriber that saves next
+    // and asks again. Recent events come from the ring; a subscriber that fell further behind,
+    // or resumes after a restart, gets them decoded again from the journal. Events from before
+    // the last checkpoint are only in the snapshot: the batch then starts at the oldest event
+    // still kept and sets gap, and the subscriber has to re-read the state it mirrors.
+    ChangeBatch changesSince(uint64_t offset, size_t limit) const {
+        HOTEL_PROFILE(CHANGES_SINCE);
+        ChangeBatch batch;
+        shared_lock<shared_mutex> state(stateMutex);   // keeps a checkpoint from truncating the journal
+        while (batch.events.size() < limit) {
+            size_t wanted = limit - batch.events.size();
+            uint64_t oldest = changes.oldest();
+            if (offset >= oldest) {
+                if (optional<uint64_t> after = changes.read(offset, wanted, batch.events)) {
+                    offset = *after;
+                    break;
+                }
+                continue;   // overwritten while reading; the journal has it
+            }
+            uint64_t from = max(offset, journalStart);
+            size_t found = 0;
+            if (journal && from < oldest) {
+                uint64_t at = from;
+                found = journal->readBack(static_cast<size_t>(from - journalStart), static_cast<size_t>(min<uint64_t>(wanted, oldest - from)),
+                    [&](HotelJournal::Op op, BinaryReader& record) {
+                        batch.events.push_back(ChangeEvent::fromRecord(op, record));
+                        batch.events.back().offset = at++;
+                    });
+            }
+            if (found == 0) from = oldest;   // not in the journal either: no journal, or its tail is torn
+            if (from != offset) batch.gap = true;
+            offset = from + found;
+        }
+        HOTEL_SCANNED(batch.events.size());
+        batch.next = offset;
+        return batch;
+    }
+
+    ChangeBatch showChanges(uint64_t offset, size_t limit) const {
+        static const char* const ruleNames[] = { "Season", "Night", "Weekday", "Stay discount", "Reset" };
+        ChangeBatch batch = changesSince(offset, limit);
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n======================================== CHANGES =============================================\n");
+        rows.line("Offset    Change          Room   Reservation  From        To          Guests  Rate        Detail\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("offset,change,room,reservation,from,to,guests,rate,detail");
+        if (batch.gap) rows.line("Earlier changes are only in the snapshot; re-read the hotel state.\n");
+        auto number = [&](const char* name, int32_t value, size_t width) {
+            if (value) rows.cell(name, value, width);
+            else rows.cell(name, "", width);
+        };
+        for (const ChangeEvent& event : batch.events) {
+            using Op = HotelJournal::Op;
+            bool stay = event.kind == Op::RESERVE || event.kind == Op::RESERVE_BLOCK || event.kind == Op::UPDATE_DATES ||
+                        event.kind == Op::WAITLIST || event.kind == Op::PROMOTE || (event.kind == Op::ARCHIVE && event.count > 0);
+            bool ruleDates = event.kind == Op::RATE_RULE && (event.ruleKind == static_cast<uint8_t>(RateRule::Kind::SEASON) ||
+                                                            event.ruleKind == static_cast<uint8_t>(RateRule::Kind::NIGHT));
+            string detail;
+            if (event.kind == Op::ADD_ROOM) {
+                detail = string(Room::typeLabel(static_cast<Room::RoomType>(event.roomType))) + " " +
+                         billingTypeName(billingStrategyFromIndex(event.billing));
+            } else if (event.kind == Op::UPDATE_BILLING) {
+                detail = billingTypeName(billingStrategyFromIndex(event.billing));
+            } else if (event.kind == Op::RESERVE_BLOCK) {
+                detail = to_string(event.count) + " rooms";
+            } else if (event.kind == Op::RATE_RULE) {
+                detail = string(Room::typeLabel(static_cast<Room::RoomType>(event.roomType))) + " " +
+                         ruleNames[min<size_t>(event.ruleKind, size(ruleNames) - 1)];
+                if (!ruleDates) detail += " " + to_string(event.from);
+            } else if (event.kind == Op::WAITLIST) {
+                detail = "waitlist #" + to_string(event.waitID) + " " + Room::typeLabel(static_cast<Room::RoomType>(event.roomType)) +
+                         " tier " + to_string(event.loyaltyTier) + (event.corporate ? " corporate" : "");
+            } else if (event.kind == Op::REASSIGN) {
+                detail = to_string(event.count) + (event.count == 1 ? " move" : " moves");
+            } else if (event.kind == Op::UNWAIT || event.kind == Op::PROMOTE) {
+                detail = "waitlist #" + to_string(event.waitID);
+            } else if (event.kind == Op::ARCHIVE) {
+                detail = to_string(event.count) + (event.count == 1 ? " stay checked out" : " stays archived");
+            }
+            rows.cell("offset", static_cast<long long>(event.offset), 10)
+                .cell("change", ChangeEvent::kindName(event.kind), 16);
+            number("room", event.roomNumber, 7);
+            number("reservation", event.reservationID, 13);
+            if (stay || ruleDates) rows.cell("from", Date(event.from), 12).cell("to", Date(event.to), 12);
+            else rows.cell("from", "", 12).cell("to", "", 12);
+            number("guests", event.guests, 8);
+            char rate[32] = "";
+            if (event.rate != 0.0) snprintf(rate, sizeof(rate), "%.2f", event.rate);
+            rows.cell("rate", rate, 12);
+            rows.cell("detail", detail, 0).endRow();
+        }
+        if (batch.events.empty()) rows.line("No new changes.\n");
+        rows.line("================================================================================================\n");
+        return batch;
+    }
+
+    // The rules that make up a room type's calendar; empty while it is flat.
+    vector<RateRule> rateRules(Room::RoomType type) const {
+        shared_lock<shared_mutex> state(stateMutex);
+        return ratesFor(type).rules();
+    }
+
+    void showRateRules(Room::RoomType type) const {
+        vector<RateRule> rules = rateRules(type);
+        RowBuffer rows(output(), listingFormat);
+        rows.line(string("\n================================ ") + Room::typeLabel(type) + " RATE CALENDAR ================================\n");
+        rows.line("Rule            From           To             Factor / Discount\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("rule,from,to,value");
+        for (const RateRule& rule : rules) {
+            char value[32];
+            bool discount = rule.kind == RateRule::Kind::STAY_DISCOUNT;
+            snprintf(value, sizeof(value), discount ? "%.2f%%" : "x%.2f", rule.value);
+            if (rule.kind == RateRule::Kind::SEASON) {
+                rows.cell("rule", "Season", 16).cell("from", Date(rule.from), 15).cell("to", Date(rule.to), 15);
+            } else if (rule.kind == RateRule::Kind::NIGHT) {
+                rows.cell("rule", "Night", 16).cell("from", Date(rule.from), 15).cell("to", Date(rule.to), 15);
+            } else if (rule.kind == RateRule::Kind::WEEKDAY) {
+                rows.cell("rule", "Weekday", 16).cell("from", RateCalendar::weekdayName(rule.from), 15).cell("to", "", 15);
+            } else {
+                rows.cell("rule", "Stay discount", 16).cell("from", to_string(rule.from) + "+ nights", 15).cell("to", "", 15);
+            }
+            rows.cell("value", value, 0).endRow();
+        }
+        if (rules.empty()) rows.line("Base rates on every night.\n");
+        rows.line("================================================================================================\n");
+    }
+
+    // Returns false if there is no such room.
+    bool showQuote(int roomNumber, Date checkIn, Date checkOut) const {
+        optional<double> total = quoteStay(roomNumber, checkIn, checkOut);
+        ostream& os = output();
+        if (!total) {
+            os << "Room not found.\n";
+            return false;
+        }
+        int nights = checkOut - checkIn;
+        os << "\n=============== STAY QUOTE ===============\n";
+        os << "Room: " << roomNumber << "\n";
+        os << "Check-in: " << checkIn << "\n";
+        os << "Check-out: " << checkOut << "\n";
+        os << "Nights: " << nights << "\n";
+        os << "Average per night: $" << fixed << setprecision(2) << *total / nights << "\n";
+        os << "Total Bill: $" << *total << "\n";
+        os << "==========================================\n";
+        return true;
+    }
+
+    // A copy of the running aggregates. The first call on a new day recounts which rooms are
+    // occupied tonight, one calendar lookup per room; every other call is a plain copy.
+    HotelStats stats() const {
+        HOTEL_PROFILE(STATS);
+        Date today = Date::today();
+        {
+            auto state = lockMaterialized();
+            lock_guard<mutex> lock(reservationMutex);
+            if (aggregates.day == today) return aggregates;
+        }
+        unique_lock<shared_mutex> exclusive(stateMutex);
+        const_cast<Hotel*>(this)->materializeLocked();
+        if (aggregates.day != today) {
+            aggregates.day = today;
+            for (HotelStats::TypeFigures& figures : aggregates.byType) figures.occupied = 0;
+            for (const Room& room : rooms) {
+                if (!room.isAvailableFor(today, today + 1)) ++aggregates.byType[static_cast<size_t>(room.getType())].occupied;
+            }
+        }
+        return aggregates;
+    }
+
+    QuoteCache::Counters quoteCacheCounters() const { return quotes.counters(); }
+
+    void showStats() const {
+        HotelStats figures = stats();
+        ostream& os = output();
+        os << "\n============== HOTEL STATISTICS ==============\n";
+        os << "Tonight (" << figures.day << "): " << figures.occupied() << " of " << figures.rooms() << " rooms occupied ("
+           << fixed << setprecision(1) << figures.occupancyPercent() << "%)\n";
+        os << "Live reservations: " << figures.reservations << "\n";
+        os << "\nType        Rooms   Occupied   Available\n";
+        for (size_t t = 0; t < figures.byType.size(); ++t) {
+            const HotelStats::TypeFigures& type = figures.byType[t];
+            os << left << setw(12) << Room::typeLabel(static_cast<Room::RoomType>(t)) << setw(8) << type.rooms
+               << setw(11) << type.occupied << type.rooms - type.occupied << "\n";
+        }
+        os << "\nBilling     Rooms   Nights     Projected Revenue\n";
+        for (size_t b = 0; b < figures.byBilling.size(); ++b) {
+            const HotelStats::BillingFigures& billing = figures.byBilling[b];
+            os << left << setw(12) << billingTypeName(billingStrategyFromIndex(b)) << setw(8) << billing.rooms
+               << setw(11) << billing.bookedNights << "$" << setprecision(2) << billing.projectedRevenue << "\n";
+        }
+        os << "Total projected revenue: $" << setprecision(2) << figures.projectedRevenue() << "\n";
+        QuoteCache::Counters cache = quoteCacheCounters();
+        uint64_t lookups = cache.hits + cache.misses;
+        os << "Quote cache: " << cache.hits << " hits, " << cache.misses << " misses ("
+           << setprecision(1) << (lookups ? 100.0 * static_cast<double>(cache.hits) / static_cast<double>(lookups) : 0.0)
+           << "% hits), " << cache.entries << " entries\n";
+        os << "==============================================\n";
+        os << right;
+    }
+
+    // Per-operation call counts, latencies and scanned elements since the program started.
+    void showMetrics() const {
+        ostream& os = output();
+        os << "\n=================================== OPERATION METRICS ====================================\n";
+#ifdef HOTEL_INSTRUMENTATION
+        HotelMetrics::instance().write(os);
+#else
+        os << "Instrumentation is not compiled in; build with -DHOTEL_INSTRUMENTATION.\n";
+#endif
+        os << "==========================================================================================\n";
+    }
+
+    // Writes the metrics table to path. Returns false if instrumentation is compiled out or the
+    // file cannot be written.
+    bool dumpMetrics(const string& path) const {
+#ifdef HOTEL_INSTRUMENTATION
+        ofstream file(path);
+        if (file) HotelMetrics::instance().write(file);
+        if (file) {
+            output() << "Metrics written to " << path << ".\n";
+            return true;
+        }
+        output() << "Could not write metrics to " << path << ".\n";
+#else
+        (void)path;
+        output() << "Instrumentation is not compiled in; build with -DHOTEL_INSTRUMENTATION.\n";
+#endif
+        return false;
+    }
+
+    void showAvailableRooms(Date checkIn, Date checkOut, int guests, Room::RoomType type) const {
+    auto state = lockMaterialized();
+    vector<int> available = findAvailableRoomsLocked(checkIn, checkOut, guests, type);
+    RowBuffer rows(output(), listingFormat);
+    rows.line("\n============================ AVAILABLE ROOMS " + checkIn.toString() + " - " + checkOut.toString() + " ============================\n");
+    appendRoomHeader(rows, false);
+    for (int roomNumber : available) {
+        const Room* room = findRoom(roomNumber);
+        appendRoomRow(rows, room->getRoomNumber(), Room::typeLabel(room->getType()), room->getBaseRate(), nullptr,
+                      room->getBillingStrategyString(), room->getMaxGuests());
+    }
+    if (available.empty()) {
+        rows.line("No matching rooms are free for those dates.\n");
+    }
+    rows.line("================================================================================================\n");
+}
+
+   void showAllRooms() const {
+    HOTEL_PROFILE(SHOW_ROOMS);
+    shared_lock<shared_mutex> state(stateMutex);
+    RowBuffer rows(output(), listingFormat);
+    rows.line("\n========================================= ALL ROOMS ==========================================\n");
+    appendRoomHeader(rows, true);
+    HOTEL_SCANNED(image ? image->roomCount() + image->reservationCount() : rooms.size());
+    if (image) {
+        Date today = Date::today();
+        unordered_set<int> occupied;
+        for (size_t i = 0; i < image->reservationCount(); ++i) {
+            const SnapshotReservationRecord& stay = image->reservation(i);
+            if (stay.checkIn <= today.dayNumber() && today.dayNumber() < stay.checkOut) occupied.insert(stay.roomNumber);
+        }
+        for (size_t i = 0; i < image->roomCount(); ++i) {
+            const SnapshotRoomRecord& record = image->room(i);
+            appendRoomRow(rows, record.roomNumber, Room::typeLabel(static_cast<Room::RoomType>(record.type)), record.baseRate,
+                          occupied.count(record.roomNumber) ? "Occupied" : "Available",
+                          billingTypeName(billingStrategyFromIndex(record.billing)), record.maxGuests);
+        }
+    } else {
+        for (const auto& room : rooms) {
+            appendRoomRow(rows, room.getRoomNumber(), Room::typeLabel(room.getType()), room.getBaseRate(),
+                          isRoomAvailableLocked(room) ? "Available" : "Occupied", room.getBillingStrategyString(), room.getMaxGuests());
+        }
+    }
+    rows.line("================================================================================================\n");
+}
+
+
+   int makeReservation(const string& guestName, const string& contactInfo, int roomNumber, Date checkIn, Date checkOut, int guests) {
+    HOTEL_PROFILE(MAKE_RESERVATION);
+    auto state = lockMaterialized();
+    Room* room = findRoom(roomNumber);
+    if (!room) {
+        output() << "Room not found.\n";
+        return 0;
+    }
+    if (guests > room->getMaxGuests()) {
+        output() << "Error: Room " << roomNumber << " can only accommodate " << room->getMaxGuests() << " guests.\n";
+        return 0;
+    }
+    if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+    int reservationID;
+    {
+        // Holding the room's stripe makes the availability check and the booking one step.
+        lock_guard<mutex> roomGuard(roomLock(roomNumber));
+        if (!room->isAvailableFor(checkIn, checkOut)) {
+            output() << "============================================\n";
+            output() << "Room not available for the selected dates.\n";
+            output() << "===========================================\n";
+            return 0;
+        }
+        reservationID = bookRoomLocked(*room, guestName, contactInfo, checkIn, checkOut, guests);
+    }
+    output() << "\n===========================================\n";
+    output() << "Reservation created successfully!\n";
+    output() << "=============================================\n";
+    return reservationID;
+}
+
+    // Books the best free room for the party: of the given type, or of any type if none is given,
+    // the smallest capacity that fits, then the lowest rate, then the lowest number. Candidates
+    // come off roomsByTypeFit already in that order, so the walk stops at the first room free for
+    // the stay. Returns the new reservation ID, or 0 if no room fits.
+    int autoAssignReservation(const string& guestName, const string& contactInfo, optional<Room::RoomType> type,
+                              Date checkIn, Date checkOut, int guests) {
+        HOTEL_PROFILE(AUTO_ASSIGN);
+        auto state = lockMaterialized();
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        using FitIterator = set<tuple<int, int, double, int>>::const_iterator;
+        vector<pair<FitIterator, FitIterator>> ranges;
+        int firstType = type ? static_cast<int>(*type) : static_cast<int>(Room::RoomType::SINGLE);
+        int lastType = type ? firstType : static_cast<int>(Room::TYPE_COUNT) - 1;
+        for (int t = firstType; t <= lastType; ++t) {
+            ranges.emplace_back(roomsByTypeFit.lower_bound(make_tuple(t, guests, -numeric_limits<double>::infinity(), numeric_limits<int>::min())),
+                                roomsByTypeFit.lower_bound(make_tuple(t + 1, numeric_limits<int>::min(), -numeric_limits<double>::infinity(), numeric_limits<int>::min())));
+        }
+        auto fit = [](const tuple<int, int, double, int>& key) { return make_tuple(get<1>(key), get<2>(key), get<3>(key)); };
+
+        while (true) {
+            pair<FitIterator, FitIterator>* best = nullptr;
+            for (auto& range : ranges) {
+                if (range.first != range.second && (!best || fit(*range.first) < fit(*best->first))) best = &range;
+            }
+            if (!best) break;
+            Room* room = findRoom(get<3>(*best->first));
+            ++best->first;
+            HOTEL_SCANNED(1);
+            lock_guard<mutex> roomGuard(roomLock(room->getRoomNumber()));
+            if (!room->isAvailableFor(checkIn, checkOut)) continue;
+            int reservationID = bookRoomLocked(*room, guestName, contactInfo, checkIn, checkOut, guests);
+            output() << "\n===========================================\n";
+            output() << "Reservation created successfully in room " << room->getRoomNumber() << "!\n";
+            output() << "=============================================\n";
+            return reservationID;
+        }
+        output() << "============================================\n";
+        output() << "No room for " << guests << (guests == 1 ? " guest" : " guests") << " is free for the selected dates.\n";
+        output() << "===========================================\n";
+        return 0;
+    }
+
+    // Books every listed room for the same stay and party size, or none of them: every room is
+    // checked with all of their stripes held before the first one is booked. Returns the new
+    // reservation IDs, or an empty list with the reason printed.
+    vector<int> reserveBlock(const string& guestName, const string& contactInfo, const vector<int>& roomNumbers,
+                             Date checkIn, Date checkOut, int guests) {
+        HOTEL_PROFILE(RESERVE_BLOCK);
+        auto state = lockMaterialized();
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        if (roomNumbers.empty()) throw invalid_argument("A block needs at least one room.");
+        auto stripes = lockRoomStripes(roomNumbers);
+        HOTEL_SCANNED(roomNumbers.size());
+        vector<Room*> block;
+        block.reserve(roomNumbers.size());
+        unordered_set<int> seen;
+        for (int number : roomNumbers) {
+            Room* room = findRoom(number);
+            string problem;
+            if (!room) problem = "Room " + to_string(number) + " not found.";
+            else if (!seen.insert(number).second) problem = "Room " + to_string(number) + " is listed twice.";
+            else if (guests > room->getMaxGuests()) problem = "Room " + to_string(number) + " can only accommodate " + to_string(room->getMaxGuests()) + " guests.";
+            else if (!room->isAvailableFor(checkIn, checkOut)) problem = "Room " + to_string(number) + " not available for the selected dates.";
+            if (!problem.empty()) {
+                rejectBlock(problem);
+                return {};
+            }
+            block.push_back(room);
+        }
+        vector<int> reservationIDs = bookBlockLocked(block, guestName, contactInfo, checkIn, checkOut, guests);
+        reportBlock(reservationIDs);
+        return reservationIDs;
+    }
+
+    // Books roomCount rooms of the type for the same stay, picked in autoAssignReservation's
+    // best-fit order from one walk of roomsByTypeFit, or none if fewer are free.
+    vector<int> reserveBlock(const string& guestName, const string& contactInfo, Room::RoomType type, int roomCount,
+                             Date checkIn, Date checkOut, int guests) {
+        HOTEL_PROFILE(RESERVE_BLOCK);
+        auto state = lockMaterialized();
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        if (roomCount < 1) throw invalid_argument("A block needs at least one room.");
+        int t = static_cast<int>(type);
+        auto first = roomsByTypeFit.lower_bound(make_tuple(t, guests, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        auto last = roomsByTypeFit.lower_bound(make_tuple(t + 1, numeric_limits<int>::min(), -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        vector<int> candidates;
+        for (auto it = first; it != last; ++it) candidates.push_back(get<3>(*it));
+        auto stripes = lockRoomStripes(candidates);
+        HOTEL_SCANNED(candidates.size());
+        vector<Room*> block;
+        block.reserve(static_cast<size_t>(roomCount));
+        for (size_t i = 0; i < candidates.size() && block.size() < static_cast<size_t>(roomCount); ++i) {
+            Room* room = findRoom(candidates[i]);
+            if (room->isAvailableFor(checkIn, checkOut)) block.push_back(room);
+        }
+        if (block.size() < static_cast<size_t>(roomCount)) {
+            rejectBlock("Only " + to_string(block.size()) + " " + Room::typeLabel(type) + " rooms for " + to_string(guests) +
+                        (guests == 1 ? " guest" : " guests") + " are free for the selected dates.");
+            return {};
+        }
+        vector<int> reservationIDs = bookBlockLocked(block, guestName, contactInfo, checkIn, checkOut, guests);
+        reportBlock(reservationIDs);
+        return reservationIDs;
+    }
+
+    // Queues a request for a room of the type when none is free for the stay. It is booked as soon
+    // as a cancellation or a change frees nights that fit it and no better-placed request takes
+    // them first. Returns the waitlist ID, or 0 with the reason printed.
+    int joinWaitlist(const string& guestName, const string& contactInfo, Room::RoomType type, Date checkIn, Date checkOut,
+                     int guests, int loyaltyTier = 0, bool corporate = false) {
+        HOTEL_PROFILE(JOIN_WAITLIST);
+        if (checkOut <= checkIn) throw invalid_argument("Invalid date range.");
+        if (guests < 1) throw invalid_argument("A stay needs at least one guest.");
+        if (loyaltyTier < 0 || loyaltyTier > WaitRequest::MAX_TIER) {
+            throw invalid_argument("Loyalty tier must be 0 to " + to_string(WaitRequest::MAX_TIER) + ".");
+        }
+        auto state = lockMaterialized();
+        int t = static_cast<int>(type);
+        auto first = roomsByTypeFit.lower_bound(make_tuple(t, guests, -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        auto last = roomsByTypeFit.lower_bound(make_tuple(t + 1, numeric_limits<int>::min(), -numeric_limits<double>::infinity(), numeric_limits<int>::min()));
+        string problem;
+        if (first == last) problem = string("No ") + Room::typeLabel(type) + " room takes " + to_string(guests) + (guests == 1 ? " guest." : " guests.");
+        lock_guard<mutex> waiting(waitlistMutex);
+        for (auto it = first; it != last && problem.empty(); ++it) {
+            HOTEL_SCANNED(1);
+            lock_guard<mutex> roomGuard(roomLock(get<3>(*it)));
+            if (findRoom(get<3>(*it))->isAvailableFor(checkIn, checkOut)) {
+                problem = "Room " + to_string(get<3>(*it)) + " is free for the selected dates; book it instead.";
+            }
+        }
+        if (!problem.empty()) {
+            output() << "============================================\n";
+            output() << problem << "\n";
+            output() << "===========================================\n";
+            return 0;
+        }
+
+        WaitRequest request;
+        request.waitID = waitlist.issue();
+        request.guestName = guestName;
+        request.contactInfo = contactInfo;
+        request.type = type;
+        request.checkIn = checkIn;
+        request.checkOut = checkOut;
+        request.guests = guests;
+        request.loyaltyTier = loyaltyTier;
+        request.corporate = corporate;
+        logMutation(HotelJournal::Op::WAITLIST, [&](BinaryWriter& writer) {
+            writer.put<int32_t>(request.waitID);
+            writer.put<uint8_t>(static_cast<uint8_t>(request.type));
+            writer.put<int32_t>(request.checkIn.dayNumber());
+            writer.put<int32_t>(request.checkOut.dayNumber());
+            writer.put<int32_t>(request.guests);
+            writer.put<uint8_t>(static_cast<uint8_t>(request.loyaltyTier));
+            writer.put<uint8_t>(request.corporate ? 1 : 0);
+            writer.putString(request.guestName);
+            writer.putString(request.contactInfo);
+        });
+        int waitID = request.waitID;
+        waitlist.add(move(request));
+        output() << "\n===========================================\n";
+        output() << "Added to the " << Room::typeLabel(type) << " waitlist as #" << waitID << "!\n";
+        output() << "=============================================\n";
+        return waitID;
+    }
+
+    bool leaveWaitlist(int waitID) {
+        HOTEL_PROFILE(LEAVE_WAITLIST);
+        auto state = lockMaterialized();
+        lock_guard<mutex> waiting(waitlistMutex);
+        if (!waitlist.remove(waitID)) {
+            output() << "Waitlist entry not found.\n";
+            return false;
+        }
+        logMutation(HotelJournal::Op::UNWAIT, [&](BinaryWriter& writer) { writer.put<int32_t>(waitID); });
+        output() << "Waitlist entry removed.\n";
+        return true;
+    }
+
+    vector<WaitRequest> waitingRequests() const {
+        shared_lock<shared_mutex> state(stateMutex);
+        lock_guard<mutex> waiting(waitlistMutex);
+        return waitlist.list();
+    }
+
+    void showWaitlist() const {
+        HOTEL_PROFILE(SHOW_WAITLIST);
+        vector<WaitRequest> waiting = waitingRequests();
+        HOTEL_SCANNED(waiting.size());
+        RowBuffer rows(output(), listingFormat);
+        rows.line("\n================================== WAITLIST ==================================================\n");
+        rows.line("Wait #  Type      Guest Name            Check-in       Check-out      Guests  Tier  Account\n");
+        rows.line("------------------------------------------------------------------------------------------------\n");
+        rows.header("wait_id,type,guest,check_in,check_out,guests,tier,account");
+        for (const WaitRequest& request : waiting) {
+            rows.cell("wait_id", request.waitID, 8)
+                .cell("type", Room::typeLabel(request.type), 10)
+                .cell("guest", request.guestName, 22)
+                .cell("check_in", request.checkIn, 15)
+                .cell("check_out", request.checkOut, 15)
+                .cell("guests", request.guests, 8)
+                .cell("tier", request.loyaltyTier, 6)
+                .cell("account", request.corporate ? "Corporate" : "Personal", 0);
+            rows.endRow();
+        }
+        rows.line("================================================================================================\n");
+    }
+
+    // Moves future stays between interchangeable rooms (same type, base rate and billing) to
+    // close short gaps in the calendar and to keep parties out of rooms larger than they need.
+    // Stays checking in during the horizon and after today may move unless they are locked.
+    // Room types are planned in parallel on copies of their calendars while bookings go on;
+    // a type's plan is then applied in one journaled step, or dropped if its stays changed in the
+    // meantime. A run plans only the types changed since the previous run with the same options.
+    AssignmentReport optimizeAssignments(const AssignmentOptions& options) {
+        HOTEL_PROFILE(OPTIMIZE_ASSIGNMENTS);
+        if (options.to <= options.from) throw invalid_argument("Invalid date range.");
+        if (options.shortGap < 1) throw invalid_argument("A gap is at least one night.");
+        const auto deadline = chrono::steady_clock::now() + options.budget;
+        lock_guard<mutex> run(optimizerMutex);
+        const int32_t from = max(options.from, Date::today() + 1).dayNumber();
+        const int32_t to = options.to.dayNumber();
+        OptimizerState& last = lastOptimization;
+
+        // Rooms and reservations touched since the last run, from the change feed.
+        const uint64_t startOffset = changeOffset();
+        bool everything = !last.ran || last.offset > startOffset || from != last.from || to != last.to ||
+                          options.shortGap != last.shortGap || options.locked != last.locked;
+        unordered_set<int> touchedRooms, touchedReservations;
+        array<bool, Room::TYPE_COUNT> dirty{};
+        for (uint64_t offset = last.offset; !everything && offset < startOffset;) {
+            ChangeBatch batch = changesSince(offset, static_cast<size_t>(min<uint64_t>(startOffset - offset, 4096)));
+            if (batch.gap || batch.events.empty()) everything = true;
+            for (const ChangeEvent& event : batch.events) {
+                using Op = HotelJournal::Op;
+                switch (event.kind) {
+                    case Op::ADD_ROOM: dirty[event.roomType] = true; break;
+                    case Op::DELETE_ROOM: case Op::UPDATE_ROOM: everything = true; break;
+                    case Op::UPDATE_RATE: case Op::UPDATE_BILLING: case Op::RESERVE: case Op::PROMOTE: touchedRooms.insert(event.roomNumber); break;
+                    case Op::RESERVE_BLOCK:
+                        for (int32_t i = 0; i < event.count; ++i) touchedReservations.insert(event.reservationID + i);
+                        break;
+                    case Op::CANCEL: case Op::UPDATE_GUESTS: case Op::UPDATE_DATES: touchedReservations.insert(event.reservationID); break;
+                    // Archived stays have ended, except an early check-out, which archives one stay.
+                    case Op::ARCHIVE: if (event.count == 1) dirty[event.roomType] = true; break;
+                    default: break;   // rate rules keep rooms of a type interchangeable; the waitlist books through PROMOTE
+                }
+            }
+            offset = batch.next;
+        }
+
+        AssignmentReport report;
+        array<optional<AssignmentPlanner>, Room::TYPE_COUNT> planners;
+        array<vector<int>, Room::TYPE_COUNT> typeRooms;
+        {
+            auto state = lockMaterialized();
+            everything = everything || stateEpoch != last.epoch;
+            if (everything) last.reservationTypes.clear();
+            {
+                lock_guard<mutex> lock(reservationMutex);
+                for (int number : touchedRooms) {
+                    if (const Room* room = findRoom(number)) dirty[static_cast<size_t>(room->getType())] = true;
+                }
+                for (int id : touchedReservations) {
+                    const Reservation* reservation = findReservation(id);
+                    const Room* room = reservation ? findRoom(reservation->getRoomNumber()) : nullptr;
+                    auto known = last.reservationTypes.find(id);
+                    if (room) dirty[static_cast<size_t>(room->getType())] = true;
+                    else if (known != last.reservationTypes.end()) dirty[known->second] = true;
+                    else everything = true;
+                }
+            }
+            for (size_t type = 0; type < Room::TYPE_COUNT; ++type) {
+                if (!everything && !dirty[type] && last.settled[type]) continue;
+                report.byType[type].status = AssignmentReport::Status::PLANNED;
+                planners[type] = collectAssignments(static_cast<Room::RoomType>(type), from, to, options, typeRooms[type], report.byType[type].movable);
+            }
+        }
+
+        array<AssignmentPlanner::Plan, Room::TYPE_COUNT> plans;
+        vector<size_t> pending;
+        for (size_t type = 0; type < Room::TYPE_COUNT; ++type) {
+            if (planners[type]) pending.push_back(type);
+        }
+        atomic<size_t> nextPlan{0};
+        auto planAll = [&] {
+            size_t i;
+            while ((i = nextPlan.fetch_add(1)) < pending.size()) plans[pending[i]] = planners[pending[i]]->plan(deadline);
+        };
+        size_t workerCount = min(max<size_t>(options.threads, 1), pending.size());
+        vector<thread> workers;
+        for (size_t i = 1; i < workerCount; ++i) workers.emplace_back(planAll);
+        planAll();
+        for (thread& worker : workers) worker.join();
+
+        vector<FreedStay> freed;
+        auto state = lockMaterialized();
+        for (size_t type : pending) {
+            AssignmentReport::TypeFigures& figures = report.byType[type];
+            const AssignmentPlanner::Plan& plan = plans[type];
+            figures.before = plan.before;
+            figures.after = plan.after;
+            bool applied = true;
+            if (!plan.moves.empty()) {
+                auto stripes = lockRoomStripes(typeRooms[type]);
+                applied = reassignLocked(plan.moves, &freed);
+            }
+            if (applied) figures.moved = static_cast<int>(plan.moves.size());
+            else figures.after = figures.before;
+            figures.status = !applied ? AssignmentReport::Status::STALE
+                           : plan.complete ? AssignmentReport::Status::PLANNED : AssignmentReport::Status::TIMED_OUT;
+            last.settled[type] = applied && plan.complete;
+        }
+        last.ran = true;
+        last.offset = startOffset;
+        last.epoch = stateEpoch;
+        last.from = from;
+        last.to = to;
+        last.shortGap = options.shortGap;
+        last.locked = options.locked;
+        for (const FreedStay& stay : freed) promoteWaiting(stay);
+        showAssignmentReport(report);
+        return report;
+    }
+
+    // Cancelling, and moving a reservation to other dates or another room, promote waiting
+    // requests into the nights given back.
+    bool cancelReservation(int reservationID) {
+        HOTEL_PROFILE(CANCEL_RESERVATION);
+        auto state = lockMaterialized();
+        FreedStay freed;
+        if (!cancelReservationLocked(reservationID, &freed)) return false;
+        promoteWaiting(freed);
+        return true;
+    }
+
+    // Checks a guest out: the stay is billed, moved to the stay archive and dropped from the live
+    // bookings. A stay still running ends today, or after its first night if that is tonight,
+    // and the nights it gives back go to the waitlist. A stay that has not begun cannot end.
+    bool checkOutReservation(int reservationID) {
+        HOTEL_PROFILE(CHECK_OUT);
+        auto state = lockMaterialized();
+        optional<FreedStay> freed;
+        bool checkedOut = withReservation(reservationID, [&](Reservation& reservation) {
+            const Date today = Date::today(), checkIn = reservation.getCheckInDate(), booked = reservation.getCheckOutDate();
+            if (today < checkIn) {
+                output() << "Reservation " << reservationID << " does not check in until " << checkIn << ".\n";
+                return false;
+            }
+            const Date leaving = min(booked, max(today, checkIn + 1));
+            optional<ArchivedStay> stay = archivedStayLocked(reservation, leaving);
+            if (!stay) {
+                output() << "Room " << reservation.getRoomNumber() << " no longer exists, so the stay cannot be billed.\n";
+                return false;
+            }
+            if (leaving < booked) freed = FreedStay{ stay->roomNumber, leaving, booked };
+            archiveStaysLocked({ *stay });
+            output() << "\n===========================================\n";
+            output() << "Reservation " << reservationID << " checked out after " << (leaving - checkIn)
+                     << ((leaving - checkIn) == 1 ? " night" : " nights") << ".\n";
+            output() << "Total Bill: $" << fixed << setprecision(2) << static_cast<double>(stay->billedCents) / 100.0 << "\n";
+            output() << "=============================================\n";
+            return true;
+        });
+        if (freed) promoteWaiting(*freed);
+        return checkedOut;
+    }
+
+    // Moves every stay that ended on or before through (today at the latest) to the stay archive
+    // in one journaled step. Stays whose room was deleted have no bill to record and stay live.
+    // Returns how many stays were archived.
+    size_t archiveCompletedStays(Date through) {
+        HOTEL_PROFILE(ARCHIVE_STAYS);
+        if (Date::today() < through) throw invalid_argument("Only stays that have ended can be archived.");
+        auto lock = lockExclusive();
+        lock_guard<mutex> guard(reservationMutex);
+        vector<ArchivedStay> stays;
+        for (auto it = reservationsByCheckIn.begin(); it != reservationsByCheckIn.end() && it->first < through.dayNumber(); ++it) {
+            HOTEL_SCANNED(1);
+            const Reservation& reservation = *findReservation(it->second);
+            if (through < reservation.getCheckOutDate()) continue;
+            if (optional<ArchivedStay> stay = archivedStayLocked(reservation, reservation.getCheckOutDate())) stays.push_back(*stay);
+        }
+        if (!stays.empty()) archiveStaysLocked(stays);
+        output() << "\n===========================================\n";
+        output() << stays.size() << (stays.size() == 1 ? " stay" : " stays") << " ended by " << through << " archived.\n";
+        output() << "=============================================\n";
+        return stays.size();
+    }
+
+    // Revenue, stay lengths and occupancy by month and room type for the nights [from, to), read
+    // from the stay archive alone, so bookings and live queries carry on meanwhile.
+    ArchiveSummary archiveSummary(Date from, Date to) const {
+        HOTEL_PROFILE(ARCHIVE_SUMMARY);
+        shared_lock<shared_mutex> lock(archiveMutex);
+        ArchiveSummary summary = archive.summarize(from, to);
+        HOTEL_SCANNED(summary.rowsRead);
+        return summary;
+    }
+
+    // The same over every night some archived stay covers, or just tonight while none is archived.
+    ArchiveSummary archiveSummary() const {
+        Date from = Date::today(), to = from + 1;
+        {
+            shared_lock<shared_mutex> lock(archiveMutex);
+            if (!archive.empty()) {
+                from = Date(archive.firstNight());
+                to = Date(archive.lastNight());
+            }
+        }
+        return archiveSummary(from, to);
+    }
+
+    void showArchiveReport(Date from, Date to) const { writeArchiveReport(archiveSummary(from, to)); }
+    void showArchiveReport() const { writeArchiveReport(archiveSummary()); }
+
+     void showAllReservations() const {
+    HOTEL_PROFILE(SHOW_RESERVATIONS);
+    shared_lock<shared_mutex> state(stateMutex);
+    RowBuffer rows(output(), listingFormat);
+    rows.line("\n============================= ALL RESERVATIONS ===============================================\n");
+    rows.line("ID      Guest Name            Room #    Check-in       Check-out      \n");
+    rows.line("------------------------------------------------------------------------------------------------\n");
+    rows.header("id,guest,room,check_in,check_out");
+    if (image) {
+        HOTEL_SCANNED(image->reservationCount());
+        for (size_t i = 0; i < image->reservationCount(); ++i) {
+            const SnapshotReservationRecord& record = image->reservation(i);
+            appendReservationRow(rows, record.reservationID, image->text(record.nameOffset, record.nameLength),
+                                 record.roomNumber, Date(record.checkIn), Date(record.checkOut));
+        }
+    } else {
+        // Copies the rows a chunk at a time, so a booking never waits on more than one chunk.
+        ListingScope listing(*this);
+        // Slots cancelled meanwhile stay linked until the listing ends; later bookings come after last.
+        vector<Reservation> chunk;
+        ReservationHandle next, last;
+        {
+            lock_guard<mutex> lock(reservationMutex);
+            next = reservations.front();
+            last = reservations.back();
+            HOTEL_SCANNED(reservations.size());
+        }
+        while (next != SlabPool<Reservation>::NONE) {
+            chunk.clear();
+            {
+                lock_guard<mutex> lock(reservationMutex);
+                for (size_t taken = 0; next != SlabPool<Reservation>::NONE && taken < LISTING_CHUNK; ++taken) {
+                    if (reservationLive[next]) chunk.push_back(reservations[next]);
+                    next = next == last ? SlabPool<Reservation>::NONE : reservations.after(next);
+                }
+            }
+            for (const Reservation& reservation : chunk) {
+                appendReservationRow(rows, reservation.getReservationID(), reservation.getGuestName(), reservation.getRoomNumber(),
+                                     reservation.getCheckInDate(), reservation.getCheckOutDate());
+            }
+        }
+    }
+    rows.line("================================================================================================\n");
+}
+
+    void viewReservationDetails(int reservationID) const {
+    HOTEL_PROFILE(VIEW_RESERVATION);
+    shared_lock<shared_mutex> state(stateMutex);
+    if (image) {
+        const SnapshotReservationRecord* record = image->findReservation(reservationID);
+        if (!record) {
+            output() << "Reservation not found.\n";
+            return;
+        }
+        double totalBill = 0.0;
+        if (const SnapshotRoomRecord* room = image->findRoom(record->roomNumber)) {
+            Date checkIn(record->checkIn), checkOut(record->checkOut);
+            totalBill = quotes.get(room->roomNumber, checkIn, checkOut, [&] {
+                return Room::billFor(billingStrategyFromIndex(room->billing), room->baseRate,
+                                     ratesFor(static_cast<Room::RoomType>(room->type)).ratedNights(checkIn, checkOut));
+            });
+        }
+        writeReservationDetails(record->reservationID, image->text(record->nameOffset, record->nameLength),
+                                image->text(record->contactOffset, record->contactLength), record->roomNumber,
+                                Date(record->checkIn), Date(record->checkOut), record->numberOfGuests, totalBill);
+        return;
+    }
+
+    optional<Reservation> found;
+    {
+        lock_guard<mutex> lock(reservationMutex);
+        if (const Reservation* stored = findReservation(reservationID)) found = *stored;
+    }
+    if (!found) {
+        output() << "Reservation not found.\n";
+        return;
+    }
+    const Reservation& reservation = *found;
+    double totalBill = 0.0;
+    if (const Room* room = findRoom(reservation.getRoomNumber())) {
+        totalBill = quoteLocked(*room, reservation.getCheckInDate(), reservation.getCheckOutDate());
+    }
+    writeReservationDetails(reservation.getReservationID(), reservation.getGuestName(), reservation.getContactInfo(),
+                            reservation.getRoomNumber(), reservation.getCheckInDate(), reservation.getCheckOutDate(),
+                            reservation.getNumberOfGuests(), totalBill);
+}
+
+    bool changeReservationGuests(int reservationID, int newGuests) {
+        HOTEL_PROFILE(CHANGE_GUESTS);
+        auto state = lockMaterialized();
+        return changeReservationGuestsLocked(reservationID, newGuests);
+    }
+
+    bool changeReservationRoom(int reservationID, int newRoomNumber) {
+        HOTEL_PROFILE(CHANGE_ROOM);
+        auto state = lockMaterialized();
+        FreedStay freed;
+        if (!changeReservationRoomLocked(reservationID, newRoomNumber, &freed)) return false;
+        promoteWaiting(freed);
+        return true;
+    }
+
+    bool changeReservationDates(int reservationID, Date newCheckIn, Date newCheckOut) {
+        HOTEL_PROFILE(CHANGE_DATES);
+        auto state = lockMaterialized();
+        FreedStay freed;
+        if (!changeReservationDatesLocked(reservationID, newCheckIn, newCheckOut, &freed)) return false;
+        promoteWaiting(freed);
+        return true;
+    }
+
+void updateReservation(int reservationID) {
+    optional<Reservation> reservation = getReservation(reservationID);
+    if (!reservation) {
+        output() << "Reservation not found.\n";
+        return;
+    }
+    cout << "\nUpdate Options:\n";
+    cout << "1. Change number of guests\n";
+    cout << "2. Change room\n";
+    cout << "3. Change dates\n";
+    cout << "4. Back\n";
+    int option;
+    option = getValidatedInt("Select update option (1-4): ");
+
+    switch (option) {
+        case 1: {
+            cout << "Current number of guests: " << reservation->getNumberOfGuests() << "\n";
+            int newGuests = getValidatedInt("Enter new number of guests: ");
+            changeReservationGuests(reservationID, newGuests);
+            break;
+        }
+        case 2: {
+            cout << "Current room: " << reservation->getRoomNumber() << "\n";
+            // Only rooms that can take this stay, a page at a time.
+            RoomFilter filter;
+            filter.minGuests = reservation->getNumberOfGuests();
+            filter.freeFrom = reservation->getCheckInDate();
+            filter.freeTo = reservation->getCheckOutDate();
+            optional<RoomCursor> next = showRoomPage(filter, nullopt, 10);
+            int newRoomNumber;
+            while (true) {
+                newRoomNumber = getValidatedInt(next ? "Enter new room number (0 for more rooms): " : "Enter new room number: ");
+                if (newRoomNumber != 0 || !next) break;
+                next = showRoomPage(filter, next, 10);
+            }
+            changeReservationRoom(reservationID, newRoomNumber);
+            break;
+        }
+        case 3: {
+            cout << "Current check-in date: " << reservation->getCheckInDate() << "\n";
+            cout << "Current check-out date: " << reservation->getCheckOutDate() << "\n";
+            Date newCheckIn = getValidatedDate("Enter new check-in date (DD/MM/YYYY): ");
+            Date newCheckOut = getValidatedDate("Enter new check-out date (DD/MM/YYYY): ");
+            changeReservationDates(reservationID, newCheckIn, newCheckOut);
+            break;
+        }
+        case 4:
+            return;
+        default:
+            cout << "Invalid option.\n";
+    }
+}
+
+    int getValidatedInt(const string& prompt) {
+    while (true) {
+        cout << prompt;
+        string input;
+        cin >> input; 
+
+        bool allDigits = true;
+        if (input.empty()) {
+            allDigits = false; 
+        } else {
+            for (char c : input) {
+                if (!isdigit(static_cast<unsigned char>(c))) {
+                    allDigits = false; 
+                    break;
+                }
+            }
+        }
+
+        if (!allDigits) {
+            cout << "\nInvalid input. Please enter numbers only.\n\n";
+            continue; 
+        }
+
+        int value = 0;
+        for (char c : input) {
+            value = value * 10 + (c - '0');
+        }
+
+        return value; 
+    }
+}
+
+    Date getValidatedDate(const string& prompt) {
+    while (true) {
+        cout << prompt;
+        string input;
+        cin >> input;
+        try {
+            return Date::parse(input);
+        } catch (const invalid_argument& e) {
+            cout << "\n" << e.what() << "\n\n";
+        }
+    }
+}
+
+};
+
+// Ties a Hotel to its snapshot and journal files: startup is snapshot load plus journal replay,
+// and a checkpoint writes a fresh snapshot and empties the journal.
+class HotelStore {
+private:
+    Hotel& hotel;
+    string snapshotPath;
+    string journalPath;
+    HotelJournal journal;
+
+public:
+    HotelStore(Hotel& target, const string& snapshotFile, const string& journalFile)
+        : hotel(target), snapshotPath(snapshotFile), journalPath(journalFile) {}
+
+    ~HotelStore() { hotel.attachJournal(nullptr); }
+
+    // Restores saved state and starts journaling. Returns true if anything was restored.
+    bool open() {
+        bool restored = false;
+        try {
+            restored = hotel.loadSnapshot(snapshotPath);
+        } catch (const exception& e) {
+            cerr << "Warning: " << e.what() << " Starting from the journal only.\n";
+        }
+        restored = hotel.replayJournal(journalPath) > 0 || restored;
+        if (!journal.open(journalPath)) {
+            cerr << "Warning: could not open journal " << journalPath << "; changes will not be saved.\n";
+        }
+        hotel.attachJournal(&journal);
+        return restored;
+    }
+
+    void flush() { journal.flush(); }
+
+    bool checkpoint() {
+        if (!hotel.checkpoint(snapshotPath)) {
+            cerr << "Warning: could not write snapshot " << snapshotPath << ".\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Many properties, one Hotel shard each. Every shard has its own thread, which runs all of that
+// shard's work in submission order, so properties never contend on one Hotel's locks and spread
+// across cores. Rooms are addressed by (property, room number), so two properties can both have
+// a room 101. Reservations are routed by ID: each shard issues IDs with its index in the top
+// bits (see ReservationIDs), so the IDs are unique chain-wide with no shared counter. Queries
+// over every property are scattered to all shards at once and the answers gathered.
+// Result messages printed on shard threads are discarded; callers get values back.
+class HotelChain {
+public:
+    struct Offer {
+        size_t property;
+        int roomNumber;
+        double bill;
+    };
+
+private:
+    class Shard {
+    private:
+        Hotel hotel;
+        mutex taskMutex;
+        condition_variable taskReady;
+        deque<function<void()>> tasks;
+        bool stopping = false;
+        thread worker;
+
+        void work() {
+            ostream discard(nullptr);
+            Hotel::setThreadOutput(&discard);
+            while (true) {
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(taskMutex);
+                    taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) return;
+                    task = move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    public:
+        const string name;
+
+        Shard(const string& propertyName, int index) : name(propertyName) {
+            hotel.setShard(index);
+            worker = thread([this] { work(); });
+        }
+
+        // Finishes the queued tasks first.
+        ~Shard() {
+            {
+                lock_guard<mutex> lock(taskMutex);
+                stopping = true;
+            }
+            taskReady.notify_one();
+            worker.join();
+        }
+
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
+
+        // Exceptions thrown by the task come out of the future's get().
+        template <typename Task>
+        future<invoke_result_t<Task&, Hotel&>> submit(Task task) {
+            using Result = invoke_result_t<Task&, Hotel&>;
+            auto job = make_shared<packaged_task<Result()>>([this, task = move(task)]() mutable { return task(hotel); });
+            future<Result> result = job->get_future();
+            {
+                lock_guard<mutex> lock(taskMutex);
+                tasks.emplace_back([job] { (*job)(); });
+            }
+            taskReady.notify_one();
+            return result;
+        }
+    };
+
+    vector<unique_ptr<Shard>> shards;
+
+    Shard& shard(size_t property) const {
+        if (property >= shards.size()) throw invalid_argument("Unknown property " + to_string(property) + ".");
+        return *shards[property];
+    }
+
+public:
+    explicit HotelChain(const vector<string>& propertyNames) {
+        if (propertyNames.empty() || propertyNames.size() > static_cast<size_t>(ReservationIDs::MAX_SHARDS)) {
+            throw invalid_argument("A chain has 1 to " + to_string(ReservationIDs::MAX_SHARDS) + " properties.");
+        }
+        for (const string& name : propertyNames) {
+            if (findProperty(name)) throw invalid_argument("Property '" + name + "' is listed twice.");
+            shards.push_back(make_unique<Shard>(name, static_cast<int>(shards.size())));
+        }
+    }
+
+    size_t propertyCount() const { return shards.size(); }
+    const string& propertyName(size_t property) const { return shard(property).name; }
+
+    optional<size_t> findProperty(const string& name) const {
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (shards[i]->name == name) return i;
+        }
+        return nullopt;
+    }
+
+    // The property whose shard issued the ID, if that shard exists.
+    optional<size_t> propertyOf(int reservationID) const {
+        if (reservationID <= 0) return nullopt;
+        size_t property = static_cast<size_t>(ReservationIDs::shardOf(reservationID));
+        if (property >= shards.size()) return nullopt;
+        return property;
+    }
+
+    // Runs task(Hotel&) on the property's shard thread.
+    template <typename Task>
+    auto onProperty(size_t property, Task task) { return shard(property).submit(move(task)); }
+
+    // Runs task(Hotel&) on every shard at once; the futures are in property order.
+    template <typename Task>
+    auto onEveryProperty(const Task& task) {
+        vector<future<invoke_result_t<Task&, Hotel&>>> results;
+        results.reserve(shards.size());
+        for (auto& each : shards) results.push_back(each->submit(task));
+        return results;
+    }
+
+    bool addRoom(size_t property, int roomNumber, Room::RoomType type, double rate, BillingStrategy billing, int maxGuests) {
+        return onProperty(property, [=](Hotel& hotel) { return hotel.addRoom(roomNumber, type, rate, billing, maxGuests); }).get();
+    }
+
+    // Returns the new chain-wide reservation ID, or 0 if the room could not be booked.
+    int makeReservation(size_t property, const string& guestName, const string& contactInfo, int roomNumber,
+                        Date checkIn, Date checkOut, int guests) {
+        return onProperty(property, [=](Hotel& hotel) {
+            return hotel.makeReservation(guestName, contactInfo, roomNumber, checkIn, checkOut, guests);
+        }).get();
+    }
+
+    bool cancelReservation(int reservationID) {
+        optional<size_t> property = propertyOf(reservationID);
+        return property && onProperty(*property, [=](Hotel& hotel) { return hotel.cancelReservation(reservationID); }).get();
+    }
+
+    optional<Reservation> getReservation(int reservationID) {
+        optional<size_t> property = propertyOf(reservationID);
+        if (!property) return nullopt;
+        return onProperty(*property, [=](Hotel& hotel) { return hotel.getReservation(reservationID); }).get();
+    }
+
+    // The cheapest free room of the type for the stay across every property (see
+    // Hotel::cheapestAvailable); ties go to the lower property index.
+    optional<Offer> cheapestAvailable(Room::RoomType type, Date checkIn, Date checkOut, int guests) {
+        auto answers = onEveryProperty([=](Hotel& hotel) { return hotel.cheapestAvailable(type, checkIn, checkOut, guests); });
+        optional<Offer> best;
+        for (size_t property = 0; property < answers.size(); ++property) {
+            optional<RoomOffer> offer = answers[property].get();
+            if (offer && (!best || offer->bill < best->bill)) best = Offer{ property, offer->roomNumber, offer->bill };
+        }
+        return best;
+    }
+
+    // Live reservations in the whole chain.
+    size_t reservationCount() {
+        size_t total = 0;
+        for (auto& answer : onEveryProperty([](Hotel& hotel) { return hotel.stats().reservations; })) total += answer.get();
+        return total;
+    }
+};
+
+// Books random one- to three-night stays from several threads into one Hotel and reports the
+// throughput for each thread count, while another thread keeps listing every reservation to
+// show that listings do not hold the bookings up.
+void runContentionBenchmark(int maxThreads, int roomCount, int bookingsPerThread) {
+    cout << "\n========== CONTENTION BENCHMARK ==========\n";
+    cout << roomCount << " rooms, " << bookingsPerThread << " booking attempts per thread\n";
+    cout << left << setw(10) << "Threads"
+         << right << setw(12) << "Booked"
+         << right << setw(12) << "Rejected"
+         << right << setw(12) << "Seconds"
+         << right << setw(16) << "Attempts/sec"
+         << right << setw(10) << "Speedup"
+         << right << setw(12) << "Listings" << "\n";
+    cout << "------------------------------------------------------------------------------------\n";
+    const Date firstNight = Date::parse("01/01/2030");
+    double baseline = 0.0;
+    for (int threads = 1; ; threads = min(threads * 2, maxThreads)) {
+        Hotel hotel;
+        for (int i = 0; i < roomCount; ++i) {
+            hotel.addRoom(1000 + i, Room::RoomType::DOUBLE, 100.00, RegularBilling{}, 2);
+        }
+        atomic<int> booked{0};
+        atomic<bool> done{false};
+        int listings = 0;
+        thread lister([&] {
+            ostream discard(nullptr);
+            Hotel::setThreadOutput(&discard);
+            while (!done.load()) {
+                hotel.showAllReservations();
+                ++listings;
+            }
+        });
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> desks;
+        for (int t = 0; t < threads; ++t) {
+            desks.emplace_back([&, t] {
+                ostream discard(nullptr);
+                Hotel::setThreadOutput(&discard);
+                mt19937 random(1234u + static_cast<unsigned>(t));
+                uniform_int_distribution<int> pickRoom(0, roomCount - 1), pickDay(0, 364), pickNights(1, 3);
+                int mine = 0;
+                for (int i = 0; i < bookingsPerThread; ++i) {
+                    Date checkIn = firstNight + pickDay(random);
+                    if (hotel.makeReservation("Guest", "555-0100", 1000 + pickRoom(random), checkIn, checkIn + pickNights(random), 1)) ++mine;
+                }
+                booked += mine;
+            });
+        }
+        for (thread& desk : desks) desk.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        done = true;
+        lister.join();
+
+        int attempts = threads * bookingsPerThread;
+        double rate = attempts / max(seconds, 1e-9);
+        if (threads == 1) baseline = rate;
+        cout << left << setw(10) << threads
+             << right << setw(12) << booked.load()
+             << right << setw(12) << attempts - booked.load()
+             << right << setw(12) << fixed << setprecision(3) << seconds
+             << right << setw(16) << setprecision(0) << rate
+             << right << setw(9) << setprecision(2) << rate / baseline << "x"
+             << right << setw(12) << listings << "\n";
+        if (threads == maxThreads) break;
+    }
+    cout << "====================================================================================\n";
+}
+
+// Books random stays into a HotelChain with one booking desk per property, so each shard thread
+// serves one desk, and then times cross-property cheapest-room queries, for each shard count.
+void runShardBenchmark(int maxShards, int roomsPerShard, int bookingsPerShard) {
+    cout << "\n========== SHARD BENCHMARK ==========\n";
+    cout << roomsPerShard << " rooms per property, " << bookingsPerShard << " booking attempts per property\n";
+    cout << left << setw(10) << "Shards"
+         << right << setw(12) << "Booked"
+         << right << setw(12) << "Seconds"
+         << right << setw(16) << "Attempts/sec"
+         << right << setw(10) << "Speedup"
+         << right << setw(16) << "Cheapest/sec" << "\n";
+    cout << "------------------------------------------------------------------------------\n";
+    const Date firstNight = Date::parse("01/01/2030");
+    double baseline = 0.0;
+    for (int shards = 1; ; shards = min(shards * 2, maxShards)) {
+        vector<string> names;
+        for (int i = 0; i < shards; ++i) names.push_back("Property " + to_string(i + 1));
+        HotelChain chain(names);
+        for (int i = 0; i < shards; ++i) {
+            chain.onProperty(static_cast<size_t>(i), [roomsPerShard, i](Hotel& hotel) {
+                for (int r = 0; r < roomsPerShard; ++r) {
+                    hotel.addRoom(1000 + r, Room::RoomType::DOUBLE, 90.0 + (r * 7 + i * 3) % 40, RegularBilling{}, 2);
+                }
+            }).get();
+        }
+
+        atomic<int> booked{0};
+        auto start = chrono::steady_clock::now();
+        vector<thread> desks;
+        for (int s = 0; s < shards; ++s) {
+            desks.emplace_back([&, s] {
+                mt19937 random(1234u + static_cast<unsigned>(s));
+                uniform_int_distribution<int> pickRoom(0, roomsPerShard - 1), pickDay(0, 364), pickNights(1, 3);
+                int mine = 0;
+                for (int i = 0; i < bookingsPerShard; ++i) {
+                    Date checkIn = firstNight + pickDay(random);
+                    if (chain.makeReservation(static_cast<size_t>(s), "Guest", "555-0100", 1000 + pickRoom(random),
+                                              checkIn, checkIn + pickNights(random), 1)) {
+                        ++mine;
+                    }
+                }
+                booked += mine;
+            });
+        }
+        for (thread& desk : desks) desk.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        const int queries = 200;
+        auto queryStart = chrono::steady_clock::now();
+        for (int q = 0; q < queries; ++q) {
+            Date checkIn = firstNight + (q * 37) % 365;
+            chain.cheapestAvailable(Room::RoomType::DOUBLE, checkIn, checkIn + 2, 2);
+        }
+        double querySeconds = chrono::duration<double>(chrono::steady_clock::now() - queryStart).count();
+
+        double rate = shards * bookingsPerShard / max(seconds, 1e-9);
+        if (shards == 1) baseline = rate;
+        cout << left << setw(10) << shards
+             << right << setw(12) << booked.load()
+             << right << setw(12) << fixed << setprecision(3) << seconds
+             << right << setw(16) << setprecision(0) << rate
+             << right << setw(9) << setprecision(2) << rate / baseline << "x"
+             << right << setw(16) << setprecision(0) << queries / max(querySeconds, 1e-9) << "\n";
+        if (shards == maxShards) break;
+    }
+    cout << "==============================================================================\n";
+}
+
+// Per-call latencies of one operation in a benchmark run.
+class LatencySamples {
+private:
+    vector<int64_t> nanoseconds;
+
+public:
+    explicit LatencySamples(size_t expected = 0) { nanoseconds.reserve(expected); }
+
+    template <typename Operation>
+    void time(Operation operation) {
+        auto start = chrono::steady_clock::now();
+        operation();
+        nanoseconds.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+
+    // One row of the benchmark table: calls, total seconds, calls per second, p50 and p99.
+    void report(const char* operation) {
+        if (nanoseconds.empty()) return;
+        double total = 0.0;
+        for (int64_t sample : nanoseconds) total += static_cast<double>(sample);
+        sort(nanoseconds.begin(), nanoseconds.end());
+        auto percentile = [&](double p) {
+            return nanoseconds[min(nanoseconds.size() - 1, static_cast<size_t>(p * static_cast<double>(nanoseconds.size())))] / 1000.0;
+        };
+        double seconds = total / 1e9;
+        cout << left << setw(24) << operation
+             << right << setw(10) << nanoseconds.size()
+             << right << setw(12) << fixed << setprecision(3) << seconds
+             << right << setw(14) << setprecision(0) << nanoseconds.size() / max(seconds, 1e-9)
+             << right << setw(12) << setprecision(2) << percentile(0.50)
+             << right << setw(12) << percentile(0.99) << "\n";
+    }
+};
+
+// Builds a synthetic hotel of roomCount rooms and about reservationCount stays and times the
+// hot paths one call at a time, reporting throughput and p50/p99 latency for each. Stays are
+// one to three nights spread over enough days that most booking attempts succeed. Hotel
+// messages and listings are discarded, so only the work of producing them is measured.
+void runBenchmark(int roomCount, int reservationCount) {
+    const size_t sampled = 100000;        // cap on the per-ID operations after the build
+    const int listingRuns = 5;
+    ostream discard(nullptr);
+    Hotel hotel(static_cast<size_t>(roomCount), static_cast<size_t>(reservationCount));
+    hotel.setOutput(discard);
+    mt19937 random(42);
+
+    cout << "\n================================== HOTEL BENCHMARK ===================================\n";
+    cout << roomCount << " rooms, " << reservationCount << " reservation attempts\n";
+    cout << left << setw(24) << "Operation"
+         << right << setw(10) << "Calls"
+         << right << setw(12) << "Seconds"
+         << right << setw(14) << "Calls/sec"
+         << right << setw(12) << "p50 (us)"
+         << right << setw(12) << "p99 (us)" << "\n";
+    cout << "--------------------------------------------------------------------------------------\n";
+
+    LatencySamples adds(static_cast<size_t>(roomCount));
+    vector<double> rates = { 75.00, 80.00, 100.00, 110.00, 150.00, 225.00, 250.00 };
+    for (int i = 0; i < roomCount; ++i) {
+        auto type = static_cast<Room::RoomType>(i % 4);
+        double rate = rates[static_cast<size_t>(i) % rates.size()];
+        BillingStrategy strategy = billingStrategyFromIndex(static_cast<size_t>(i / 4) % 3);
+        adds.time([&] { hotel.addRoom(100000 + i, type, rate, strategy, Room::defaultMaxGuests(type)); });
+    }
+    adds.report("addRoom");
+
+    const Date firstNight = Date::parse("01/01/2030");
+    int days = max(365, 4 * (reservationCount / roomCount + 1));
+    uniform_int_distribution<int> pickRoom(0, roomCount - 1), pickDay(0, days - 1), pickNights(1, 3);
+    int guestCount = max(1, reservationCount / 3);
+    vector<int> reservationIDs;
+    reservationIDs.reserve(static_cast<size_t>(reservationCount));
+    LatencySamples bookings(static_cast<size_t>(reservationCount));
+    for (int i = 0; i < reservationCount; ++i) {
+        string name = "Guest " + to_string(i % guestCount);
+        string contact = "555-" + to_string(i % guestCount);
+        int room = 100000 + pickRoom(random);
+        Date checkIn = firstNight + pickDay(random);
+        Date checkOut = checkIn + pickNights(random);
+        int id = 0;
+        bookings.time([&] { id = hotel.makeReservation(name, contact, room, checkIn, checkOut, 1); });
+        if (id) reservationIDs.push_back(id);
+    }
+    bookings.report("makeReservation");
+    if (reservationIDs.empty()) {
+        cout << "No reservations were booked.\n";
+        return;
+    }
+    uniform_int_distribution<size_t> pickReservation(0, reservationIDs.size() - 1);
+
+    size_t lookups = min(sampled, reservationIDs.size());
+    vector<int> viewed(lookups);
+    for (int& id : viewed) id = reservationIDs[pickReservation(random)];
+    LatencySamples views(lookups);
+    for (int id : viewed) views.time([&] { hotel.viewReservationDetails(id); });
+    views.report("viewReservationDetails");
+
+    // The same views again, every bill now in the quote cache.
+    LatencySamples repeatViews(lookups);
+    for (int id : viewed) repeatViews.time([&] { hotel.viewReservationDetails(id); });
+    repeatViews.report("viewReservationDetails again");
+
+    vector<const Room*> rooms;
+    for (const Room& room : hotel.getRooms()) rooms.push_back(&room);
+    LatencySamples bills(sampled);
+    volatile double billed = 0.0;
+    for (size_t i = 0; i < sampled; ++i) {
+        const Room& room = *rooms[static_cast<size_t>(pickRoom(random))];
+        int nights = pickNights(random);
+        bills.time([&] { billed = billed + room.calculateBill(nights); });
+    }
+    bills.report("Room::calculateBill");
+
+    const size_t batch = 1024;
+    LatencySamples batches(sampled / batch);
+    vector<int> batchIDs(batch);
+    for (size_t i = 0; i < sampled / batch; ++i) {
+        for (int& id : batchIDs) id = reservationIDs[pickReservation(random)];
+        batches.time([&] { billed = billed + hotel.computeBills(batchIDs).back(); });
+    }
+    batches.report("computeBills x1024");
+
+    LatencySamples allRooms, available, allReservations, priceRates;
+    for (int run = 0; run < listingRuns; ++run) {
+        allRooms.time([&] { hotel.showAllRooms(); });
+        available.time([&] { hotel.showAvailableRooms(); });
+        allReservations.time([&] { hotel.showAllReservations(); });
+        priceRates.time([&] { hotel.showRoomPriceRates(); });
+    }
+    allRooms.report("showAllRooms");
+    available.report("showAvailableRooms");
+    allReservations.report("showAllReservations");
+    priceRates.report("showRoomPriceRates");
+
+    shuffle(reservationIDs.begin(), reservationIDs.end(), random);
+    size_t cancels = min(sampled, reservationIDs.size());
+    LatencySamples cancellations(cancels);
+    for (size_t i = 0; i < cancels; ++i) {
+        int id = reservationIDs[i];
+        cancellations.time([&] { hotel.cancelReservation(id); });
+    }
+    cancellations.report("cancelReservation");
+    cout << "Booked " << reservationIDs.size() << " of " << reservationCount << " attempts.\n";
+    QuoteCache::Counters cache = hotel.quoteCacheCounters();
+    cout << "Quote cache: " << cache.hits << " hits, " << cache.misses << " misses.\n";
+    cout << "======================================================================================\n";
+#ifdef HOTEL_INSTRUMENTATION
+    hotel.setOutput(cout);
+    hotel.showMetrics();
+#endif
+}
+
+void seedDefaultRooms(Hotel& hotel) {
+    hotel.addRoom(101, Room::RoomType::SINGLE, 75.00, RegularBilling{}, 1);
+    hotel.addRoom(102, Room::RoomType::SINGLE, 75.00, RegularBilling{}, 1);
+    hotel.addRoom(103, Room::RoomType::SINGLE, 80.00, PremiumBilling{}, 1);
+    hotel.addRoom(201, Room::RoomType::DOUBLE, 100.00, RegularBilling{}, 2);
+    hotel.addRoom(202, Room::RoomType::DOUBLE, 100.00, RegularBilling{}, 2);
+    hotel.addRoom(203, Room::RoomType::DOUBLE, 110.00, PremiumBilling{}, 2);
+    hotel.addRoom(301, Room::RoomType::DELUXE, 150.00, PremiumBilling{}, 4);
+    hotel.addRoom(302, Room::RoomType::DELUXE, 150.00, PremiumBilling{}, 4);
+    hotel.addRoom(401, Room::RoomType::SUITE, 250.00, PremiumBilling{}, 6);
+    hotel.addRoom(402, Room::RoomType::SUITE, 225.00, CorporateBilling{}, 6);
+}
+
+// Runs a line-oriented command file against a Hotel with no prompts. One command per line,
+// fields separated by spaces; a field containing spaces is written in double quotes. Blank
+// lines and lines starting with # are skipped.
+//   ADD_ROOM number type rate billing [maxGuests]     type: SINGLE DOUBLE DELUXE SUITE
+//   DELETE_ROOM number                                billing: REGULAR PREMIUM CORPORATE
+//   UPDATE_RATE number rate
+//   UPDATE_BILLING number billing
+//   SET_SEASON type from to factor      price factor of the base rate for the nights [from, to)
+//   SET_NIGHT type date factor          replaces the season and weekday factors of one night
+//   SET_WEEKDAY type weekday factor     weekday: MON ... SUN or 1-7
+//   SET_STAY_DISCOUNT type minNights percent     percent 0 removes the tier
+//   CLEAR_RATES type | SHOW_RATE_CALENDAR type
+//   QUOTE room checkIn checkOut
+//   RESERVE "guest name" "contact" room checkIn checkOut guests   (dates as DD/MM/YYYY)
+//   ASSIGN "guest name" "contact" type|ANY checkIn checkOut guests   (picks the best free room)
+//   BLOCK_ROOMS "guest name" "contact" room,room,... checkIn checkOut guests   (all or none)
+//   BLOCK_TYPE "guest name" "contact" type count checkIn checkOut guests    (all or none)
+//   WAITLIST "guest name" "contact" type checkIn checkOut guests [tier [CORPORATE]]
+//     queues for a room of the type when none is free; tier 0-3, booked when nights are freed
+//   UNWAIT id | SHOW_WAITLIST
+//   CANCEL id
+//   CHECKOUT id              bills and archives a stay that has begun; one still running ends today
+//   ARCHIVE [date]           archives every stay that ended by the date (today by default)
+//   ARCHIVE_REPORT [from to] revenue, stay length and occupancy by month and type from the archive;
+//     every archived night by default
+//   UPDATE_GUESTS id guests
+//   UPDATE_ROOM id room
+//   UPDATE_DATES id checkIn checkOut
+//   VIEW id
+//   SEARCH checkIn checkOut guests type
+//   FIND_ROOMS [type=] [billing=] [min_rate=] [max_rate=] [guests=] [from= to=] [limit=] [after=]
+//   FIND_RESERVATIONS [guest=prefix] [from=] [to=] [limit=] [after=]
+//     one page of matches (20 by default); pass the printed after= cursor for the next page
+//   FIND_GUEST "name or contact" [limit]               prefix or close spelling, 10 by default
+//   OPTIMIZE [from=] [to=] [lock=id,id,...] [gap=nights] [budget=ms] [threads=]
+//     repacks stays checking in during [from, to) (tomorrow to 30 days on by default) among
+//     rooms of the same type and price to close gaps of up to gap nights (1); locked ones stay put
+//   CHANGES offset [limit]   change events from offset on (100 by default), then the offset to
+//     ask for next; offsets that skip past the requested one mean the changes between were checkpointed
+//   SHOW_ROOMS | SHOW_AVAILABLE | SHOW_RESERVATIONS | SHOW_RATES | STATS
+//   METRICS [file]          operation metrics (a -DHOTEL_INSTRUMENTATION build), or a dump to file
+// Hotel messages go to the output stream; problems with a line are reported on cerr with its
+// line number and counted as failures, and the run carries on with the next line.
+class BatchRunner {
+private:
+    friend class BulkImporter;              // shares the room type and billing name parsing
+
+    Hotel& hotel;
+    ostream& out;
+    bool fileAccess;                // false for network clients: no command writes files
+    size_t commands = 0;
+    size_t failures = 0;
+
+    // Splits on spaces outside double quotes; the quotes themselves are dropped, so both
+    // "Ann Lee" and guest="Ann Lee" are one field.
+    static vector<string> tokenize(const string& line) {
+        vector<string> fields;
+        size_t i = 0;
+        while (i < line.size()) {
+            if (isspace(static_cast<unsigned char>(line[i]))) { ++i; continue; }
+            string field;
+            bool quoted = false;
+            for (; i < line.size() && (quoted || !isspace(static_cast<unsigned char>(line[i]))); ++i) {
+                if (line[i] == '"') quoted = !quoted;
+                else field += line[i];
+            }
+            if (quoted) throw invalid_argument("Unterminated quoted field.");
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    // key=value fields after the command word; a key that is not in allowed is an error.
+    static map<string, string> options(const vector<string>& fields, initializer_list<const char*> allowed, const char* usage) {
+        map<string, string> values;
+        for (size_t i = 1; i < fields.size(); ++i) {
+            size_t equals = fields[i].find('=');
+            string key = equals == string::npos ? fields[i] : fields[i].substr(0, equals);
+            bool known = equals != string::npos && any_of(allowed.begin(), allowed.end(), [&](const char* name) { return key == name; });
+            if (!known) throw invalid_argument(string("Usage: ") + usage);
+            values[key] = fields[i].substr(equals + 1);
+        }
+        return values;
+    }
+
+    static size_t parseLimit(const map<string, string>& values) {
+        auto it = values.find("limit");
+        if (it == values.end()) return 20;
+        int limit = parseInt(it->second);
+        if (limit < 1) throw invalid_argument("limit must be at least 1.");
+        return static_cast<size_t>(limit);
+    }
+
+    static string upper(string text) {
+        for (char& c : text) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        return text;
+    }
+
+    static int parseInt(const string& field) {
+        size_t used = 0;
+        int value = 0;
+        try {
+            value = stoi(field, &used);
+        } catch (const exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != field.size()) throw invalid_argument("'" + field + "' is not a whole number.");
+        return value;
+    }
+
+    static uint64_t parseOffset(const string& field) {
+        size_t used = 0;
+        uint64_t value = 0;
+        try {
+            value = stoull(field, &used);
+        } catch (const exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != field.size() || field[0] == '-') throw invalid_argument("'" + field + "' is not an offset.");
+        return value;
+    }
+
+    static double parseRate(const string& field) {
+        size_t used = 0;
+        double value = 0.0;
+        try {
+            value = stod(field, &used);
+        } catch (const exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != field.size() || value <= 0) throw invalid_argument("'" + field + "' is not a positive rate.");
+        return value;
+    }
+
+    // Accepts the type keyword or its menu number (from 1).
+    static Room::RoomType parseRoomType(const string& field) {
+        string name = upper(field);
+        for (size_t i = 0; i < ROOM_TYPES.size(); ++i) {
+            if (name == ROOM_TYPES[i].keyword || name == to_string(i + 1)) return static_cast<Room::RoomType>(i);
+        }
+        throw invalid_argument("Unknown room type '" + field + "'.");
+    }
+
+    // Accepts the first three letters of the name or its number (1 = Monday); returns 0 for Monday.
+    static int parseWeekday(const string& field) {
+        static const char* const names[] = { "MON", "TUE", "WED", "THU", "FRI", "SAT", "SUN" };
+        string name = upper(field).substr(0, 3);
+        for (int i = 0; i < 7; ++i) {
+            if (name == names[i] || field == to_string(i + 1)) return i;
+        }
+        throw invalid_argument("Unknown weekday '" + field + "'.");
+    }
+
+    static double parsePercent(const string& field) {
+        size_t used = 0;
+        double value = -1.0;
+        try {
+            value = stod(field, &used);
+        } catch (const exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != field.size() || value < 0) throw invalid_argument("'" + field + "' is not a percentage.");
+        return value;
+    }
+
+    // Accepts the strategy keyword or its menu number (from 1).
+    static BillingStrategy parseBilling(const string& field) {
+        string name = upper(field);
+        for (size_t i = 0; i < BILLING_KINDS.size(); ++i) {
+            if (name == BILLING_KINDS[i].keyword || name == to_string(i + 1)) return BILLING_STRATEGIES[i];
+        }
+        throw invalid_argument("Unknown billing strategy '" + field + "'.");
+    }
+
+    bool reportBlock(const vector<int>& reservationIDs) {
+        if (reservationIDs.empty()) return false;
+        out << "Reservations #" << reservationIDs.front() << "-" << reservationIDs.back() << "\n";
+        return true;
+    }
+
+    static void expect(const vector<string>& fields, size_t minimum, size_t maximum, const char* usage) {
+        if (fields.size() < minimum || fields.size() > maximum) throw invalid_argument(string("Usage: ") + usage);
+    }
+
+    // Returns false when the Hotel rejected the command.
+    bool execute(const vector<string>& fields) {
+        const string command = upper(fields[0]);
+        if (command == "ADD_ROOM") {
+            expect(fields, 5, 6, "ADD_ROOM number type rate billing [maxGuests]");
+            Room::RoomType type = parseRoomType(fields[2]);
+            int guests = fields.size() == 6 ? parseInt(fields[5]) : Room::defaultMaxGuests(type);
+            return hotel.addRoom(parseInt(fields[1]), type, parseRate(fields[3]), parseBilling(fields[4]), guests);
+        }
+        if (command == "DELETE_ROOM") {
+            expect(fields, 2, 2, "DELETE_ROOM number");
+            return hotel.deleteRoom(parseInt(fields[1]));
+        }
+        if (command == "UPDATE_RATE") {
+            expect(fields, 3, 3, "UPDATE_RATE number rate");
+            return hotel.updateRoomRate(parseInt(fields[1]), parseRate(fields[2]));
+        }
+        if (command == "UPDATE_BILLING") {
+            expect(fields, 3, 3, "UPDATE_BILLING number billing");
+            return hotel.updateRoomBillingStrategy(parseInt(fields[1]), parseBilling(fields[2]));
+        }
+        if (command == "SET_SEASON") {
+            expect(fields, 5, 5, "SET_SEASON type from to factor");
+            return hotel.setSeasonRate(parseRoomType(fields[1]), Date::parse(fields[2]), Date::parse(fields[3]), parseRate(fields[4]));
+        }
+        if (command == "SET_NIGHT") {
+            expect(fields, 4, 4, "SET_NIGHT type date factor");
+            return hotel.setNightRate(parseRoomType(fields[1]), Date::parse(fields[2]), parseRate(fields[3]));
+        }
+        if (command == "SET_WEEKDAY") {
+            expect(fields, 4, 4, "SET_WEEKDAY type weekday factor");
+            return hotel.setWeekdayRate(parseRoomType(fields[1]), parseWeekday(fields[2]), parseRate(fields[3]));
+        }
+        if (command == "SET_STAY_DISCOUNT") {
+            expect(fields, 4, 4, "SET_STAY_DISCOUNT type minNights percent");
+            return hotel.setStayDiscount(parseRoomType(fields[1]), parseInt(fields[2]), parsePercent(fields[3]));
+        }
+        if (command == "CLEAR_RATES") {
+            expect(fields, 2, 2, "CLEAR_RATES type");
+            return hotel.clearRates(parseRoomType(fields[1]));
+        }
+        if (command == "SHOW_RATE_CALENDAR") {
+            expect(fields, 2, 2, "SHOW_RATE_CALENDAR type");
+            hotel.showRateRules(parseRoomType(fields[1]));
+            return true;
+        }
+        if (command == "QUOTE") {
+            expect(fields, 4, 4, "QUOTE room checkIn checkOut");
+            return hotel.showQuote(parseInt(fields[1]), Date::parse(fields[2]), Date::parse(fields[3]));
+        }
+        if (command == "RESERVE") {
+            expect(fields, 7, 7, "RESERVE \"guest name\" \"contact\" room checkIn checkOut guests");
+            int id = hotel.makeReservation(fields[1], fields[2], parseInt(fields[3]), Date::parse(fields[4]),
+                                           Date::parse(fields[5]), parseInt(fields[6]));
+            if (id != 0) out << "Reservation #" << id << "\n";
+            return id != 0;
+        }
+        if (command == "ASSIGN") {
+            expect(fields, 7, 7, "ASSIGN \"guest name\" \"contact\" type|ANY checkIn checkOut guests");
+            optional<Room::RoomType> type;
+            if (upper(fields[3]) != "ANY") type = parseRoomType(fields[3]);
+            int id = hotel.autoAssignReservation(fields[1], fields[2], type, Date::parse(fields[4]),
+                                                 Date::parse(fields[5]), parseInt(fields[6]));
+            if (id != 0) out << "Reservation #" << id << "\n";
+            return id != 0;
+        }
+        if (command == "BLOCK_ROOMS") {
+            expect(fields, 7, 7, "BLOCK_ROOMS \"guest name\" \"contact\" room,room,... checkIn checkOut guests");
+            vector<int> roomNumbers;
+            size_t start = 0;
+            while (start <= fields[3].size()) {
+                size_t comma = min(fields[3].find(',', start), fields[3].size());
+                roomNumbers.push_back(parseInt(fields[3].substr(start, comma - start)));
+                start = comma + 1;
+            }
+            return reportBlock(hotel.reserveBlock(fields[1], fields[2], roomNumbers, Date::parse(fields[4]),
+                                                  Date::parse(fields[5]), parseInt(fields[6])));
+        }
+        if (command == "BLOCK_TYPE") {
+            expect(fields, 8, 8, "BLOCK_TYPE \"guest name\" \"contact\" type count checkIn checkOut guests");
+            return reportBlock(hotel.reserveBlock(fields[1], fields[2], parseRoomType(fields[3]), parseInt(fields[4]),
+                                                  Date::parse(fields[5]), Date::parse(fields[6]), parseInt(fields[7])));
+        }
+        if (command == "WAITLIST") {
+            expect(fields, 7, 9, "WAITLIST \"guest name\" \"contact\" type checkIn checkOut guests [tier [CORPORATE]]");
+            int tier = fields.size() >= 8 ? parseInt(fields[7]) : 0;
+            if (fields.size() == 9 && upper(fields[8]) != "CORPORATE") throw invalid_argument("Expected CORPORATE, got '" + fields[8] + "'.");
+            int id = hotel.joinWaitlist(fields[1], fields[2], parseRoomType(fields[3]), Date::parse(fields[4]),
+                                        Date::parse(fields[5]), parseInt(fields[6]), tier, fields.size() == 9);
+            if (id != 0) out << "Waitlist #" << id << "\n";
+            return id != 0;
+        }
+        if (command == "UNWAIT") {
+            expect(fields, 2, 2, "UNWAIT id");
+            return hotel.leaveWaitlist(parseInt(fields[1]));
+        }
+        if (command == "CANCEL") {
+            expect(fields, 2, 2, "CANCEL id");
+            return hotel.cancelReservation(parseInt(fields[1]));
+        }
+        if (command == "CHECKOUT") {
+            expect(fields, 2, 2, "CHECKOUT id");
+            return hotel.checkOutReservation(parseInt(fields[1]));
+        }
+        if (command == "ARCHIVE") {
+            expect(fields, 1, 2, "ARCHIVE [date]");
+            hotel.archiveCompletedStays(fields.size() == 2 ? Date::parse(fields[1]) : Date::today());
+            return true;
+        }
+        if (command == "ARCHIVE_REPORT") {
+            if (fields.size() != 1 && fields.size() != 3) throw invalid_argument("Usage: ARCHIVE_REPORT [from to]");
+            if (fields.size() == 3) hotel.showArchiveReport(Date::parse(fields[1]), Date::parse(fields[2]));
+            else hotel.showArchiveReport();
+            return true;
+        }
+        if (command == "UPDATE_GUESTS") {
+            expect(fields, 3, 3, "UPDATE_GUESTS id guests");
+            return hotel.changeReservationGuests(parseInt(fields[1]), parseInt(fields[2]));
+        }
+        if (command == "UPDATE_ROOM") {
+            expect(fields, 3, 3, "UPDATE_ROOM id room");
+            return hotel.changeReservationRoom(parseInt(fields[1]), parseInt(fields[2]));
+        }
+        if (command == "UPDATE_DATES") {
+            expect(fields, 4, 4, "UPDATE_DATES id checkIn checkOut");
+            return hotel.changeReservationDates(parseInt(fields[1]), Date::parse(fields[2]), Date::parse(fields[3]));
+        }
+        if (command == "VIEW") {
+            expect(fields, 2, 2, "VIEW id");
+            hotel.viewReservationDetails(parseInt(fields[1]));
+            return true;
+        }
+        if (command == "SEARCH") {
+            expect(fields, 5, 5, "SEARCH checkIn checkOut guests type");
+            hotel.showAvailableRooms(Date::parse(fields[1]), Date::parse(fields[2]), parseInt(fields[3]), parseRoomType(fields[4]));
+            return true;
+        }
+        if (command == "FIND_ROOMS") {
+            const char* usage = "FIND_ROOMS [type=] [billing=] [min_rate=] [max_rate=] [guests=] [from= to=] [limit=] [after=]";
+            map<string, string> values = options(fields, { "type", "billing", "min_rate", "max_rate", "guests", "from", "to", "limit", "after" }, usage);
+            RoomFilter filter;
+            optional<RoomCursor> after;
+            for (const auto& [key, value] : values) {
+                if (key == "type") filter.type = parseRoomType(value);
+                else if (key == "billing") filter.billing = parseBilling(value).index();
+                else if (key == "min_rate") filter.minRate = parseRate(value);
+                else if (key == "max_rate") filter.maxRate = parseRate(value);
+                else if (key == "guests") filter.minGuests = parseInt(value);
+                else if (key == "from") filter.freeFrom = Date::parse(value);
+                else if (key == "to") filter.freeTo = Date::parse(value);
+                else if (key == "after") after = RoomCursor::parse(value);
+            }
+            if (optional<RoomCursor> next = hotel.showRoomPage(filter, after, parseLimit(values))) {
+                out << "Next page: after=" << next->toString() << "\n";
+            }
+            return true;
+        }
+        if (command == "FIND_RESERVATIONS") {
+            const char* usage = "FIND_RESERVATIONS [guest=prefix] [from=] [to=] [limit=] [after=]";
+            map<string, string> values = options(fields, { "guest", "from", "to", "limit", "after" }, usage);
+            ReservationFilter filter;
+            optional<ReservationCursor> after;
+            for (const auto& [key, value] : values) {
+                if (key == "guest") filter.guestPrefix = value;
+                else if (key == "from") filter.from = Date::parse(value);
+                else if (key == "to") filter.to = Date::parse(value);
+                else if (key == "after") after = ReservationCursor::parse(value);
+            }
+            if (optional<ReservationCursor> next = hotel.showReservationPage(filter, after, parseLimit(values))) {
+                out << "Next page: after=\"" << next->toString() << "\"\n";
+            }
+            return true;
+        }
+        if (command == "METRICS") {
+            expect(fields, 1, 2, "METRICS [file]");
+            if (fields.size() == 2) {
+                if (!fileAccess) throw invalid_argument("METRICS cannot write files here.");
+                return hotel.dumpMetrics(fields[1]);
+            }
+            hotel.showMetrics();
+            return true;
+        }
+        if (command == "FIND_GUEST") {
+            expect(fields, 2, 3, "FIND_GUEST \"name or contact\" [limit]");
+            int limit = fields.size() == 3 ? parseInt(fields[2]) : 10;
+            if (limit < 1) throw invalid_argument("limit must be at least 1.");
+            hotel.showGuests(fields[1], static_cast<size_t>(limit));
+            return true;
+        }
+        if (command == "OPTIMIZE") {
+            const char* usage = "OPTIMIZE [from=] [to=] [lock=id,id,...] [gap=nights] [budget=ms] [threads=]";
+            map<string, string> values = options(fields, { "from", "to", "lock", "gap", "budget", "threads" }, usage);
+            AssignmentOptions settings;
+            for (const auto& [key, value] : values) {
+                if (key == "from") settings.from = Date::parse(value);
+                else if (key == "to") settings.to = Date::parse(value);
+                else if (key == "gap") settings.shortGap = parseInt(value);
+                else if (key == "budget") settings.budget = chrono::milliseconds(max(parseInt(value), 0));
+                else if (key == "threads") settings.threads = static_cast<size_t>(max(parseInt(value), 1));
+                else if (key == "lock") {
+                    size_t start = 0;
+                    while (start <= value.size()) {
+                        size_t comma = min(value.find(',', start), value.size());
+                        settings.locked.insert(parseInt(value.substr(start, comma - start)));
+                        start = comma + 1;
+                    }
+                }
+            }
+            if (!values.count("to")) settings.to = settings.from + 30;
+            AssignmentReport report = hotel.optimizeAssignments(settings);
+            out << "Moved " << report.moved() << (report.moved() == 1 ? " reservation\n" : " reservations\n");
+            return true;
+        }
+        if (command == "CHANGES") {
+            expect(fields, 2, 3, "CHANGES offset [limit]");
+            int limit = fields.size() == 3 ? parseInt(fields[2]) : 100;
+            if (limit < 1) throw invalid_argument("limit must be at least 1.");
+            ChangeBatch batch = hotel.showChanges(parseOffset(fields[1]), static_cast<size_t>(limit));
+            out << "Next offset: " << batch.next << "\n";
+            return true;
+        }
+        if (command == "SHOW_ROOMS" || command == "SHOW_AVAILABLE" || command == "SHOW_RESERVATIONS" || command == "SHOW_RATES" ||
+            command == "SHOW_WAITLIST" || command == "STATS") {
+            expect(fields, 1, 1, command.c_str());
+            if (command == "STATS") {
+                hotel.showStats();
+                hotel.showMetrics();
+            }
+            else if (command == "SHOW_ROOMS") hotel.showAllRooms();
+            else if (command == "SHOW_AVAILABLE") hotel.showAvailableRooms();
+            else if (command == "SHOW_RESERVATIONS") hotel.showAllReservations();
+            else if (command == "SHOW_WAITLIST") hotel.showWaitlist();
+            else hotel.showRoomPriceRates();
+            return true;
+        }
+        throw invalid_argument("Unknown command '" + fields[0] + "'.");
+    }
+
+public:
+    enum class Outcome { SKIPPED, DONE, FAILED };
+
+    BatchRunner(Hotel& target, ostream& output, bool allowFiles = true)
+        : hotel(target), out(output), fileAccess(allowFiles) {}
+
+    // Runs one command line. A problem with the line itself is described in error; a command
+    // the Hotel rejected has already said why in the Hotel's output.
+    Outcome runLine(const string& line, string& error) {
+        vector<string> fields;
+        try {
+            fields = tokenize(line);
+            if (fields.empty() || fields[0][0] == '#') return Outcome::SKIPPED;
+            ++commands;
+            if (execute(fields)) return Outcome::DONE;
+        } catch (const exception& e) {
+            if (fields.empty()) ++commands;
+            error = e.what();
+        }
+        ++failures;
+        return Outcome::FAILED;
+    }
+
+    void run(istream& input) {
+        string line, error;
+        size_t lineNumber = 0;
+        while (getline(input, line)) {
+            ++lineNumber;
+            error.clear();
+            if (runLine(line, error) == Outcome::FAILED && !error.empty()) {
+                cerr << "line " << lineNumber << ": " << error << "\n";
+            }
+        }
+    }
+
+    size_t commandCount() const { return commands; }
+    size_t failureCount() const { return failures; }
+};
+
+// --batch file [--memory] [--format text|csv|json]: runs the command file ("-" for stdin) against
+// the saved hotel, or against an empty in-memory one with --memory, with listings in the given
+// format. Returns non-zero if any command failed.
+int runBatch(const string& path, bool inMemory, ListingFormat format) {
+    ifstream file;
+    istream* input = &cin;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            cerr << "Could not open batch file " << path << ".\n";
+            return 1;
+        }
+        input = &file;
+    }
+
+    // Sync with C stdio off gives cout its own large buffer; output is flushed once at the end.
+    ios::sync_with_stdio(false);
+    Hotel hotel;
+    hotel.setListingFormat(format);
+    BatchRunner runner(hotel, cout);
+    auto start = chrono::steady_clock::now();
+    if (inMemory) {
+        runner.run(*input);
+    } else {
+        HotelStore store(hotel, "hotel.snapshot", "hotel.journal");
+        if (!store.open()) seedDefaultRooms(hotel);
+        runner.run(*input);
+        store.checkpoint();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout.flush();
+    cerr << runner.commandCount() << " commands, " << runner.failureCount() << " failed, "
+         << fixed << setprecision(3) << seconds << " s\n";
+    return runner.failureCount() == 0 ? 0 : 2;
+}
+
+// --import: loads rooms and historical reservations in bulk from CSV or TSV files.
+//   rooms:         number,type,rate,billing[,maxGuests]          (names or menu numbers, as in batch files)
+//   reservations:  guest,contact,room,checkIn,checkOut,guests    (dates as DD/MM/YYYY)
+// The separator is a tab if the file's first line has one and a comma otherwise; a first line
+// that is not a valid row and starts with "number" or "guest" is a header. A field may be double-quoted, with "" for a
+// quote inside it, but cannot contain a line break. The file is read in blocks; each block is
+// cut at line breaks into one chunk per thread and the chunks are parsed in parallel. Only the
+// parsed rows are kept, and they go to the Hotel in one bulk call at the end of the file, so
+// its indexes are built once; the Hotel checks capacity and room calendars in file order.
+// Rejected rows are reported by line number with the reason.
+class BulkImporter {
+public:
+    static constexpr size_t BLOCK_SIZE = 16 << 20;
+
+    struct Result {
+        size_t rows = 0;
+        size_t added = 0;
+        vector<ImportRejection> rejected;       // by line
+    };
+
+private:
+    template <typename Row>
+    struct Chunk {
+        string_view text;
+        vector<Row> rows;
+        vector<ImportRejection> rejected;
+        size_t lines = 0;
+    };
+
+    Hotel& hotel;
+    size_t threadCount;
+
+    // Splits a line at the separator. Quoted fields are unquoted in place when they hold no
+    // doubled quote and copied into unquoted otherwise. Returns false for an unterminated quote.
+    static bool splitFields(string_view line, char separator, vector<string_view>& fields, deque<string>& unquoted) {
+        fields.clear();
+        unquoted.clear();
+        size_t i = 0;
+        while (true) {
+            if (i < line.size() && line[i] == '"') {
+                size_t start = ++i;
+                bool doubled = false;
+                while (true) {
+                    size_t close = line.find('"', i);
+                    if (close == string_view::npos) return false;
+                    if (close + 1 < line.size() && line[close + 1] == '"') {
+                        doubled = true;
+                        i = close + 2;
+                        continue;
+                    }
+                    i = close + 1;
+                    break;
+                }
+                string_view field = line.substr(start, i - 1 - start);
+                if (doubled) {
+                    string& copy = unquoted.emplace_back();
+                    for (size_t c = 0; c < field.size(); ++c) {
+                        copy += field[c];
+                        if (field[c] == '"') ++c;
+                    }
+                    field = copy;
+                }
+                fields.push_back(field);
+                if (i < line.size() && line[i] != separator) return false;
+            } else {
+                size_t end = line.find(separator, i);
+                fields.push_back(line.substr(i, end == string_view::npos ? string_view::npos : end - i));
+                i = end == string_view::npos ? line.size() : end;
+            }
+            if (i >= line.size()) return true;
+            ++i;
+        }
+    }
+
+    static string_view trim(string_view field) {
+        while (!field.empty() && (field.front() == ' ' || field.front() == '\t')) field.remove_prefix(1);
+        while (!field.empty() && (field.back() == ' ' || field.back() == '\t')) field.remove_suffix(1);
+        return field;
+    }
+
+    static optional<int> wholeNumber(string_view field) {
+        field = trim(field);
+        int value;
+        from_chars_result parsed = from_chars(field.data(), field.data() + field.size(), value);
+        if (field.empty() || parsed.ec != errc() || parsed.ptr != field.data() + field.size()) return nullopt;
+        return value;
+    }
+
+    static optional<double> positiveRate(string_view field) {
+        field = trim(field);
+        double value;
+        from_chars_result parsed = from_chars(field.data(), field.data() + field.size(), value);
+        if (field.empty() || parsed.ec != errc() || parsed.ptr != field.data() + field.size() || !(value > 0) || !isfinite(value)) return nullopt;
+        return value;
+    }
+
+    static string quote(string_view field) { return "'" + string(field) + "'"; }
+
+    // Each parse returns nullopt after adding the reason to problem.
+    static optional<ImportedRoom> parseRoom(const vector<string_view>& fields, size_t line, string& problem) {
+        if (fields.size() != 4 && fields.size() != 5) {
+            problem = "Expected number,type,rate,billing[,maxGuests] but got " + to_string(fields.size()) + " fields.";
+            return nullopt;
+        }
+        optional<int> number = wholeNumber(fields[0]);
+        optional<double> rate = positiveRate(fields[2]);
+        if (!number || *number <= 0) {
+            problem = quote(fields[0]) + " is not a room number.";
+            return nullopt;
+        }
+        if (!rate) {
+            problem = quote(fields[2]) + " is not a positive rate.";
+            return nullopt;
+        }
+        try {
+            Room::RoomType type = BatchRunner::parseRoomType(string(trim(fields[1])));
+            BillingStrategy billing = BatchRunner::parseBilling(string(trim(fields[3])));
+            optional<int> guests = fields.size() == 5 ? wholeNumber(fields[4]) : optional<int>(Room::defaultMaxGuests(type));
+            if (!guests || *guests < 1) {
+                problem = quote(fields[4]) + " is not a guest capacity.";
+                return nullopt;
+            }
+            return ImportedRoom{ line, *number, type, *rate, billing, *guests };
+        } catch (const invalid_argument& e) {
+            problem = e.what();
+            return nullopt;
+        }
+    }
+
+    static optional<ImportedStay> parseStay(const vector<string_view>& fields, size_t line, string& problem) {
+        if (fields.size() != 6) {
+            problem = "Expected guest,contact,room,checkIn,checkOut,guests but got " + to_string(fields.size()) + " fields.";
+            return nullopt;
+        }
+        string_view guestName = trim(fields[0]);
+        optional<int> room = wholeNumber(fields[2]);
+        optional<Date> checkIn = Date::fromText(trim(fields[3]));
+        optional<Date> checkOut = Date::fromText(trim(fields[4]));
+        optional<int> guests = wholeNumber(fields[5]);
+        if (guestName.empty()) problem = "The guest name is empty.";
+        else if (!room) problem = quote(fields[2]) + " is not a room number.";
+        else if (!checkIn) problem = "Invalid date " + quote(fields[3]) + ".";
+        else if (!checkOut) problem = "Invalid date " + quote(fields[4]) + ".";
+        else if (*checkOut <= *checkIn) problem = "Check-out must be after check-in.";
+        else if (!guests || *guests < 1) problem = quote(fields[5]) + " is not a number of guests.";
+        else return ImportedStay{ line, string(guestName), string(trim(fields[1])), *room, *checkIn, *checkOut, *guests };
+        return nullopt;
+    }
+
+    // Lines are numbered within the chunk here and renumbered once every chunk is parsed.
+    template <typename Row, typename Parse>
+    static void parseChunk(Chunk<Row>& chunk, char separator, Parse parse) {
+        vector<string_view> fields;
+        deque<string> unquoted;
+        string problem;
+        string_view text = chunk.text;
+        while (!text.empty()) {
+            size_t end = text.find('\n');
+            string_view line = text.substr(0, end);
+            text.remove_prefix(end == string_view::npos ? text.size() : end + 1);
+            ++chunk.lines;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (trim(line).empty()) continue;
+            if (!splitFields(line, separator, fields, unquoted)) {
+                chunk.rejected.push_back({ chunk.lines, "Unterminated or misplaced quote." });
+                continue;
+            }
+            problem.clear();
+            if (optional<Row> row = parse(fields, chunk.lines, problem)) chunk.rows.push_back(move(*row));
+            else chunk.rejected.push_back({ chunk.lines, problem });
+        }
+    }
+
+    template <typename Row, typename Parse, typename Apply>
+    Result importFile(const string& path, const char* headerStart, Parse parse, Apply apply) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) throw runtime_error("Could not open " + path + ".");
+        Result result;
+        vector<Row> rows;
+        string block;
+        size_t carried = 0, firstLine = 1;
+        char separator = 0;
+        while (true) {
+            block.resize(carried + BLOCK_SIZE);
+            size_t read = fread(&block[carried], 1, BLOCK_SIZE, file);
+            block.resize(carried + read);
+            bool last = read == 0;
+            size_t usable = last ? block.size() : block.rfind('\n') + 1;
+            if (!last && usable == 0) {             // no line break yet: read more into the same block
+                carried = block.size();
+                continue;
+            }
+            string_view text(block.data(), usable);
+            if (separator == 0 && !text.empty()) {
+                string_view first = text.substr(0, text.find('\n'));
+                size_t length = first.size();
+                if (!first.empty() && first.back() == '\r') first.remove_suffix(1);
+                separator = first.find('\t') != string_view::npos ? '\t' : ',';
+                vector<string_view> fields;
+                deque<string> unquoted;
+                string problem, lowered;
+                bool isRow = splitFields(first, separator, fields, unquoted) && parse(fields, 1, problem);
+                if (!fields.empty()) {
+                    for (char c : trim(fields[0])) lowered += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+                }
+                if (!isRow && lowered.rfind(headerStart, 0) == 0) {
+                    text.remove_prefix(min(text.size(), length + 1));
+                    ++firstLine;
+                }
+            }
+
+            vector<Chunk<Row>> chunks(text.empty() ? 0 : threadCount);
+            for (size_t i = 0, begin = 0; i < chunks.size(); ++i) {
+                size_t end = max(begin, (i + 1) * text.size() / chunks.size());
+                if (end < text.size()) end = min(text.size(), text.find('\n', end) + 1);
+                chunks[i].text = text.substr(begin, end - begin);
+                begin = end;
+            }
+            vector<thread> parsers;
+            for (size_t i = 1; i < chunks.size(); ++i) parsers.emplace_back([&, i] { parseChunk(chunks[i], separator, parse); });
+            if (!chunks.empty()) parseChunk(chunks[0], separator, parse);
+            for (thread& parser : parsers) parser.join();
+
+            for (Chunk<Row>& chunk : chunks) {
+                for (Row& row : chunk.rows) {
+                    row.line += firstLine - 1;
+                    rows.push_back(move(row));
+                }
+                for (ImportRejection& rejection : chunk.rejected) {
+                    rejection.line += firstLine - 1;
+                    result.rejected.push_back(move(rejection));
+                }
+                result.rows += chunk.rows.size() + chunk.rejected.size();
+                firstLine += chunk.lines;
+            }
+            if (last) break;
+            block.erase(0, usable);
+            carried = block.size();
+        }
+        fclose(file);
+        result.added = apply(rows, result.rejected);
+        sort(result.rejected.begin(), result.rejected.end(),
+             [](const ImportRejection& a, const ImportRejection& b) { return a.line < b.line; });
+        return result;
+    }
+
+public:
+    BulkImporter(Hotel& target, size_t threads) : hotel(target), threadCount(max<size_t>(1, threads)) {}
+
+    Result importRooms(const string& path) {
+        return importFile<ImportedRoom>(path, "number", parseRoom,
+            [this](const vector<ImportedRoom>& rows, vector<ImportRejection>& rejected) { return hotel.importRooms(rows, rejected, threadCount); });
+    }
+
+    Result importReservations(const string& path) {
+        return importFile<ImportedStay>(path, "guest", parseStay,
+            [this](const vector<ImportedStay>& rows, vector<ImportRejection>& rejected) { return hotel.importReservations(rows, rejected, threadCount); });
+    }
+};
+
+// --import [--rooms file] [--reservations file] [--memory] [--threads n]: loads the files into
+// the saved hotel (rooms first) and writes a snapshot, or only checks them against an empty
+// in-memory hotel with --memory. Rejected rows go to cerr as file:line: reason. Returns 1 if a
+// file could not be read or the snapshot could not be written, and 2 if any row was rejected.
+int runImport(const string& roomsPath, const string& reservationsPath, bool inMemory, size_t threads) {
+    Hotel hotel;
+    unique_ptr<HotelStore> store;
+    if (!inMemory) {
+        store = make_unique<HotelStore>(hotel, "hotel.snapshot", "hotel.journal");
+        store->open();
+    }
+    // Imported rows are only saved by the checkpoint, so a missing file stops the run before
+    // anything is loaded, and a later failure still saves the rows loaded before it.
+    for (const string& path : { roomsPath, reservationsPath }) {
+        FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+        if (file) fclose(file);
+        else if (!path.empty()) {
+            cerr << "Could not open " << path << ".\n";
+            return 1;
+        }
+    }
+    BulkImporter importer(hotel, threads);
+    size_t rejected = 0;
+    for (int kind = 0; kind < 2; ++kind) {
+        const string& path = kind == 0 ? roomsPath : reservationsPath;
+        if (path.empty()) continue;
+        auto start = chrono::steady_clock::now();
+        BulkImporter::Result result;
+        try {
+            result = kind == 0 ? importer.importRooms(path) : importer.importReservations(path);
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            if (store) store->checkpoint();
+            return 1;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (const ImportRejection& rejection : result.rejected) cerr << path << ":" << rejection.line << ": " << rejection.reason << "\n";
+        cout << path << ": " << result.rows << (kind == 0 ? " rooms, " : " reservations, ") << result.added << " added, "
+             << result.rejected.size() << " rejected, " << fixed << setprecision(3) << seconds << " s\n";
+        rejected += result.rejected.size();
+    }
+    if (store && !store->checkpoint()) return 1;
+    return rejected == 0 ? 0 : 2;
+}
+
+// The few socket calls that are spelled differently by Winsock and POSIX.
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+const SocketHandle NO_SOCKET = INVALID_SOCKET;
+
+int pollSockets(pollfd* sockets, size_t count, int timeoutMs) { return WSAPoll(sockets, static_cast<ULONG>(count), timeoutMs); }
+void closeSocket(SocketHandle socket) { closesocket(socket); }
+bool setNonBlocking(SocketHandle socket) {
+    u_long on = 1;
+    return ioctlsocket(socket, FIONBIO, &on) == 0;
+}
+bool socketWouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+void shutdownSending(SocketHandle socket) { shutdown(socket, SD_SEND); }
+#else
+using SocketHandle = int;
+const SocketHandle NO_SOCKET = -1;
+
+int pollSockets(pollfd* sockets, size_t count, int timeoutMs) { return poll(sockets, static_cast<nfds_t>(count), timeoutMs); }
+void closeSocket(SocketHandle socket) { close(socket); }
+bool setNonBlocking(SocketHandle socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+bool socketWouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+void shutdownSending(SocketHandle socket) { shutdown(socket, SHUT_WR); }
+#endif
+
+// Starts Winsock for its lifetime, and on POSIX turns off SIGPIPE so a client that disconnects
+// mid-response fails the send instead of killing the process.
+class SocketLibrary {
+private:
+    bool ready = true;
+
+public:
+    SocketLibrary() {
+#ifdef _WIN32
+        WSADATA data;
+        ready = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+        signal(SIGPIPE, SIG_IGN);
+#endif
+    }
+
+    ~SocketLibrary() {
+#ifdef _WIN32
+        if (ready) WSACleanup();
+#endif
+    }
+
+    SocketLibrary(const SocketLibrary&) = delete;
+    SocketLibrary& operator=(const SocketLibrary&) = delete;
+
+    bool isReady() const { return ready; }
+};
+
+bool parseAddress(const string& host, int port, sockaddr_in& address) {
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    return port > 0 && port < 65536 && inet_pton(AF_INET, host.c_str(), &address.sin_addr) == 1;
+}
+
+// --serve: answers the batch command language over TCP, so booking agents and the website can
+// work on one Hotel at the same time. A request is one command line; every line gets exactly
+// one response, in order:
+//   OK <length>\n<what the command printed>
+//   ERR <length>\n<why the line was rejected, then anything the command printed>
+// Blank and comment lines are answered with "OK 0". Clients may pipeline: a connection's
+// requests run one after another, while requests from different connections run at the same
+// time on the worker threads, with the Hotel's own locks keeping them apart. One thread owns
+// every socket and waits on all of them with poll (WSAPoll on Windows); workers hand finished
+// responses back through a queue and wake it over a loopback socket pair.
+class HotelServer {
+public:
+    static constexpr size_t MAX_LINE = 64 * 1024;
+    static constexpr size_t MAX_QUEUED = 256;        // per connection; reading pauses beyond
+    static constexpr int POLL_MS = 100;              // how often a stop request is noticed
+    static constexpr auto FLUSH_EVERY = chrono::milliseconds(20);
 
-class Hotel {
 private:
-    vector<Room> rooms;
-    vector<Reservation> reservations;
+    struct Connection {
+        SocketHandle socket = NO_SOCKET;
+        string input;               // received bytes after the last whole line
+        deque<string> queued;       // request lines waiting for the one in flight
+        bool busy = false;          // a request is on a worker
+        string output;              // responses not yet sent
+        size_t sent = 0;            // bytes of output already sent
+        bool closing = false;       // client finished sending: close once everything is answered
+        bool overlong = false;      // a line exceeded MAX_LINE: answer ERR after the queue, then close
+        bool broken = false;        // the socket failed: drop without answering
+    };
+    struct Job {
+        uint64_t connection;
+        string line;
+    };
+    struct Reply {
+        uint64_t connection;
+        string response;
+    };
 
-public:
-    const vector<Room>& getRooms() const {
-        return rooms;
-    }
-    
-    void addRoom(int number, Room::RoomType type, double rate, unique_ptr<BillingStrategy> strategy, int guests) {
-        rooms.emplace_back(number, type, rate, move(strategy), guests);
-    }
+    static inline atomic<bool> signalled{false};
 
-void addRoomWithValidation() {
-    cout << "\n========== ADD NEW ROOM ==========\n";
-    int roomNumber;
-    bool roomExists;
+    Hotel& hotel;
+    HotelStore* store;
+    size_t workerCount;
+    SocketHandle listener = NO_SOCKET;
+    SocketHandle wakeReader = NO_SOCKET;
+    SocketHandle wakeWriter = NO_SOCKET;
+    unordered_map<uint64_t, Connection> connections;     // event loop thread only
+    uint64_t nextConnection = 1;
+    atomic<bool> stopRequested{false};
 
-    do {
-        roomNumber = getValidatedInt("Enter room number: ");
-        roomExists = false;
+    mutex jobMutex;
+    condition_variable jobReady;
+    deque<Job> jobs;
+    bool workersDone = false;
 
-        for (const auto& room : rooms) {
-            if (room.getRoomNumber() == roomNumber) {
-                roomExists = true;
-                cout << "Room " << roomNumber << " already exists. Please enter a different room number.\n";
-                break; 
-            }
-        }
-    } while (roomExists); 
+    mutex replyMutex;
+    vector<Reply> replies;
 
-    double baseRate;
-    while (true) {
-        cout << "Enter base rate per night: $";
-        string input;
-        cin >> input;
+    static void onSignal(int) { signalled = true; }
 
-        try {
-            baseRate = stod(input); // Convert string to double
-            if (baseRate <= 0) {
-                cout << "Invalid input. Please enter a positive number for the base rate.\n";
-            } else {
-                break; // Valid input
-            }
-        } catch (const invalid_argument&) {
-            cout << "Invalid input. Please enter a valid number for the base rate.\n";
-        } catch (const out_of_range&) {
-            cout << "Input is out of range. Please enter a valid number for the base rate.\n";
-        }
+    static string frame(bool ok, const string& body) {
+        return (ok ? "OK " : "ERR ") + to_string(body.size()) + "\n" + body;
     }
 
-    cout << "\nRoom Types:\n";
-    cout << "1. Single (Max 1 guest)\n";
-    cout << "2. Double (Max 2 guests)\n";
-    cout << "3. Deluxe (Max 4 guests)\n";
-    cout << "4. Suite (Max 6 guests)\n";
-    int roomTypeChoice = getValidatedInt("Select room type (1-4): ");
-    Room::RoomType roomType = static_cast<Room::RoomType>(roomTypeChoice - 1);
-    int maxGuests = 1;
-    switch (roomType) {
-        case Room::RoomType::SINGLE: maxGuests = 1; break;
-        case Room::RoomType::DOUBLE: maxGuests = 2; break;
-        case Room::RoomType::DELUXE: maxGuests = 4; break;
-        case Room::RoomType::SUITE: maxGuests = 6; break;
-        default: maxGuests = 1; break;
+    // A listening socket on 127.0.0.1 is connected to itself to get the wakeup pair; unlike a
+    // pipe this works with WSAPoll too.
+    bool openWakePair() {
+        sockaddr_in address;
+        socklen_t length = sizeof(address);
+        parseAddress("127.0.0.1", 1, address);
+        address.sin_port = 0;
+        SocketHandle acceptor = socket(AF_INET, SOCK_STREAM, 0);
+        if (acceptor == NO_SOCKET) return false;
+        bool ok = bind(acceptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0
+               && listen(acceptor, 1) == 0
+               && getsockname(acceptor, reinterpret_cast<sockaddr*>(&address), &length) == 0;
+        if (ok) {
+            wakeWriter = socket(AF_INET, SOCK_STREAM, 0);
+            ok = wakeWriter != NO_SOCKET && connect(wakeWriter, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        }
+        if (ok) {
+            wakeReader = accept(acceptor, nullptr, nullptr);
+            ok = wakeReader != NO_SOCKET && setNonBlocking(wakeReader) && setNonBlocking(wakeWriter);
+        }
+        closeSocket(acceptor);
+        return ok;
     }
 
-    cout << "\nBilling Strategies:\n";
-    cout << "1. Regular Rate\n";
-    cout << "2. Premium Rate (10% service charge)\n";
-    cout << "3. Corporate Rate (15% discount)\n";
-
-    int billingStrategyChoice;
-    while (true) {
-        billingStrategyChoice = getValidatedInt("Select billing strategy (1-3): ");
-        if (billingStrategyChoice < 1 || billingStrategyChoice > 3) {
-            cout << "Invalid billing strategy choice. Please select a valid option (1-3).\n";
-        } else {
-            break; // Valid input
-        }
+    // A full socket buffer already means a wakeup is pending, so a failed send is fine.
+    void wake() {
+        char byte = 1;
+        send(wakeWriter, &byte, 1, 0);
     }
 
-    unique_ptr<BillingStrategy> billingStrategy;
-    switch (billingStrategyChoice) {
-        case 1:
-            billingStrategy = make_unique<RegularBilling>();
-            break;
-        case 2:
-            billingStrategy = make_unique<PremiumBilling>();
-            break;
-        case 3:
-            billingStrategy = make_unique<CorporateBilling>();
-            break;
+    void drainWake() {
+        char bytes[256];
+        while (recv(wakeReader, bytes, sizeof(bytes), 0) > 0) {}
     }
 
-    addRoom(roomNumber, roomType, baseRate, move(billingStrategy), maxGuests);
-    cout << "\n==========================\n";
-    cout << "Room added successfully!\n";
-    cout << "============================\n";
-}
+    string respond(const string& line) {
+        ostringstream output;
+        string error;
+        Hotel::setThreadOutput(&output);
+        BatchRunner runner(hotel, output, false);
+        BatchRunner::Outcome outcome = runner.runLine(line, error);
+        Hotel::setThreadOutput(nullptr);
+        if (outcome != BatchRunner::Outcome::FAILED) return frame(true, output.str());
+        return frame(false, error.empty() ? output.str() : error + "\n" + output.str());
+    }
 
-    void deleteRoom(int roomNumber) {
-        for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-            if (it->getRoomNumber() == roomNumber) {
-                rooms.erase(it);
-                cout << "\n===========================================\n";
-                cout << "Room " << roomNumber << " deleted successfully!\n";
-                cout << "=============================================\n";
-                return;
+    void work() {
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobReady.wait(lock, [this] { return workersDone || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = move(jobs.front());
+                jobs.pop_front();
             }
+            string response = respond(job.line);
+            {
+                lock_guard<mutex> lock(replyMutex);
+                replies.push_back({ job.connection, move(response) });
+            }
+            wake();
         }
-        cout << "Room not found.\n";
     }
 
-    void updateRoomRate(int roomNumber, double newRate) {
-        for (auto& room : rooms) {
-            if (room.getRoomNumber() == roomNumber) {
-                room.setBaseRate(newRate);
-                cout << "\n===========================================\n";
-                cout << "Room " << roomNumber << " rate updated to $" << newRate << " successfully!\n";
-                cout << "=============================================\n";
-                return;
+    // Hands the connection's next request to the workers unless one is already running.
+    void dispatch(uint64_t id, Connection& connection) {
+        if (connection.busy) return;
+        if (connection.queued.empty()) {
+            if (connection.overlong) {
+                connection.output += frame(false, "Request line longer than " + to_string(MAX_LINE) + " bytes.\n");
+                connection.overlong = false;
             }
+            return;
+        }
+        connection.busy = true;
+        {
+            lock_guard<mutex> lock(jobMutex);
+            jobs.push_back({ id, move(connection.queued.front()) });
         }
-        cout << "Room not found.\n";
+        connection.queued.pop_front();
+        jobReady.notify_one();
     }
 
-    void updateRoomBillingStrategy(int roomNumber, unique_ptr<BillingStrategy> strategy) {
-        for (auto& room : rooms) {
-            if (room.getRoomNumber() == roomNumber) {
-                room.setBillingStrategy(move(strategy));
-                cout << "\n===========================================\n";
-                cout << "Room " << roomNumber << " billing strategy updated successfully!\n";
-                cout << "============================================\n";
-                return;
-            }
+    void deliverReplies() {
+        vector<Reply> ready;
+        {
+            lock_guard<mutex> lock(replyMutex);
+            ready.swap(replies);
         }
-        cout << "Room not found.\n";
-    }
-   void showRoomPriceRates() const {
-    cout << "\n=============================== ROOM PRICE RATES =============================================\n";
-    cout << left << setw(8) << "Room #" 
-         << left << setw(12) << "Type" 
-         << right << setw(12) << "Base Rate" 
-         << left << setw(15) << " "  
-         << left << setw(15) << "Billing Type" 
-         << right << setw(12) << "Max Guests" << "\n";
-    cout << "------------------------------------------------------------------------------------------------\n";
-    for (const auto& room : rooms) {
-        cout << left << setw(8) << room.getRoomNumber()
-             << left << setw(12) << room.getRoomTypeString()
-             << right << setw(2) << "$"
-             << right << setw(10) << fixed << setprecision(2) << room.getBaseRate()
-             << left << setw(15) << " "
-             << left << setw(15) << room.getBillingStrategyString()
-             << right << setw(12) << room.getMaxGuests() << "\n";
-    }
-    cout << "================================================================================================\n";
-}
-    void showAvailableRooms() const {
-    cout << "\n==================================== AVAILABLE ROOMS =========================================\n";
-    cout << left << setw(8) << "Room #" 
-         << left << setw(12) << "Type" 
-         << right << setw(12) << "Base Rate" 
-         << left << setw(15) << "  "  
-         << left << setw(15) << "Billing Type" 
-         << right << setw(12) << "Max Guests" << "\n";
-    cout << "------------------------------------------------------------------------------------------------\n";
-    for (const auto& room : rooms) {
-        if (room.isRoomAvailable()) {
-            cout << left << setw(8) << room.getRoomNumber()
-                 << left << setw(12) << room.getRoomTypeString()
-                 << right << setw(2) << "$"
-                 << right << setw(10) << fixed << setprecision(2) << room.getBaseRate()
-                 << left << setw(15) << " "
-                 << left << setw(15) << room.getBillingStrategyString()
-                 << right << setw(12) << room.getMaxGuests() << "\n";
+        for (Reply& reply : ready) {
+            auto found = connections.find(reply.connection);
+            if (found == connections.end()) continue;           // dropped while the request ran
+            found->second.busy = false;
+            found->second.output += reply.response;
+            dispatch(found->first, found->second);
         }
     }
-    cout << "================================================================================================\n";
-}
-   void showAllRooms() const {
-    cout << "\n========================================= ALL ROOMS ==========================================\n";
-    cout << left << setw(8) << "Room #" 
-         << left << setw(12) << "Type" 
-         << right << setw(12) << "Base Rate" 
-         << left << setw(15) << "  "
-         << left << setw(12) << "Status" 
-         << left << setw(15) << "Billing Type" 
-         << right << setw(12) << "Max Guests" << "\n";
-    cout << "------------------------------------------------------------------------------------------------\n";
-    for (const auto& room : rooms) {
-        cout << left << setw(8) << room.getRoomNumber()
-             << left << setw(12) << room.getRoomTypeString()
-             << right << setw(2) << "$"
-             << right << setw(10) << fixed << setprecision(2) << room.getBaseRate()
-             << left << setw(15) << " "
-             << left << setw(12) << (room.isRoomAvailable() ? "Available" : "Occupied")
-             << left << setw(15) << room.getBillingStrategyString()
-             << right << setw(12) << room.getMaxGuests() << "\n";
-    }
-    cout << "================================================================================================\n";
-}
 
-
-   void makeReservation(const string& guestName, const string& contactInfo, int roomNumber, const string& checkIn, const string& checkOut, int guests) {
-    for (auto& room : rooms) {
-        if (room.getRoomNumber() == roomNumber) {
-            if (guests > room.getMaxGuests()) {
-                cout << "Error: Room " << roomNumber << " can only accommodate " << room.getMaxGuests() << " guests.\n";
-                return;
-            }
-            if (room.isRoomAvailable()) {
-                room.setAvailability(false);
-                reservations.emplace_back(guestName, contactInfo, roomNumber, checkIn, checkOut, guests);
-                cout << "\n===========================================\n";
-                cout << "Reservation created successfully!\n"; 
-                cout << "=============================================\n";
-                return;
-            } else {
-                cout << "============================================\n";
-                cout << "Room not available for reservation.\n";
-                cout << "===========================================\n";
-                return;
+    void acceptConnections() {
+        while (true) {
+            SocketHandle client = accept(listener, nullptr, nullptr);
+            if (client == NO_SOCKET) return;
+            if (!setNonBlocking(client)) {
+                closeSocket(client);
+                continue;
             }
+            int on = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+            connections[nextConnection++].socket = client;
         }
     }
-    cout << "Room not found.\n";
-}
-
-
 
+    void receive(uint64_t id, Connection& connection) {
+        char buffer[16 * 1024];
+        while (true) {
+            auto received = recv(connection.socket, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                connection.input.append(buffer, static_cast<size_t>(received));
+                if (connection.input.size() > MAX_LINE + sizeof(buffer)) break;
+                continue;
+            }
+            if (received == 0) connection.closing = true;
+            else if (!socketWouldBlock()) connection.broken = true;
+            break;
+        }
+        size_t start = 0, end;
+        while ((end = connection.input.find('\n', start)) != string::npos) {
+            size_t length = end - start;
+            if (length > 0 && connection.input[end - 1] == '\r') --length;
+            connection.queued.push_back(connection.input.substr(start, length));
+            start = end + 1;
+        }
+        connection.input.erase(0, start);
+        if (connection.input.size() > MAX_LINE) {
+            connection.input.clear();
+            connection.overlong = true;
+            connection.closing = true;
+        }
+        dispatch(id, connection);
+    }
 
-    void cancelReservation(int reservationID) {
-        for (auto it = reservations.begin(); it != reservations.end(); ++it) {
-            if (it->getReservationID() == reservationID) {
-                for (auto& room : rooms) {
-                    if (room.getRoomNumber() == it->getRoomNumber()) {
-                        room.setAvailability(true);
-                        break;
-                    }
-                }
-                reservations.erase(it);
-                cout << "\n===========================================\n";
-                cout << "Reservation " << reservationID << " cancelled successfully!\n";
-                cout << "============================================\n";
-                return;
+    void transmit(Connection& connection) {
+        while (connection.sent < connection.output.size()) {
+            size_t remaining = min<size_t>(connection.output.size() - connection.sent, 1 << 20);
+            auto sent = send(connection.socket, connection.output.data() + connection.sent, static_cast<int>(remaining), 0);
+            if (sent > 0) {
+                connection.sent += static_cast<size_t>(sent);
+                continue;
             }
+            if (sent < 0 && !socketWouldBlock()) connection.broken = true;
+            return;
         }
-        cout << "Reservation not found.\n";
+        connection.output.clear();
+        connection.sent = 0;
     }
 
-     void showAllReservations() const {
-    cout << "\n============================= ALL RESERVATIONS ===============================================\n";
-    cout << left << setw(8) << "ID" 
-         << left << setw(22) << "Guest Name" 
-         << left << setw(10) << "Room #" 
-         << left << setw(15) << "Check-in" 
-         << left << setw(15) << "Check-out" << "\n";
-    cout << "------------------------------------------------------------------------------------------------\n";
-    for (const auto& reservation : reservations) {
-        cout << left << setw(8) << reservation.getReservationID() 
-             << left << setw(22) << reservation.getGuestName() 
-             << left << setw(10) << reservation.getRoomNumber() 
-             << left << setw(15) << reservation.getCheckInDate() 
-             << left << setw(15) << reservation.getCheckOutDate() << "\n";
-    }
-    cout << "================================================================================================\n";
-}
+    bool finished(const Connection& connection) const {
+        if (connection.broken) return true;
+        return connection.closing && !connection.busy && connection.queued.empty()
+            && !connection.overlong && connection.output.empty();
+    }
 
-    void viewReservationDetails(int reservationID) const {
-    for (const auto& reservation : reservations) {
-        if (reservation.getReservationID() == reservationID) {
-            cout << "\n=========== RESERVATION DETAILS ===========\n";
-            cout << "Reservation #" << reservation.getReservationID() << "\n";
-            cout << "Guest: " << reservation.getGuestName() << "\n";
-            cout << "Contact: " << reservation.getContactInfo() << "\n";
-            cout << "Room: " << reservation.getRoomNumber() << "\n";
-            cout << "Check-in: " << reservation.getCheckInDate() << "\n";
-            cout << "Check-out: " << reservation.getCheckOutDate() << "\n";
-            cout << "Guests: " << reservation.getNumberOfGuests() << "\n";
+public:
+    HotelServer(Hotel& target, HotelStore* journalStore, size_t workers)
+        : hotel(target), store(journalStore), workerCount(max<size_t>(1, workers)) {}
 
-            int checkInDay, checkInMonth, checkInYear;
-            int checkOutDay, checkOutMonth, checkOutYear;
-            sscanf(reservation.getCheckInDate().c_str(), "%d/%d/%d", &checkInDay, &checkInMonth, &checkInYear);
-            sscanf(reservation.getCheckOutDate().c_str(), "%d/%d/%d", &checkOutDay, &checkOutMonth, &checkOutYear);
+    ~HotelServer() {
+        if (listener != NO_SOCKET) closeSocket(listener);
+        if (wakeReader != NO_SOCKET) closeSocket(wakeReader);
+        if (wakeWriter != NO_SOCKET) closeSocket(wakeWriter);
+    }
 
-            int nights = 0;
+    HotelServer(const HotelServer&) = delete;
+    HotelServer& operator=(const HotelServer&) = delete;
 
-            if (checkInYear > checkOutYear || 
-                (checkInYear == checkOutYear && checkInMonth > checkOutMonth) || 
-                (checkInYear == checkOutYear && checkInMonth == checkOutMonth && checkInDay >= checkOutDay)) {
-                throw runtime_error("Invalid date range.");
-            }
+    bool listenOn(const string& host, int port) {
+        sockaddr_in address;
+        if (!parseAddress(host, port, address)) {
+            cerr << "Invalid address " << host << ":" << port << ".\n";
+            return false;
+        }
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (listener == NO_SOCKET
+            || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on)) != 0
+            || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, SOMAXCONN) != 0 || !setNonBlocking(listener)) {
+            cerr << "Could not listen on " << host << ":" << port << ".\n";
+            return false;
+        }
+        if (!openWakePair()) {
+            cerr << "Could not create the server's wakeup sockets.\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Safe from any thread.
+    void stop() {
+        stopRequested = true;
+        if (wakeWriter != NO_SOCKET) wake();
+    }
 
-            const int daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    // Ctrl+C or SIGTERM stops the server the same way stop() does.
+    static void stopOnSignals() {
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+    }
 
-            nights += daysInMonth[checkInMonth - 1] - checkInDay; 
+    // Serves until stop() or a signal. On the way out no new connections or requests are
+    // accepted; requests already running finish and their responses are sent if the clients
+    // can take them straight away.
+    void run() {
+        vector<thread> workers;
+        for (size_t i = 0; i < workerCount; ++i) workers.emplace_back([this] { work(); });
 
-            for (int month = checkInMonth; month < checkOutMonth - 1; ++month) {
-                nights += daysInMonth[month];
+        vector<pollfd> sockets;
+        vector<uint64_t> owners;
+        auto lastFlush = chrono::steady_clock::now();
+        bool stopping = false;
+        while (true) {
+            if (!stopping && (stopRequested || signalled)) {
+                stopping = true;
+                closeSocket(listener);
+                listener = NO_SOCKET;
+                for (auto& [id, connection] : connections) {
+                    connection.queued.clear();
+                    connection.closing = true;
+                }
+            }
+            if (stopping && none_of(connections.begin(), connections.end(),
+                                    [](const auto& entry) { return entry.second.busy; })) {
+                break;
             }
 
-            nights += checkOutDay;
+            sockets.clear();
+            owners.clear();
+            sockets.push_back({ wakeReader, POLLIN, 0 });
+            if (listener != NO_SOCKET) sockets.push_back({ listener, POLLIN, 0 });
+            size_t firstConnection = sockets.size();
+            for (const auto& [id, connection] : connections) {
+                short events = 0;
+                if (!connection.closing && connection.queued.size() < MAX_QUEUED) events |= POLLIN;
+                if (!connection.output.empty()) events |= POLLOUT;
+                if (events == 0) continue;
+                sockets.push_back({ connection.socket, events, 0 });
+                owners.push_back(id);
+            }
+            pollSockets(sockets.data(), sockets.size(), POLL_MS);
 
-            double totalBill = 0.0;
-            for (const auto& room : rooms) {
-                if (room.getRoomNumber() == reservation.getRoomNumber()) {
-                    totalBill = room.calculateBill(nights); 
-                    break;
+            if (sockets[0].revents) drainWake();
+            deliverReplies();
+            if (listener != NO_SOCKET && sockets[1].revents) acceptConnections();
+            for (size_t i = 0; i < owners.size(); ++i) {
+                short events = sockets[firstConnection + i].revents;
+                auto found = connections.find(owners[i]);
+                if (found == connections.end()) continue;
+                if (events & (POLLIN | POLLHUP | POLLERR)) receive(found->first, found->second);
+            }
+            for (auto entry = connections.begin(); entry != connections.end(); ) {
+                if (!entry->second.output.empty()) transmit(entry->second);
+                if (finished(entry->second)) {
+                    closeSocket(entry->second.socket);
+                    entry = connections.erase(entry);
+                } else {
+                    ++entry;
                 }
             }
-            cout << "Total Bill: $" << fixed << setprecision(2) << totalBill << "\n";
-            cout << "===============================\n";
-            return;
-        }
-    }
-    cout << "Reservation not found.\n";
-}
 
+            if (store && chrono::steady_clock::now() - lastFlush >= FLUSH_EVERY) {
+                store->flush();
+                lastFlush = chrono::steady_clock::now();
+            }
+        }
 
-void updateReservation(int reservationID) {
-    for (auto& reservation : reservations) {
-        if (reservation.getReservationID() == reservationID) {
-            cout << "\nUpdate Options:\n";
-            cout << "1. Change number of guests\n";
-            cout << "2. Change room\n";
-            cout << "3. Change dates\n";
-            cout << "4. Back\n";
-            int option;
-            option = getValidatedInt("Select update option (1-4): ");
-
-            switch (option) {
-                case 1: { 
-                    cout << "Current number of guests: " << reservation.getNumberOfGuests() << "\n";
-                    int newGuests = getValidatedInt("Enter new number of guests: ");
-
-                    for (const auto& room : rooms) {
-                        if (room.getRoomNumber() == reservation.getRoomNumber()) {
-                            if (newGuests > room.getMaxGuests()) {
-                                cout << "Error: Room " << room.getRoomNumber() << " can only accommodate " << room.getMaxGuests() << " guests.\n";
-                                return; 
-                            }
-                            break; 
-                        }
-                    }
-                    
-                    reservation.updateGuests(newGuests);
-                    cout << "\n===========================================\n";
-                    cout << "Number of guests updated successfully.\n";
-                    cout << "============================================\n";
-                    break;
-                }
-                case 2: { 
-                    cout << "Current room: " << reservation.getRoomNumber() << "\n";
-                    showAvailableRooms();
-                    int newRoomNumber = getValidatedInt("Enter new room number: ");
-
-                    for (auto& room : rooms) {
-                        if (room.getRoomNumber() == newRoomNumber) {
-  
-                            if (reservation.getNumberOfGuests() > room.getMaxGuests()) {
-                                cout << "Error: Room " << newRoomNumber << " can only accommodate " << room.getMaxGuests() << " guests.\n";
-                                return; 
-                            }
+        {
+            lock_guard<mutex> lock(jobMutex);
+            workersDone = true;
+        }
+        jobReady.notify_all();
+        for (thread& worker : workers) worker.join();
+        deliverReplies();
+        for (auto& [id, connection] : connections) {
+            transmit(connection);
+            closeSocket(connection.socket);
+        }
+        connections.clear();
+        if (store) store->flush();
+    }
+};
 
-                          
-                            for (auto& oldRoom : rooms) {
-                                if (oldRoom.getRoomNumber() == reservation.getRoomNumber()) {
-                                    oldRoom.setAvailability(true);
-                                    break;
-                                }
-                            }
+struct ServeOptions {
+    string host = "0.0.0.0";
+    int port = 0;
+    size_t threads = max(2u, thread::hardware_concurrency());
+    bool inMemory = false;
+    bool console = false;       // run the interactive menus on the same Hotel while serving
+    ListingFormat format = ListingFormat::TEXT;
+};
 
-                      
-                            reservation.updateRoomNumber(newRoomNumber); 
-                            room.setAvailability(false); 
-                            cout << "\n===========================================\n";
-                            cout << "Room changed successfully.\n";
-                            cout << "============================================\n";
-                            return;
-                        }
-                    }
-                    cout << "Room not available.\n";
-                    break;
-                }
-                case 3: {
-                    cout << "Current check-in date: " << reservation.getCheckInDate() << "\n";
-                    cout << "Current check-out date: " << reservation.getCheckOutDate() << "\n";
-                    string newCheckIn, newCheckOut;
-                    cout << "Enter new check-in date (DD/MM/YYYY): ";
-                    cin >> newCheckIn;
-                    cout << "Enter new check-out date (DD/MM/YYYY): ";
-                    cin >> newCheckOut;
-                    reservation.updateDates(newCheckIn, newCheckOut); 
-                    break;
+// --serve port without --console: serves the saved hotel (or an empty in-memory one with
+// --memory) until Ctrl+C or SIGTERM, then writes a snapshot.
+int runServer(const ServeOptions& options) {
+    SocketLibrary sockets;
+    if (!sockets.isReady()) {
+        cerr << "Could not start the socket library.\n";
+        return 1;
+    }
+    Hotel hotel;
+    hotel.setListingFormat(options.format);
+    unique_ptr<HotelStore> store;
+    if (!options.inMemory) {
+        store = make_unique<HotelStore>(hotel, "hotel.snapshot", "hotel.journal");
+        if (!store->open()) seedDefaultRooms(hotel);
+    }
+    HotelServer server(hotel, store.get(), options.threads);
+    if (!server.listenOn(options.host, options.port)) return 1;
+    HotelServer::stopOnSignals();
+    cerr << "Serving on " << options.host << ":" << options.port << " with " << options.threads << " workers.\n";
+    server.run();
+    if (store) store->checkpoint();
+    cerr << "Server stopped.\n";
+    return 0;
 }
 
-                case 4: 
-                    return;
-                default:
-                    cout << "Invalid option.\n";
+// --connect host port: a client for --serve. Sends each line of stdin as a request without
+// waiting for the answers, then prints every response body as it arrives. Returns non-zero if
+// any request was answered with ERR.
+int runClient(const string& host, int port) {
+    SocketLibrary sockets;
+    sockaddr_in address;
+    if (!sockets.isReady() || !parseAddress(host, port, address)) {
+        cerr << "Invalid address " << host << ":" << port << ".\n";
+        return 1;
+    }
+    SocketHandle server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server == NO_SOCKET || connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        cerr << "Could not connect to " << host << ":" << port << ".\n";
+        if (server != NO_SOCKET) closeSocket(server);
+        return 1;
+    }
+
+    thread sender([server] {
+        string line;
+        while (getline(cin, line)) {
+            line += '\n';
+            for (size_t done = 0; done < line.size(); ) {
+                auto sent = send(server, line.data() + done, static_cast<int>(line.size() - done), 0);
+                if (sent <= 0) return;
+                done += static_cast<size_t>(sent);
             }
-            return;
         }
-    }
-    cout << "Reservation not found.\n";
-}
+        shutdownSending(server);
+    });
 
-    int getValidatedInt(const string& prompt) {
+    size_t responses = 0, errors = 0;
+    string pending;
+    char buffer[16 * 1024];
     while (true) {
-        cout << prompt;
-        string input;
-        cin >> input; 
+        auto received = recv(server, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        pending.append(buffer, static_cast<size_t>(received));
+        while (true) {
+            size_t headerEnd = pending.find('\n');
+            if (headerEnd == string::npos) break;
+            bool ok = pending.compare(0, 3, "OK ") == 0;
+            size_t length = static_cast<size_t>(strtoull(pending.c_str() + (ok ? 3 : 4), nullptr, 10));
+            if (pending.size() < headerEnd + 1 + length) break;
+            cout.write(pending.data() + headerEnd + 1, static_cast<streamsize>(length));
+            ++responses;
+            if (!ok) ++errors;
+            pending.erase(0, headerEnd + 1 + length);
+        }
+    }
+    cout.flush();
+    // The sender may still be waiting on stdin if the server went away first.
+    sender.detach();
+    closeSocket(server);
+    cerr << responses << " responses, " << errors << " errors\n";
+    return errors == 0 ? 0 : 2;
+}
 
-        bool allDigits = true;
-        if (input.empty()) {
-            allDigits = false; 
-        } else {
-            for (char c : input) {
-                if (!isdigit(static_cast<unsigned char>(c))) {
-                    allDigits = false; 
-                    break;
-                }
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        int roomCount = argc > 2 ? atoi(argv[2]) : 1000;
+        int reservations = argc > 3 ? atoi(argv[3]) : 10000;
+        if (roomCount < 1 || reservations < 1) {
+            cerr << "Usage: " << argv[0] << " --bench [rooms] [reservations]\n";
+            return 1;
+        }
+        runBenchmark(roomCount, reservations);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-contention") {
+        int threads = argc > 2 ? atoi(argv[2]) : static_cast<int>(max(1u, thread::hardware_concurrency()));
+        int roomCount = argc > 3 ? atoi(argv[3]) : 256;
+        int bookings = argc > 4 ? atoi(argv[4]) : 20000;
+        if (threads < 1 || roomCount < 1 || bookings < 1) {
+            cerr << "Usage: " << argv[0] << " --bench-contention [threads] [rooms] [bookings per thread]\n";
+            return 1;
+        }
+        runContentionBenchmark(threads, roomCount, bookings);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-shards") {
+        int shards = argc > 2 ? atoi(argv[2]) : static_cast<int>(max(1u, thread::hardware_concurrency()));
+        int roomCount = argc > 3 ? atoi(argv[3]) : 256;
+        int bookings = argc > 4 ? atoi(argv[4]) : 20000;
+        if (shards < 1 || shards > ReservationIDs::MAX_SHARDS || roomCount < 1 || bookings < 1) {
+            cerr << "Usage: " << argv[0] << " --bench-shards [shards] [rooms per shard] [bookings per shard]\n";
+            return 1;
+        }
+        runShardBenchmark(shards, roomCount, bookings);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        bool inMemory = false, valid = argc >= 3;
+        ListingFormat format = ListingFormat::TEXT;
+        for (int i = 3; valid && i < argc; ++i) {
+            string option = argv[i];
+            if (option == "--memory") {
+                inMemory = true;
+            } else if (option == "--format" && i + 1 < argc) {
+                string name = argv[++i];
+                if (name == "text") format = ListingFormat::TEXT;
+                else if (name == "csv") format = ListingFormat::CSV;
+                else if (name == "json") format = ListingFormat::JSON;
+                else valid = false;
+            } else {
+                valid = false;
             }
         }
-
-        if (!allDigits) {
-            cout << "\nInvalid input. Please enter numbers only.\n\n";
-            continue; 
+        if (!valid) {
+            cerr << "Usage: " << argv[0] << " --batch <file|-> [--memory] [--format text|csv|json]\n";
+            return 1;
         }
-
-        int value = 0;
-        for (char c : input) {
-            value = value * 10 + (c - '0');
+        return runBatch(argv[2], inMemory, format);
+    }
+    if (argc > 1 && string(argv[1]) == "--import") {
+        string roomsPath, reservationsPath;
+        bool inMemory = false, valid = argc > 2;
+        size_t threads = max(1u, thread::hardware_concurrency());
+        for (int i = 2; valid && i < argc; ++i) {
+            string option = argv[i];
+            if (option == "--rooms" && i + 1 < argc) {
+                roomsPath = argv[++i];
+            } else if (option == "--reservations" && i + 1 < argc) {
+                reservationsPath = argv[++i];
+            } else if (option == "--memory") {
+                inMemory = true;
+            } else if (option == "--threads" && i + 1 < argc) {
+                int count = atoi(argv[++i]);
+                valid = count >= 1;
+                threads = static_cast<size_t>(max(count, 1));
+            } else {
+                valid = false;
+            }
         }
-
-        return value; 
+        if (!valid || (roomsPath.empty() && reservationsPath.empty())) {
+            cerr << "Usage: " << argv[0] << " --import [--rooms file] [--reservations file] [--memory] [--threads n]\n";
+            return 1;
+        }
+        return runImport(roomsPath, reservationsPath, inMemory, threads);
+    }
+    if (argc > 1 && string(argv[1]) == "--connect") {
+        int port = argc == 4 ? atoi(argv[3]) : 0;
+        if (port < 1 || port > 65535) {
+            cerr << "Usage: " << argv[0] << " --connect <host> <port>\n";
+            return 1;
+        }
+        return runClient(argv[2], port);
+    }
+    ServeOptions serve;
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        bool valid = argc >= 3;
+        if (valid) serve.port = atoi(argv[2]);
+        valid = valid && serve.port >= 1 && serve.port <= 65535;
+        for (int i = 3; valid && i < argc; ++i) {
+            string option = argv[i];
+            if (option == "--memory") {
+                serve.inMemory = true;
+            } else if (option == "--console") {
+                serve.console = true;
+            } else if (option == "--host" && i + 1 < argc) {
+                serve.host = argv[++i];
+            } else if (option == "--threads" && i + 1 < argc) {
+                int threads = atoi(argv[++i]);
+                valid = threads >= 1;
+                serve.threads = static_cast<size_t>(max(threads, 1));
+            } else if (option == "--format" && i + 1 < argc) {
+                string name = argv[++i];
+                if (name == "text") serve.format = ListingFormat::TEXT;
+                else if (name == "csv") serve.format = ListingFormat::CSV;
+                else if (name == "json") serve.format = ListingFormat::JSON;
+                else valid = false;
+            } else {
+                valid = false;
+            }
+        }
+        valid = valid && !(serve.console && serve.inMemory);
+        if (!valid) {
+            cerr << "Usage: " << argv[0] << " --serve <port> [--host address] [--threads n] [--memory | --console]"
+                 << " [--format text|csv|json]\n";
+            return 1;
+        }
+        if (!serve.console) return runServer(serve);
     }
-}
-
-};
 
-int main() {
     Hotel hotel;
+    HotelStore store(hotel, "hotel.snapshot", "hotel.journal");
     int mainChoice, reservationChoice;
 
-    hotel.addRoom(101, Room::RoomType::SINGLE, 75.00, make_unique<RegularBilling>(), 1);
-    hotel.addRoom(102, Room::RoomType::SINGLE, 75.00, make_unique<RegularBilling>(), 1);
-    hotel.addRoom(103, Room::RoomType::SINGLE, 80.00, make_unique<PremiumBilling>(), 1);
-    hotel.addRoom(201, Room::RoomType::DOUBLE, 100.00, make_unique<RegularBilling>(), 2);
-    hotel.addRoom(202, Room::RoomType::DOUBLE, 100.00, make_unique<RegularBilling>(), 2);
-    hotel.addRoom(203, Room::RoomType::DOUBLE, 110.00, make_unique<PremiumBilling>(), 2);
-    hotel.addRoom(301, Room::RoomType::DELUXE, 150.00, make_unique<PremiumBilling>(), 4);
-    hotel.addRoom(302, Room::RoomType::DELUXE, 150.00, make_unique<PremiumBilling>(), 4);
-    hotel.addRoom(401, Room::RoomType::SUITE, 250.00, make_unique<PremiumBilling>(), 6);
-    hotel.addRoom(402, Room::RoomType::SUITE, 225.00, make_unique<CorporateBilling>(), 6);
+    if (!store.open()) {
+        seedDefaultRooms(hotel);
+    }
+
+    // --serve port --console: the menus below and the network clients share this Hotel; leaving
+    // the menus stops the server.
+    SocketLibrary sockets;
+    unique_ptr<HotelServer> server;
+    thread serverThread;
+    if (serve.console) {
+        hotel.setListingFormat(serve.format);
+        server = make_unique<HotelServer>(hotel, &store, serve.threads);
+        if (!sockets.isReady() || !server->listenOn(serve.host, serve.port)) return 1;
+        cout << "Serving on " << serve.host << ":" << serve.port << " with " << serve.threads << " workers.\n";
+        serverThread = thread([&server] { server->run(); });
+    }
 
     do {
-        mainChoice = hotel.getValidatedInt("\n========== HOTEL MANAGEMENT SYSTEM ========== \n1. Room Management \n2. Reservation Management \n3. Show Available Rooms \n4. Show All Rooms \n5. Show All Reservations \n6. Show Room Price Rates \n7. Exit \nEnter your choice: ");
+        mainChoice = hotel.getValidatedInt("\n========== HOTEL MANAGEMENT SYSTEM ========== \n1. Room Management \n2. Reservation Management \n3. Show Available Rooms \n4. Show All Rooms \n5. Show All Reservations \n6. Show Room Price Rates \n7. Hotel Statistics \n8. Exit \nEnter your choice: ");
 
 switch (mainChoice) {
     case 1: { 
@@ -598,7 +8057,9 @@ switch (mainChoice) {
             cout << "2. Delete Room\n";
             cout << "3. Update Room Rate\n";
             cout << "4. Update Room Billing Strategy\n";
-            cout << "5. Back to Main Menu\n";
+            cout << "5. Rate Calendar\n";
+            cout << "6. Optimize Room Assignments\n";
+            cout << "7. Back to Main Menu\n";
             roomChoice = hotel.getValidatedInt("Enter your choice: ");
             switch (roomChoice) {
                 case 1: { 
@@ -608,15 +8069,9 @@ switch (mainChoice) {
 
                     do {
                         roomNumber = hotel.getValidatedInt("Enter room number: ");
-                        roomExists = false;
-
-                        
-                        for (const auto& room : hotel.getRooms()) {
-                            if (room.getRoomNumber() == roomNumber) {
-                                roomExists = true;
-                                cout << "Room " << roomNumber << " already exists. Please enter a different room number.\n";
-                                break; 
-                            }
+                        roomExists = hotel.hasRoom(roomNumber);
+                        if (roomExists) {
+                            cout << "Room " << roomNumber << " already exists. Please enter a different room number.\n";
                         }
                     } while (roomExists); 
 
@@ -624,43 +8079,20 @@ switch (mainChoice) {
                     cout << "Enter base rate per night: $";
                     cin >> baseRate;
                     cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                    cout << "\nRoom Types:\n";
-                    cout << "1. Single (Max 1 guest)\n";
-                    cout << "2. Double (Max 2 guests)\n";
-                    cout << "3. Deluxe (Max 4 guests)\n";
-                    cout << "4. Suite (Max 6 guests)\n";
-                    int roomTypeChoice = hotel.getValidatedInt("Select room type (1-4): ");
-                    Room::RoomType roomType = static_cast<Room::RoomType>(roomTypeChoice - 1);
-                    int maxGuests = 1;
-                    switch (roomType) {
-                        case Room::RoomType::SINGLE: maxGuests = 1; break;
-                        case Room::RoomType::DOUBLE: maxGuests = 2; break;
-                        case Room::RoomType::DELUXE: maxGuests = 4; break;
-                        case Room::RoomType::SUITE: maxGuests = 6; break;
-                        default: maxGuests = 1; break;
+                    printRoomTypeMenu();
+                    optional<Room::RoomType> roomType = Room::typeFromMenu(hotel.getValidatedInt("Select room type (1-" + to_string(Room::TYPE_COUNT) + "): "));
+                    if (!roomType) {
+                        cout << "Invalid room type choice.\n";
+                        continue;
                     }
-                    cout << "\nBilling Strategies:\n";
-                    cout << "1. Regular Rate\n";
-                    cout << "2. Premium Rate (10% service charge)\n";
-                    cout << "3. Corporate Rate (15% discount)\n";
-                    int billingStrategyChoice = hotel.getValidatedInt("Select billing strategy (1-3): ");
-                    unique_ptr<BillingStrategy> billingStrategy;
-
-                    switch (billingStrategyChoice) {
-                        case 1:
-                            billingStrategy = make_unique<RegularBilling>();
-                            break;
-                        case 2:
-                            billingStrategy = make_unique<PremiumBilling>();
-                            break;
-                        case 3:
-                            billingStrategy = make_unique<CorporateBilling>();
-                            break;
-                        default:
-                            cout << "Invalid billing strategy choice.\n";
-                            continue; 
+                    int maxGuests = Room::defaultMaxGuests(*roomType);
+                    printBillingMenu();
+                    optional<BillingStrategy> billingStrategy = billingFromMenu(hotel.getValidatedInt("Select billing strategy (1-" + to_string(BILLING_KINDS.size()) + "): "));
+                    if (!billingStrategy) {
+                        cout << "Invalid billing strategy choice.\n";
+                        continue; 
                     }
-                    hotel.addRoom(roomNumber, roomType, baseRate, move(billingStrategy), maxGuests);
+                    hotel.addRoom(roomNumber, *roomType, baseRate, *billingStrategy, maxGuests);
                     cout << "\n==========================\n";
                     cout << "Room added successfully!\n";
                     cout << "============================\n";
@@ -688,46 +8120,118 @@ switch (mainChoice) {
                     cout << "\n========== UPDATE ROOM BILLING STRATEGY ========== \n";
                     hotel.showAllRooms();
                     int roomNumberToUpdate = hotel.getValidatedInt("Enter room number to update: ");
-                    cout << "\nBilling Strategies:\n";
-                    cout << "1. Regular Rate\n";
-                    cout << "2. Premium Rate (10% service charge)\n";
-                    cout << "3. Corporate Rate (15% discount)\n";
-                    int newBillingStrategyChoice = hotel.getValidatedInt("Select new billing strategy (1-3): ");
-                    unique_ptr<BillingStrategy> newBillingStrategy;
-                    switch (newBillingStrategyChoice) {
-                        case 1:
-                            newBillingStrategy = make_unique<RegularBilling>();
+                    printBillingMenu();
+                    optional<BillingStrategy> newBillingStrategy = billingFromMenu(hotel.getValidatedInt("Select new billing strategy (1-" + to_string(BILLING_KINDS.size()) + "): "));
+                    if (!newBillingStrategy) {
+                        cout << "Invalid billing strategy choice.\n";
+                        continue; 
+                    }
+                    hotel.updateRoomBillingStrategy(roomNumberToUpdate, *newBillingStrategy);
+                    break;
+                }
+                case 5: {
+                    cout << "\n========== RATE CALENDAR ========== \n";
+                    optional<Room::RoomType> chosenType = Room::typeFromMenu(hotel.getValidatedInt("Room type (" + Room::typeChoices() + "): "));
+                    if (!chosenType) {
+                        cout << "Invalid room type choice.\n";
+                        continue;
+                    }
+                    Room::RoomType rateType = *chosenType;
+                    hotel.showRateRules(rateType);
+                    cout << "1. Seasonal Rate\n";
+                    cout << "2. Weekday Rate\n";
+                    cout << "3. Single Night Rate\n";
+                    cout << "4. Length-of-Stay Discount\n";
+                    cout << "5. Clear Rate Calendar\n";
+                    cout << "6. Quote a Stay\n";
+                    cout << "7. Back\n";
+                    int rateChoice = hotel.getValidatedInt("Enter your choice: ");
+                    double value;
+                    switch (rateChoice) {
+                        case 1: {
+                            Date from = hotel.getValidatedDate("Enter first night of the season (DD/MM/YYYY): ");
+                            Date to = hotel.getValidatedDate("Enter the day after its last night (DD/MM/YYYY): ");
+                            cout << "Enter price factor of the base rate (1.00 = base rate): ";
+                            cin >> value;
+                            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                            hotel.setSeasonRate(rateType, from, to, value);
+                            break;
+                        }
+                        case 2: {
+                            int weekday = hotel.getValidatedInt("Enter weekday (1 Monday ... 7 Sunday): ");
+                            cout << "Enter price factor of the base rate (1.00 = base rate): ";
+                            cin >> value;
+                            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                            hotel.setWeekdayRate(rateType, weekday - 1, value);
                             break;
-                        case 2:
-                            newBillingStrategy = make_unique<PremiumBilling>();
+                        }
+                        case 3: {
+                            Date night = hotel.getValidatedDate("Enter the night (DD/MM/YYYY): ");
+                            cout << "Enter price factor of the base rate (1.00 = base rate): ";
+                            cin >> value;
+                            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                            hotel.setNightRate(rateType, night, value);
+                            break;
+                        }
+                        case 4: {
+                            int minNights = hotel.getValidatedInt("Enter minimum number of nights: ");
+                            cout << "Enter discount percent (0 removes it): ";
+                            cin >> value;
+                            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                            hotel.setStayDiscount(rateType, minNights, value);
+                            break;
+                        }
+                        case 5:
+                            hotel.clearRates(rateType);
+                            break;
+                        case 6: {
+                            int quoteRoom = hotel.getValidatedInt("Enter room number: ");
+                            Date checkIn = hotel.getValidatedDate("Enter check-in date (DD/MM/YYYY): ");
+                            Date checkOut = hotel.getValidatedDate("Enter check-out date (DD/MM/YYYY): ");
+                            if (checkOut <= checkIn) cout << "Invalid date range.\n";
+                            else hotel.showQuote(quoteRoom, checkIn, checkOut);
                             break;
-                        case 3:
-                            newBillingStrategy = make_unique<CorporateBilling>();
+                        }
+                        case 7:
                             break;
                         default:
-                            cout << "Invalid billing strategy choice.\n";
-                            continue; 
+                            cout << "Invalid choice.\n";
+                    }
+                    break;
+                }
+                case 6: {
+                    cout << "\n========== OPTIMIZE ROOM ASSIGNMENTS ==========\n";
+                    AssignmentOptions settings;
+                    settings.from = hotel.getValidatedDate("Enter first check-in date to repack (DD/MM/YYYY): ");
+                    settings.to = hotel.getValidatedDate("Enter the date after the last one (DD/MM/YYYY): ");
+                    int lockedID;
+                    while ((lockedID = hotel.getValidatedInt("Enter a reservation ID to keep in its room (0 when done): ")) != 0) {
+                        settings.locked.insert(lockedID);
+                    }
+                    try {
+                        hotel.optimizeAssignments(settings);
+                    } catch (const exception& e) {
+                        cout << "Error: " << e.what() << endl;
                     }
-                    hotel.updateRoomBillingStrategy(roomNumberToUpdate, move(newBillingStrategy));
                     break;
                 }
-                case 5: 
+                case 7: 
                     break;
                 default:
                     cout << "Invalid choice. Please try again.\n";
             }
-        } while (roomChoice != 5);
+        } while (roomChoice != 7);
         break;
     }
     case 2: 
                 do {
                     cout << "\n========== RESERVATION MANAGEMENT ========== \n";
-                    reservationChoice = hotel.getValidatedInt("1. Make New Reservation \n2. Cancel Reservation \n3. View Reservation Details \n4. Update Reservation \n5. Back to Main Menu \nEnter your choice: ");
+                    reservationChoice = hotel.getValidatedInt("1. Make New Reservation \n2. Cancel Reservation \n3. View Reservation Details \n4. Update Reservation \n5. Search Available Rooms by Date \n6. Find Guest \n7. Block Booking \n8. Show Waitlist \n9. Check Out Guest \n10. Stay History \n11. Back to Main Menu \nEnter your choice: ");
 
                     try {
                         switch (reservationChoice) {
                            case 1: { 
-    string guestName, contactInfo, checkIn, checkOut;
+    string guestName, contactInfo;
     int roomNumber, guests;
     cout << "\n========== MAKE NEW RESERVATION ========== \n";
     hotel.showAvailableRooms();
@@ -737,14 +8241,32 @@ switch (mainChoice) {
     cout << "Enter contact information: ";
     getline(cin >> ws, contactInfo); 
     
-    roomNumber = hotel.getValidatedInt("Enter room number: ");
-    cout << "Enter check-in date (DD/MM/YYYY): ";
-    cin >> checkIn;
-    cout << "Enter check-out date (DD/MM/YYYY): ";
-    cin >> checkOut;
+    roomNumber = hotel.getValidatedInt("Enter room number (0 to assign one automatically): ");
+    Date checkIn = hotel.getValidatedDate("Enter check-in date (DD/MM/YYYY): ");
+    Date checkOut = hotel.getValidatedDate("Enter check-out date (DD/MM/YYYY): ");
     guests = hotel.getValidatedInt("Enter number of guests: ");
     
-    hotel.makeReservation(guestName, contactInfo, roomNumber, checkIn, checkOut, guests);
+    optional<Room::RoomType> roomType;
+    int reservationID;
+    if (roomNumber == 0) {
+        roomType = Room::typeFromMenu(hotel.getValidatedInt("Room type (" + Room::typeChoices() + ", 0 any): "));
+        reservationID = hotel.autoAssignReservation(guestName, contactInfo, roomType, checkIn, checkOut, guests);
+    } else {
+        reservationID = hotel.makeReservation(guestName, contactInfo, roomNumber, checkIn, checkOut, guests);
+        roomType = hotel.roomTypeOf(roomNumber);
+    }
+    if (reservationID == 0 && roomType && checkIn < checkOut) {
+        string answer;
+        cout << "Join the " << Room::typeLabel(*roomType) << " waitlist for these dates? (y/n): ";
+        getline(cin >> ws, answer);
+        if (!answer.empty() && tolower(static_cast<unsigned char>(answer[0])) == 'y') {
+            int tier = hotel.getValidatedInt("Loyalty tier (0 none to 3): ");
+            cout << "Corporate account? (y/n): ";
+            getline(cin >> ws, answer);
+            bool corporate = !answer.empty() && tolower(static_cast<unsigned char>(answer[0])) == 'y';
+            hotel.joinWaitlist(guestName, contactInfo, *roomType, checkIn, checkOut, guests, tier, corporate);
+        }
+    }
 
     break;
 }
@@ -774,7 +8296,81 @@ switch (mainChoice) {
                                 hotel.updateReservation(reservationID);
                                 break;
                             }
-                            case 5: 
+                            case 5: {
+                                cout << "\n========== SEARCH AVAILABLE ROOMS ========== \n";
+                                Date checkIn = hotel.getValidatedDate("Enter check-in date (DD/MM/YYYY): ");
+                                Date checkOut = hotel.getValidatedDate("Enter check-out date (DD/MM/YYYY): ");
+                                int guests = hotel.getValidatedInt("Enter number of guests: ");
+                                printRoomTypeMenu();
+                                optional<Room::RoomType> roomType = Room::typeFromMenu(hotel.getValidatedInt("Select room type (1-" + to_string(Room::TYPE_COUNT) + "): "));
+                                if (!roomType) {
+                                    cout << "Invalid room type.\n";
+                                    break;
+                                }
+                                hotel.showAvailableRooms(checkIn, checkOut, guests, *roomType);
+                                break;
+                            }
+                            case 6: {
+                                string query;
+                                cout << "\n========== FIND GUEST ========== \n";
+                                cout << "Enter part of the guest name or contact: ";
+                                getline(cin >> ws, query);
+                                hotel.showGuests(query);
+                                break;
+                            }
+                            case 7: {
+                                string guestName, contactInfo;
+                                cout << "\n========== BLOCK BOOKING ========== \n";
+                                cout << "Enter group or guest name: ";
+                                getline(cin >> ws, guestName);
+                                cout << "Enter contact information: ";
+                                getline(cin >> ws, contactInfo);
+                                Date checkIn = hotel.getValidatedDate("Enter check-in date (DD/MM/YYYY): ");
+                                Date checkOut = hotel.getValidatedDate("Enter check-out date (DD/MM/YYYY): ");
+                                int guests = hotel.getValidatedInt("Enter number of guests per room: ");
+                                optional<Room::RoomType> roomType = Room::typeFromMenu(hotel.getValidatedInt("Room type (" + Room::typeChoices() + ", 0 to list room numbers): "));
+                                if (roomType) {
+                                    int roomCount = hotel.getValidatedInt("Enter number of rooms: ");
+                                    hotel.reserveBlock(guestName, contactInfo, *roomType, roomCount, checkIn, checkOut, guests);
+                                    break;
+                                }
+                                vector<int> roomNumbers;
+                                int roomNumber;
+                                while ((roomNumber = hotel.getValidatedInt("Enter room number (0 when done): ")) != 0) {
+                                    roomNumbers.push_back(roomNumber);
+                                }
+                                hotel.reserveBlock(guestName, contactInfo, roomNumbers, checkIn, checkOut, guests);
+                                break;
+                            }
+                            case 8: {
+                                hotel.showWaitlist();
+                                if (!hotel.waitingRequests().empty()) {
+                                    int waitID = hotel.getValidatedInt("Enter waitlist # to remove (0 to keep all): ");
+                                    if (waitID != 0) hotel.leaveWaitlist(waitID);
+                                }
+                                break;
+                            }
+                            case 9: {
+                                int reservationID = hotel.getValidatedInt("Enter reservation ID to check out: ");
+                                hotel.checkOutReservation(reservationID);
+                                break;
+                            }
+                            case 10: {
+                                int archiveChoice = hotel.getValidatedInt("1. Archive stays that have ended \n2. Report on every archived month \n3. Report on a date range \nEnter your choice: ");
+                                if (archiveChoice == 1) {
+                                    hotel.archiveCompletedStays(Date::today());
+                                } else if (archiveChoice == 2) {
+                                    hotel.showArchiveReport();
+                                } else if (archiveChoice == 3) {
+                                    Date from = hotel.getValidatedDate("Enter first night (DD/MM/YYYY): ");
+                                    Date to = hotel.getValidatedDate("Enter the day after the last night (DD/MM/YYYY): ");
+                                    hotel.showArchiveReport(from, to);
+                                } else {
+                                    cout << "Invalid choice.\n";
+                                }
+                                break;
+                            }
+                            case 11: 
                                 break;
                             default:
                                 cout << "Invalid choice. Please try again.\n";
@@ -782,7 +8378,7 @@ switch (mainChoice) {
                     } catch (const exception& e) {
                         cout << "Error: " << e.what() << endl;
                     }
-                } while (reservationChoice != 5);
+                } while (reservationChoice != 11);
                 break;
 
             case 3:
@@ -802,16 +8398,31 @@ switch (mainChoice) {
                 hotel.showRoomPriceRates();
                 break;
             }
-            case 7: 
+            case 7:
+                hotel.showStats();
+                hotel.showMetrics();
+#ifdef HOTEL_INSTRUMENTATION
+                hotel.dumpMetrics("hotel.metrics");
+#endif
+                break;
+
+            case 8: 
                 cout << "\n========== EXITING HOTEL MANAGEMENT SYSTEM ==========\n";
                 cout << "Thank you for using the Hotel Management System. Goodbye! \n";
                 cout << "======================================================\n\n";
+                store.checkpoint();
                 break;
 
             default:
                 cout << "Invalid choice. Please try again.\n";
         }
-    } while (mainChoice != 7);
+        store.flush();
+    } while (mainChoice != 8);
 
+    if (server) {
+        server->stop();
+        serverThread.join();
+        store.checkpoint();
+    }
     return 0;
 }